@@ -8,10 +8,16 @@ mkdir -p out &
 mkdir -p log &
 
 # Compile process A
-gcc src/processA.c -lncurses -lbmp -lm -o bin/processA &
+gcc src/processA.c -lncurses -lm -lpthread -o bin/processA &
 
 # Compile process B
-gcc src/processB.c -lncurses -lbmp -lm -o bin/processB &
+gcc src/processB.c -lncurses -lm -lpthread -o bin/processB &
+
+# Compile the benchmarks
+gcc -DARP_WITH_LIBBMP src/benchmark.c -lbmp -lm -lrt -lpthread -o bin/benchmark &
+
+# Compile the load generator
+gcc src/arp_loadgen.c -o bin/arp_loadgen &
 
 # Compile master process
-gcc src/master.c -o bin/master
\ No newline at end of file
+gcc src/master.c -lpthread -o bin/master
\ No newline at end of file
@@ -0,0 +1,485 @@
+#include "pixel_kernels.h"
+#include "integral_image.h"
+#include "frame_pyramid.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum number of objects reported for a single frame
+#define MAX_BLOBS 32
+
+// Typedef for a horizontal run of non-black pixels, covering [x_start, x_end) on row y
+typedef struct {
+    int y;
+    int x_start, x_end;
+    int parent;
+}RUN;
+
+// Typedef for a connected component of non-black pixels
+typedef struct {
+    int area;
+    int center_x, center_y;
+    int min_x, min_y, max_x, max_y;
+}BLOB;
+
+// Typedef for the labelling state, kept between frames to reuse the run buffer
+typedef struct {
+    RUN *runs;
+    int n_runs;
+    int capacity;
+    // Index of the first run of the previous row and of the current row
+    int prev_row;
+    int curr_row;
+    // Scratch buffers used when collecting the components
+    int *label;
+    long long *sum_x;
+    long long *sum_y;
+    int scratch_capacity;
+}LABELLER;
+
+// Method to find the root of a run, halving the path on the way
+int find_root(RUN *runs, int i) {
+    while (runs[i].parent != i) {
+        runs[i].parent = runs[runs[i].parent].parent;
+        i = runs[i].parent;
+    }
+    return i;
+}
+
+// Method to merge the components of two runs
+void union_runs(RUN *runs, int a, int b) {
+    a = find_root(runs, a);
+    b = find_root(runs, b);
+
+    // Keep the root with the lowest index so that labels follow scan order
+    if (a < b) {
+        runs[b].parent = a;
+    }
+    else if (b < a) {
+        runs[a].parent = b;
+    }
+}
+
+// Method to prepare the labeller for a new frame
+void labeller_reset(LABELLER *lab) {
+    lab->n_runs = 0;
+    lab->prev_row = 0;
+    lab->curr_row = 0;
+}
+
+// Method to free the labeller buffers
+void labeller_destroy(LABELLER *lab) {
+    free(lab->runs);
+    free(lab->label);
+    free(lab->sum_x);
+    free(lab->sum_y);
+    memset(lab, 0, sizeof(LABELLER));
+}
+
+/*
+ * Method to add a run of the current row. Runs must be added left to right;
+ * the run is joined to every run of the previous row it touches.
+ * Returns -1 if the run buffer cannot grow.
+ */
+int labeller_add_run(LABELLER *lab, int y, int x_start, int x_end) {
+
+    // Grow the run buffer if needed
+    if (lab->n_runs == lab->capacity) {
+        int capacity = lab->capacity == 0 ? 1024 : lab->capacity * 2;
+        RUN *runs = realloc(lab->runs, capacity * sizeof(RUN));
+        if (runs == NULL) {
+            return -1;
+        }
+        lab->runs = runs;
+        lab->capacity = capacity;
+    }
+
+    int n = lab->n_runs++;
+    lab->runs[n].y = y;
+    lab->runs[n].x_start = x_start;
+    lab->runs[n].x_end = x_end;
+    lab->runs[n].parent = n;
+
+    // Join with the overlapping runs of the previous row, skipping the ones on the left
+    while (lab->prev_row < lab->curr_row && lab->runs[lab->prev_row].x_end <= x_start) {
+        lab->prev_row++;
+    }
+    for (int k = lab->prev_row; k < lab->curr_row && lab->runs[k].x_start < x_end; k++) {
+        union_runs(lab->runs, n, k);
+    }
+
+    return 0;
+}
+
+// Method to close the current row, making its runs the previous row of the next one
+void labeller_end_row(LABELLER *lab) {
+    lab->prev_row = lab->curr_row;
+    lab->curr_row = lab->n_runs;
+}
+
+/*
+ * Method to label the rows [y_start, y_end) of a frame stored row by row.
+ * Returns -1 if the run buffer cannot grow.
+ */
+int label_frame_rows(const rgb_pixel_t *frame, int width, LABELLER *lab, int y_start, int y_end) {
+    labeller_reset(lab);
+
+    for (int y = y_start; y < y_end; y++) {
+        const rgb_pixel_t *row = frame + (size_t)y * width;
+
+        // Extract the runs of non-black pixels of the row
+        int x = 0;
+        while (x < width) {
+            int start = frame_skip_black(row, x, width);
+            x = frame_skip_nonblack(row, start, width);
+            if (x > start && labeller_add_run(lab, y, start, x) == -1) {
+                return -1;
+            }
+        }
+
+        labeller_end_row(lab);
+    }
+
+    return 0;
+}
+
+/*
+ * Method to merge the labellers of consecutive horizontal stripes into dst.
+ * The runs of each stripe are appended to dst and the last row of every stripe is
+ * joined with the first row of the next one. Returns -1 if dst cannot grow.
+ */
+int labeller_merge(LABELLER *dst, LABELLER *stripes, int n_stripes) {
+    labeller_reset(dst);
+
+    // First run of the last row of the previous stripe, in dst indices
+    int prev_last_row = 0;
+
+    for (int s = 0; s < n_stripes; s++) {
+        LABELLER *src = &stripes[s];
+        int offset = dst->n_runs;
+
+        // Grow the run buffer if needed
+        if (dst->capacity < offset + src->n_runs) {
+            int capacity = dst->capacity == 0 ? 1024 : dst->capacity;
+            while (capacity < offset + src->n_runs) {
+                capacity *= 2;
+            }
+            RUN *runs = realloc(dst->runs, capacity * sizeof(RUN));
+            if (runs == NULL) {
+                return -1;
+            }
+            dst->runs = runs;
+            dst->capacity = capacity;
+        }
+
+        // Append the runs, moving the parents to the new indices
+        for (int i = 0; i < src->n_runs; i++) {
+            dst->runs[offset + i] = src->runs[i];
+            dst->runs[offset + i].parent += offset;
+        }
+        dst->n_runs += src->n_runs;
+
+        // Join the first row of this stripe with the last row of the previous one
+        if (s > 0 && offset > prev_last_row && src->n_runs > 0) {
+            int first_y = src->runs[0].y;
+            int k = prev_last_row;
+            for (int i = offset; i < dst->n_runs && dst->runs[i].y == first_y; i++) {
+                RUN *run = &dst->runs[i];
+
+                // Skip the runs entirely on the left, then join the overlapping ones
+                while (k < offset && dst->runs[k].x_end <= run->x_start) {
+                    k++;
+                }
+                for (int m = k; m < offset && dst->runs[m].x_start < run->x_end; m++) {
+                    if (dst->runs[m].y == first_y - 1) {
+                        union_runs(dst->runs, i, m);
+                    }
+                }
+            }
+        }
+
+        // After the last labeller_end_row, prev_row is the first run of the last row
+        prev_last_row = offset + src->prev_row;
+    }
+
+    return 0;
+}
+
+/*
+ * Method to collect the components found in the frame into blobs.
+ * Returns the number of components, of which at most max_blobs are stored,
+ * or -1 if the scratch buffers cannot be allocated.
+ */
+int labeller_collect(LABELLER *lab, BLOB *blobs, int max_blobs) {
+
+    // Grow the scratch buffers if needed
+    if (lab->scratch_capacity < lab->n_runs) {
+        free(lab->label);
+        free(lab->sum_x);
+        free(lab->sum_y);
+        lab->label = malloc(lab->capacity * sizeof(int));
+        lab->sum_x = malloc(lab->capacity * sizeof(long long));
+        lab->sum_y = malloc(lab->capacity * sizeof(long long));
+        if (lab->label == NULL || lab->sum_x == NULL || lab->sum_y == NULL) {
+            lab->scratch_capacity = 0;
+            return -1;
+        }
+        lab->scratch_capacity = lab->capacity;
+    }
+
+    int n_blobs = 0;
+
+    for (int i = 0; i < lab->n_runs; i++) {
+        RUN *run = &lab->runs[i];
+        int root = find_root(lab->runs, i);
+        int length = run->x_end - run->x_start;
+
+        // A run that is its own root starts a new component
+        if (root == i) {
+            lab->label[i] = n_blobs;
+            if (n_blobs < max_blobs) {
+                BLOB *blob = &blobs[n_blobs];
+                blob->area = 0;
+                blob->min_x = run->x_start;
+                blob->max_x = run->x_end - 1;
+                blob->min_y = run->y;
+                blob->max_y = run->y;
+                lab->sum_x[n_blobs] = 0;
+                lab->sum_y[n_blobs] = 0;
+            }
+            n_blobs++;
+        }
+        else {
+            lab->label[i] = lab->label[root];
+        }
+
+        // Accumulate area, bounding box and coordinate sums
+        int l = lab->label[i];
+        if (l < max_blobs) {
+            BLOB *blob = &blobs[l];
+            blob->area += length;
+            if (run->x_start < blob->min_x) blob->min_x = run->x_start;
+            if (run->x_end - 1 > blob->max_x) blob->max_x = run->x_end - 1;
+            if (run->y > blob->max_y) blob->max_y = run->y;
+            lab->sum_x[l] += (long long)(run->x_start + run->x_end - 1) * length / 2;
+            lab->sum_y[l] += (long long)run->y * length;
+        }
+    }
+
+    // Compute the centroids
+    for (int l = 0; l < n_blobs && l < max_blobs; l++) {
+        blobs[l].center_x = lab->sum_x[l] / blobs[l].area;
+        blobs[l].center_y = lab->sum_y[l] / blobs[l].area;
+    }
+
+    return n_blobs;
+}
+
+/*
+ * Method to find the components of the frame with its integral image, coarse
+ * to fine: the cells of INTEGRAL_CELL pixels holding non-black pixels are
+ * found with one query each and grouped by adjacency, then the area is
+ * counted over the cells of each group and the cells on its border are
+ * shrunk to the bounding box of its pixels with binary searches, so that the
+ * objects whose cells fall in the rectangle of the group are left out.
+ * The cost depends on the size of the grid and of the objects, not on the
+ * scan order of the frame. Objects closer than a cell are reported as one,
+ * and the center is the center of the bounding box, the centroid of the
+ * circles drawn by processA. Returns the number of components, of which at
+ * most max_blobs are stored.
+ */
+int integral_find_blobs(INTEGRAL_IMAGE *ii, BLOB *blobs, int max_blobs) {
+    // Mark the cells holding non-black pixels as not visited, the others as empty
+    for (int row = 0; row < ii->rows; row++) {
+        int min_y = row * INTEGRAL_CELL;
+        int max_y = min_y + INTEGRAL_CELL > ii->height ? ii->height - 1 : min_y + INTEGRAL_CELL - 1;
+        for (int col = 0; col < ii->cols; col++) {
+            int min_x = col * INTEGRAL_CELL;
+            int max_x = min_x + INTEGRAL_CELL > ii->width ? ii->width - 1 : min_x + INTEGRAL_CELL - 1;
+            ii->cells[row * ii->cols + col] = integral_box(ii, min_x, min_y, max_x, max_y) > 0 ? -1 : -2;
+        }
+    }
+
+    int n_blobs = 0;
+    for (int start = 0; start < ii->cols * ii->rows; start++) {
+        if (ii->cells[start] != -1) {
+            continue;
+        }
+
+        // Flood the group of adjacent occupied cells, keeping its rectangle in cells
+        RECT group = {start % ii->cols, start / ii->cols, start % ii->cols, start / ii->cols};
+        int top = 0;
+        ii->stack[top++] = start;
+        ii->cells[start] = n_blobs;
+        while (top > 0) {
+            int cell = ii->stack[--top];
+            int col = cell % ii->cols, row = cell / ii->cols;
+            RECT here = {col, row, col, row};
+            group = rect_union(group, here);
+
+            int neighbours[4] = {col > 0 ? cell - 1 : -1, col + 1 < ii->cols ? cell + 1 : -1,
+                                 row > 0 ? cell - ii->cols : -1, row + 1 < ii->rows ? cell + ii->cols : -1};
+            for (int k = 0; k < 4; k++) {
+                if (neighbours[k] != -1 && ii->cells[neighbours[k]] == -1) {
+                    ii->cells[neighbours[k]] = n_blobs;
+                    ii->stack[top++] = neighbours[k];
+                }
+            }
+        }
+
+        // Count the pixels of the cells of the group, and shrink the cells on its border to the pixels
+        if (n_blobs < max_blobs) {
+            BLOB *blob = &blobs[n_blobs];
+            RECT box = {0, 0, -1, -1};
+            blob->area = 0;
+            for (int row = group.min_y; row <= group.max_y; row++) {
+                for (int col = group.min_x; col <= group.max_x; col++) {
+                    if (ii->cells[row * ii->cols + col] != n_blobs) {
+                        continue;
+                    }
+                    RECT cell = {col * INTEGRAL_CELL, row * INTEGRAL_CELL, (col + 1) * INTEGRAL_CELL - 1, (row + 1) * INTEGRAL_CELL - 1};
+                    cell.max_x = cell.max_x >= ii->width ? ii->width - 1 : cell.max_x;
+                    cell.max_y = cell.max_y >= ii->height ? ii->height - 1 : cell.max_y;
+                    blob->area += integral_box(ii, cell.min_x, cell.min_y, cell.max_x, cell.max_y);
+                    if (col == group.min_x || col == group.max_x || row == group.min_y || row == group.max_y) {
+                        box = rect_union(box, integral_refine(ii, cell));
+                    }
+                }
+            }
+
+            blob->min_x = box.min_x;
+            blob->min_y = box.min_y;
+            blob->max_x = box.max_x;
+            blob->max_y = box.max_y;
+            blob->center_x = (box.min_x + box.max_x) / 2;
+            blob->center_y = (box.min_y + box.max_y) / 2;
+        }
+        n_blobs++;
+    }
+
+    return n_blobs;
+}
+
+/*
+ * Method to find the components of the frame with its occupancy pyramid,
+ * coarse to fine: the occupied cells of the first level are collected by
+ * descending only into the occupied cells of the levels above, grouped by
+ * adjacency, and only the pixels of the rectangle of each group are read,
+ * counting those in the cells of the group, to get the area, bounding box
+ * and centroid as the labelling does, without the pixels of the objects
+ * whose cells fall in the same rectangle. The
+ * cost depends on the size of the coarsest level and of the objects, not on
+ * the size of the frame. Objects closer than a cell of the first level are
+ * reported as one. Returns the number of components, of which at most
+ * max_blobs are stored.
+ */
+int pyramid_find_blobs(const PYRAMID_LEVEL *levels, const uint8_t *base, const rgb_pixel_t *frame, int width, int height,
+                       PYRAMID_SEARCH *search, BLOB *blobs, int max_blobs) {
+    const PYRAMID_LEVEL *top = &levels[PYRAMID_LEVELS - 1];
+    const uint8_t *top_cells = base + top->offset;
+    const PYRAMID_LEVEL *first = &levels[0];
+    const uint8_t *cells = base + first->offset;
+
+    // Collect the occupied cells of the first level
+    int n_cells = 0;
+    for (int row = 0; row < top->height; row++) {
+        for (int col = 0; col < top->width; col++) {
+            if (top_cells[(size_t)row * top->width + col]) {
+                n_cells = pyramid_collect(levels, base, PYRAMID_LEVELS - 1, col, row, search->cells, n_cells);
+            }
+        }
+    }
+
+    // A new mark for each group of this search, the marks are cleared only when the stamps wrap around
+    if (search->stamp > UINT32_MAX - (uint32_t)n_cells - 1) {
+        memset(search->visited, 0, (size_t)search->capacity * sizeof(uint32_t));
+        search->stamp = 0;
+    }
+    uint32_t first_stamp = search->stamp + 1;
+
+    int n_blobs = 0;
+    for (int i = 0; i < n_cells; i++) {
+        int start = search->cells[i];
+        if (search->visited[start] >= first_stamp) {
+            continue;
+        }
+
+        // Flood the group of adjacent occupied cells, keeping its rectangle in cells
+        uint32_t stamp = ++search->stamp;
+        RECT group = {start % first->width, start / first->width, start % first->width, start / first->width};
+        int depth = 0;
+        search->stack[depth++] = start;
+        search->visited[start] = stamp;
+        while (depth > 0) {
+            int cell = search->stack[--depth];
+            int col = cell % first->width, row = cell / first->width;
+            RECT here = {col, row, col, row};
+            group = rect_union(group, here);
+
+            int neighbours[4] = {col > 0 ? cell - 1 : -1, col + 1 < first->width ? cell + 1 : -1,
+                                 row > 0 ? cell - first->width : -1, row + 1 < first->height ? cell + first->width : -1};
+            for (int k = 0; k < 4; k++) {
+                if (neighbours[k] != -1 && cells[neighbours[k]] && search->visited[neighbours[k]] < first_stamp) {
+                    search->visited[neighbours[k]] = stamp;
+                    search->stack[depth++] = neighbours[k];
+                }
+            }
+        }
+        if (n_blobs >= max_blobs) {
+            n_blobs++;
+            continue;
+        }
+
+        // Read the runs of the pixels of the rectangle of the group only, split at the cells of the other groups
+        int x_start = group.min_x * PYRAMID_FACTOR;
+        int x_end = (group.max_x + 1) * PYRAMID_FACTOR < width ? (group.max_x + 1) * PYRAMID_FACTOR : width;
+        int y_end = (group.max_y + 1) * PYRAMID_FACTOR < height ? (group.max_y + 1) * PYRAMID_FACTOR : height;
+        BLOB *blob = &blobs[n_blobs];
+        blob->area = 0;
+        blob->min_x = x_end;
+        blob->max_x = -1;
+        blob->min_y = y_end;
+        blob->max_y = -1;
+        long long sum_x = 0, sum_y = 0;
+        for (int y = group.min_y * PYRAMID_FACTOR; y < y_end; y++) {
+            const rgb_pixel_t *row = frame + (size_t)y * width;
+            const uint32_t *marks = search->visited + (size_t)(y / PYRAMID_FACTOR) * first->width;
+            int x = frame_skip_black(row, x_start, x_end);
+            while (x < x_end) {
+                int end = frame_skip_nonblack(row, x, x_end);
+
+                // Each piece of the run spans the consecutive cells with the same owner
+                int from = x;
+                while (from < end) {
+                    int own = marks[from / PYRAMID_FACTOR] == stamp;
+                    int to = (from / PYRAMID_FACTOR + 1) * PYRAMID_FACTOR;
+                    while (to < end && (marks[to / PYRAMID_FACTOR] == stamp) == own) {
+                        to += PYRAMID_FACTOR;
+                    }
+                    to = to < end ? to : end;
+                    if (own) {
+                        int length = to - from;
+                        blob->area += length;
+                        if (from < blob->min_x) blob->min_x = from;
+                        if (to - 1 > blob->max_x) blob->max_x = to - 1;
+                        if (y < blob->min_y) blob->min_y = y;
+                        blob->max_y = y;
+                        sum_x += (long long)(from + to - 1) * length / 2;
+                        sum_y += (long long)y * length;
+                    }
+                    from = to;
+                }
+                x = frame_skip_black(row, end, x_end);
+            }
+        }
+
+        // The cells may be ahead of the pixels of a frame being drawn, whose read is started again anyway
+        if (blob->area == 0) {
+            continue;
+        }
+        blob->center_x = sum_x / blob->area;
+        blob->center_y = sum_y / blob->area;
+        n_blobs++;
+    }
+
+    return n_blobs;
+}
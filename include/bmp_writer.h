@@ -0,0 +1,231 @@
+#include "pixel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Size in bytes of the file header and of the info header of a BMP file
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_INFO_HEADER_SIZE 40
+#define BMP_HEADER_SIZE (BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE)
+
+// Flag to write the file with O_DIRECT, bypassing the page cache
+#define BMP_WRITE_DIRECT 1
+
+// Alignment of the buffers, offsets and sizes of O_DIRECT writes, and size of each write
+#define BMP_DIRECT_ALIGN 4096
+#define BMP_DIRECT_CHUNK (4UL << 20)
+
+// Method to store a 16 bit little endian value
+void bmp_put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+// Method to store a 32 bit little endian value
+void bmp_put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+// Method to get the size in bytes of the BMP file of an image
+uint64_t bmp_file_size(int width, int height) {
+    return BMP_HEADER_SIZE + (uint64_t)width * height * sizeof(rgb_pixel_t);
+}
+
+// Method to fill the header of an uncompressed 32 bit BMP file, with the rows stored bottom-up
+void bmp_fill_header(uint8_t *header, int width, int height) {
+    memset(header, 0, BMP_HEADER_SIZE);
+
+    // File header
+    header[0] = 'B';
+    header[1] = 'M';
+    bmp_put32(header + 2, bmp_file_size(width, height));
+    bmp_put32(header + 10, BMP_HEADER_SIZE);
+
+    // Info header: no compression, 32 bits per pixel, 72 dpi
+    bmp_put32(header + 14, BMP_INFO_HEADER_SIZE);
+    bmp_put32(header + 18, width);
+    bmp_put32(header + 22, height);
+    bmp_put16(header + 26, 1);
+    bmp_put16(header + 28, 32);
+    bmp_put32(header + 34, (uint32_t)width * height * sizeof(rgb_pixel_t));
+    bmp_put32(header + 38, 2835);
+    bmp_put32(header + 42, 2835);
+}
+
+// Method to write a list of buffers entirely, returns -1 on error
+int bmp_writev_all(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        // Skip the buffers written, and the part written of the next one
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Method to write the header and the rows through the page cache.
+ * The rows are sent straight from the frame, last one first, with one
+ * writev for up to IOV_MAX rows.
+ */
+int bmp_write_buffered(int fd, const uint8_t *header, const rgb_pixel_t *frame, int width, int height) {
+    struct iovec iov[IOV_MAX];
+    size_t row_size = (size_t)width * sizeof(rgb_pixel_t);
+
+    int n = 0;
+    iov[n].iov_base = (void *)header;
+    iov[n].iov_len = BMP_HEADER_SIZE;
+    n++;
+
+    for (int y = height - 1; y >= 0; y--) {
+        iov[n].iov_base = (void *)(frame + (size_t)y * width);
+        iov[n].iov_len = row_size;
+        n++;
+
+        if (n == IOV_MAX || y == 0) {
+            if (bmp_writev_all(fd, iov, n) == -1) {
+                return -1;
+            }
+            n = 0;
+        }
+    }
+    return height == 0 ? bmp_writev_all(fd, iov, n) : 0;
+}
+
+/*
+ * Method to write the header and the rows with O_DIRECT.
+ * The rows are gathered in an aligned buffer and written in chunks of
+ * BMP_DIRECT_CHUNK bytes; the last chunk is padded to the alignment and the
+ * padding is then cut from the file.
+ */
+int bmp_write_direct(int fd, const uint8_t *header, const rgb_pixel_t *frame, int width, int height) {
+    uint8_t *chunk;
+    if (posix_memalign((void **)&chunk, BMP_DIRECT_ALIGN, BMP_DIRECT_CHUNK) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t row_size = (size_t)width * sizeof(rgb_pixel_t);
+    size_t filled = 0;
+    int result = 0;
+
+    // Sources in file order: the header, then the rows from the last one
+    for (int y = height; y >= 0 && result == 0; y--) {
+        const uint8_t *src = y == height ? header : (const uint8_t *)(frame + (size_t)y * width);
+        size_t left = y == height ? BMP_HEADER_SIZE : row_size;
+
+        while (left > 0) {
+            size_t n = BMP_DIRECT_CHUNK - filled < left ? BMP_DIRECT_CHUNK - filled : left;
+            memcpy(chunk + filled, src, n);
+            filled += n;
+            src += n;
+            left -= n;
+
+            // Write the chunk once full, or padded if it is the last one
+            int last = y == 0 && left == 0;
+            if (filled == BMP_DIRECT_CHUNK || last) {
+                size_t size = (filled + BMP_DIRECT_ALIGN - 1) / BMP_DIRECT_ALIGN * BMP_DIRECT_ALIGN;
+                memset(chunk + filled, 0, size - filled);
+
+                struct iovec iov = {chunk, size};
+                if (bmp_writev_all(fd, &iov, 1) == -1) {
+                    result = -1;
+                    break;
+                }
+                filled = 0;
+            }
+        }
+    }
+
+    free(chunk);
+    if (result == 0 && ftruncate(fd, bmp_file_size(width, height)) == -1) {
+        return -1;
+    }
+    return result;
+}
+
+/*
+ * Method to save a frame as a 32 bit BMP file, without libbmp.
+ * The file is allocated at its final size, written in large sequential
+ * writes to a temporary file and renamed, so that it is never seen half
+ * written. With BMP_WRITE_DIRECT in flags the page cache is bypassed when
+ * the file system allows it; flags is updated with the options in effect.
+ * Returns -1 on error.
+ */
+int bmp_write(const char *path, const rgb_pixel_t *frame, int width, int height, int *flags) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = -1;
+    if (*flags & BMP_WRITE_DIRECT) {
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (fd == -1) {
+            // The file system does not support O_DIRECT
+            *flags &= ~BMP_WRITE_DIRECT;
+        }
+    }
+    if (fd == -1) {
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+    }
+
+    // Allocate the whole file at once, if the file system supports it
+    int error = posix_fallocate(fd, 0, bmp_file_size(width, height));
+    if (error != 0 && error != EOPNOTSUPP && error != EINVAL) {
+        close(fd);
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+
+    uint8_t header[BMP_HEADER_SIZE];
+    bmp_fill_header(header, width, height);
+
+    int result;
+    if (*flags & BMP_WRITE_DIRECT) {
+        result = bmp_write_direct(fd, header, frame, width, height);
+    }
+    else {
+        result = bmp_write_buffered(fd, header, frame, width, height);
+    }
+
+    if (close(fd) == -1) {
+        result = -1;
+    }
+    if (result == -1 || rename(tmp_path, path) == -1) {
+        int err_no = errno;
+        unlink(tmp_path);
+        errno = err_no;
+        return -1;
+    }
+    return 0;
+}
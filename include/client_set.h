@@ -0,0 +1,415 @@
+#ifndef CLIENT_SET_H
+#define CLIENT_SET_H
+
+#include "latency.h"
+#include "monotonic_clock.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#include <unistd.h>
+
+// Maximum number of clients connected to the server at the same time
+#define MAX_CLIENTS 64
+
+// Size in bytes of a command: the key code as a NUL terminated string
+#define MESSAGE_SIZE 4
+
+// Command sent by an idle client to show it is alive, acked but not applied
+#define HEARTBEAT_KEY 0
+
+// Interval of the heartbeats, and silence after which the peer of a session is considered dead
+#define HEARTBEAT_NS 200000000ULL
+#define PEER_TIMEOUT_NS 1000000000ULL
+
+// Message opening a session, followed by the token of the session to resume, 0 for a new one
+#define SESSION_MAGIC "ARPS"
+
+// Maximum number of sessions remembered by the server, including those of disconnected clients
+#define MAX_SESSIONS 64
+
+// Values returned by clients_receive
+#define CLIENT_CLOSED -1
+#define CLIENT_PARTIAL 0
+#define CLIENT_COMMAND 1
+#define CLIENT_HELLO 2
+
+/*
+ * Typedef for the answer of the server to the opening of a session: the
+ * token of the session, the commands of the session applied so far and the
+ * position of the circle, so that the client can resume from the state of
+ * the server. All the fields are in network byte order.
+ */
+typedef struct {
+    char magic[MESSAGE_SIZE];
+    uint32_t token;
+    uint32_t applied;
+    int32_t x;
+    int32_t y;
+}SESSION_WELCOME;
+
+// Message announcing that the next command is stamped for the latency tracing
+#define STAMP_MAGIC "ARPL"
+
+/*
+ * Typedef for the stamp sent before a command: its identifier and the
+ * monotonic time the client sent it, split in two words. All the fields are
+ * in network byte order.
+ */
+typedef struct {
+    char magic[MESSAGE_SIZE];
+    uint32_t id;
+    uint32_t sent_high;
+    uint32_t sent_low;
+}COMMAND_STAMP;
+
+// Message acking a command of a session, or a heartbeat, with the resulting state of the server
+#define STATE_MAGIC "ARPT"
+
+/*
+ * Typedef for the ack of a command of a session: the number of commands of
+ * the session applied, the last one included, and the resulting cell of the
+ * circle on the server, which owns the position. All the fields are in
+ * network byte order.
+ */
+typedef struct {
+    char magic[MESSAGE_SIZE];
+    uint32_t seq;
+    int32_t x;
+    int32_t y;
+}SESSION_STATE;
+
+// Typedef for a session, which outlives the connection of its client
+typedef struct {
+    uint32_t token;
+    // Commands of the session applied by the server
+    uint32_t applied;
+    // Time of the last message of the session
+    uint64_t last_seen;
+}SESSION;
+
+// Typedef for a client connected to the server
+typedef struct {
+    int fd;
+    // Bytes of the current command received so far
+    int filled;
+    char message[MESSAGE_SIZE];
+    // Set when the next message is the token of a session
+    int hello;
+    // Words of the stamp still to receive, and stamp of the next command, or of the last one if stamped is set
+    int stamp_words;
+    uint32_t stamp[3];
+    int stamped;
+    // Index of the session of the client, -1 if it did not open one or if a new connection resumed it
+    int session;
+    // Set once the client opened a session, it then sends heartbeats and is dropped when silent
+    int heartbeats;
+    uint64_t last_seen;
+    // Set if the client is on the same host, over the Unix domain socket or a loopback address, so that its send times are comparable
+    int local;
+}CLIENT;
+
+/*
+ * Typedef for the clients of the server. Every client receives back each of
+ * its commands once applied, so that it can measure the latency; the ack is
+ * dropped instead of blocking the server when the client does not read it.
+ */
+typedef struct {
+    int listen_fd;
+    CLIENT clients[MAX_CLIENTS];
+    int n_clients;
+    SESSION sessions[MAX_SESSIONS];
+    int n_sessions;
+    // Number of commands received, acks sent and acks dropped
+    unsigned long received;
+    unsigned long acked;
+    unsigned long dropped_acks;
+}CLIENT_SET;
+
+// Method to initialize an empty set of clients accepted from the listening socket
+void clients_init(CLIENT_SET *set, int listen_fd) {
+    set->listen_fd = listen_fd;
+    set->n_clients = 0;
+    set->n_sessions = 0;
+    set->received = 0;
+    set->acked = 0;
+    set->dropped_acks = 0;
+}
+
+// Method to check if the peer of a connected socket is on the same host, over the Unix domain socket or a loopback address
+int clients_is_local(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t size = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *)&addr, &size) < 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_UNIX) {
+        return 1;
+    }
+    return addr.ss_family == AF_INET && (ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+}
+
+// Method to add a connected socket to the set, returns -1 if the set is full
+int clients_add(CLIENT_SET *set, int fd) {
+    if (set->n_clients == MAX_CLIENTS) {
+        return -1;
+    }
+    set->clients[set->n_clients].fd = fd;
+    set->clients[set->n_clients].filled = 0;
+    set->clients[set->n_clients].hello = 0;
+    set->clients[set->n_clients].stamp_words = 0;
+    set->clients[set->n_clients].stamped = 0;
+    set->clients[set->n_clients].session = -1;
+    set->clients[set->n_clients].heartbeats = 0;
+    set->clients[set->n_clients].local = clients_is_local(fd);
+    set->n_clients++;
+    return 0;
+}
+
+// Method to accept a pending connection, returns its socket or -1 on error
+int clients_accept(CLIENT_SET *set) {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(cli_addr);
+
+    int fd = accept(set->listen_fd, (struct sockaddr *)&cli_addr, &clilen);
+    if (fd < 0) {
+        return -1;
+    }
+    if (clients_add(set, fd) == -1) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    // Send each ack as soon as the command is applied
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Method to close the connection of the i-th client, the last client takes its place
+void clients_remove(CLIENT_SET *set, int i) {
+    close(set->clients[i].fd);
+    set->clients[i] = set->clients[set->n_clients - 1];
+    set->n_clients--;
+}
+
+// Method to add the listening socket and the clients to a set of descriptors, returns the highest one
+int clients_fdset(CLIENT_SET *set, fd_set *readfds, int maxfd) {
+    FD_SET(set->listen_fd, readfds);
+    maxfd = set->listen_fd > maxfd ? set->listen_fd : maxfd;
+    for (int i = 0; i < set->n_clients; i++) {
+        FD_SET(set->clients[i].fd, readfds);
+        maxfd = set->clients[i].fd > maxfd ? set->clients[i].fd : maxfd;
+    }
+    return maxfd;
+}
+
+/*
+ * Method to find the session with the given token, or to open a new one if
+ * the token is unknown, replacing the least recently seen session when the
+ * table is full. Returns the index of the session.
+ */
+int clients_find_session(CLIENT_SET *set, uint32_t token) {
+    for (int s = 0; token != 0 && s < set->n_sessions; s++) {
+        if (set->sessions[s].token == token) {
+            return s;
+        }
+    }
+
+    int s = set->n_sessions;
+    if (s == MAX_SESSIONS) {
+        s = 0;
+        for (int k = 1; k < MAX_SESSIONS; k++) {
+            s = set->sessions[k].last_seen < set->sessions[s].last_seen ? k : s;
+        }
+        // Detach the client of the replaced session, if still connected
+        for (int k = 0; k < set->n_clients; k++) {
+            set->clients[k].session = set->clients[k].session == s ? -1 : set->clients[k].session;
+        }
+    }
+    else {
+        set->n_sessions++;
+    }
+
+    SESSION *session = &set->sessions[s];
+    session->token = 0;
+    while (session->token == 0) {
+        if (getrandom(&session->token, sizeof(session->token), 0) != sizeof(session->token)) {
+            session->token = (uint32_t)monotonic_ns() ^ ((uint32_t)getpid() << 16);
+        }
+    }
+    session->applied = 0;
+    return s;
+}
+
+/*
+ * Method to read from the i-th client, a command may arrive in several reads.
+ * Returns CLIENT_COMMAND and the key code if a whole command was received,
+ * CLIENT_HELLO if the client opened a session, to be answered with
+ * clients_welcome, CLIENT_PARTIAL if the message is still incomplete and
+ * CLIENT_CLOSED if the client closed the connection or on error.
+ */
+int clients_receive(CLIENT_SET *set, int i, int *cmd) {
+    CLIENT *client = &set->clients[i];
+
+    int n = read(client->fd, client->message + client->filled, MESSAGE_SIZE - client->filled);
+    if (n <= 0) {
+        return CLIENT_CLOSED;
+    }
+    client->filled += n;
+    if (client->filled < MESSAGE_SIZE) {
+        return CLIENT_PARTIAL;
+    }
+    client->filled = 0;
+
+    client->last_seen = monotonic_ns();
+    if (client->session != -1) {
+        set->sessions[client->session].last_seen = client->last_seen;
+    }
+
+    // The token of the session follows the magic
+    if (client->hello) {
+        uint32_t token;
+        memcpy(&token, client->message, sizeof(token));
+        client->hello = 0;
+        client->heartbeats = 1;
+        client->session = clients_find_session(set, ntohl(token));
+        set->sessions[client->session].last_seen = client->last_seen;
+
+        // A previous connection of the session is dead: let it expire now
+        for (int k = 0; k < set->n_clients; k++) {
+            if (k != i && set->clients[k].session == client->session) {
+                set->clients[k].session = -1;
+                set->clients[k].last_seen = 0;
+            }
+        }
+        return CLIENT_HELLO;
+    }
+
+    // The identifier and the send time of the next command follow the magic
+    if (client->stamp_words > 0) {
+        memcpy(&client->stamp[3 - client->stamp_words], client->message, MESSAGE_SIZE);
+        client->stamp_words--;
+        return CLIENT_PARTIAL;
+    }
+    if (memcmp(client->message, SESSION_MAGIC, MESSAGE_SIZE) == 0) {
+        client->hello = 1;
+        return CLIENT_PARTIAL;
+    }
+    if (memcmp(client->message, STAMP_MAGIC, MESSAGE_SIZE) == 0) {
+        client->stamp_words = 3;
+        client->stamped = 1;
+        return CLIENT_PARTIAL;
+    }
+
+    client->message[MESSAGE_SIZE - 1] = '\0';
+    *cmd = atoi(client->message);
+    set->received++;
+    if (client->session != -1 && *cmd != HEARTBEAT_KEY) {
+        set->sessions[client->session].applied++;
+    }
+    return CLIENT_COMMAND;
+}
+
+/*
+ * Method to get the stamp of the last command of the i-th client, received
+ * at received. Returns 0 if the command was not stamped, the stamp is then
+ * only the receive time. The send time of a client on another host is on
+ * another clock and is dropped.
+ */
+int clients_stamp(CLIENT_SET *set, int i, uint64_t received, INPUT_STAMP *stamp) {
+    CLIENT *client = &set->clients[i];
+    int stamped = client->stamped;
+    stamp->id = stamped ? ntohl(client->stamp[0]) : 0;
+    stamp->sent = stamped && client->local ? (uint64_t)ntohl(client->stamp[1]) << 32 | ntohl(client->stamp[2]) : 0;
+    stamp->received = received;
+    client->stamped = 0;
+    return stamped;
+}
+
+// Method to answer the opening of a session by the i-th client with the position of the circle
+void clients_welcome(CLIENT_SET *set, int i, int x, int y) {
+    SESSION *session = &set->sessions[set->clients[i].session];
+    SESSION_WELCOME welcome;
+    memcpy(welcome.magic, SESSION_MAGIC, MESSAGE_SIZE);
+    welcome.token = htonl(session->token);
+    welcome.applied = htonl(session->applied);
+    welcome.x = htonl(x);
+    welcome.y = htonl(y);
+    send(set->clients[i].fd, &welcome, sizeof(welcome), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// Method to find a client with a session silent for longer than PEER_TIMEOUT_NS, or resumed elsewhere; -1 if none
+int clients_expired(CLIENT_SET *set, uint64_t now) {
+    for (int i = 0; i < set->n_clients; i++) {
+        if (set->clients[i].heartbeats && now - set->clients[i].last_seen > PEER_TIMEOUT_NS) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Method to send back to the i-th client the command just applied, without blocking
+void clients_ack(CLIENT_SET *set, int i, int cmd) {
+    char ack[MESSAGE_SIZE] = {0};
+    snprintf(ack, MESSAGE_SIZE, "%d", cmd);
+
+    if (send(set->clients[i].fd, ack, MESSAGE_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL) == MESSAGE_SIZE) {
+        set->acked++;
+    }
+    else {
+        set->dropped_acks++;
+    }
+}
+
+// Method to find the client connected on a socket, -1 if it is gone
+int clients_find(CLIENT_SET *set, int fd) {
+    for (int i = 0; i < set->n_clients; i++) {
+        if (set->clients[i].fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Method to get the number of commands applied in the session of the i-th client, 0 without a session
+uint32_t clients_applied(CLIENT_SET *set, int i) {
+    return set->clients[i].session == -1 ? 0 : set->sessions[set->clients[i].session].applied;
+}
+
+/*
+ * Method to ack a command applied for the i-th client without blocking: a
+ * client with a session receives seq, the number of its commands applied
+ * with this one, and the state of the server after it; the others receive
+ * the command itself.
+ */
+void clients_reply(CLIENT_SET *set, int i, int cmd, uint32_t seq, int x, int y) {
+    if (set->clients[i].session == -1) {
+        clients_ack(set, i, cmd);
+        return;
+    }
+
+    SESSION_STATE state;
+    memcpy(state.magic, STATE_MAGIC, MESSAGE_SIZE);
+    state.seq = htonl(seq);
+    state.x = htonl(x);
+    state.y = htonl(y);
+
+    if (send(set->clients[i].fd, &state, sizeof(state), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(state)) {
+        set->acked++;
+    }
+    else {
+        set->dropped_acks++;
+    }
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Size in bytes of a command or of an ack, the same messages as the stream transports
+#define QUEUE_MESSAGE_SIZE 4
+
+// Number of messages of each ring, must be a power of two
+#define QUEUE_CAPACITY 1024
+
+// Value written in the queue once it is valid
+#define QUEUE_MAGIC 0x41525051
+
+/*
+ * Typedef for a single-producer, single-consumer ring of messages.
+ * The head is also the futex word the consumer sleeps on when the ring is
+ * empty; the producer only makes the wake-up system call if the consumer
+ * said it is waiting.
+ */
+typedef struct {
+    // Number of messages written, and set when the consumer is sleeping
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t waiting;
+    // Number of messages read
+    uint32_t tail __attribute__((aligned(64)));
+    char messages[QUEUE_CAPACITY][QUEUE_MESSAGE_SIZE] __attribute__((aligned(64)));
+}COMMAND_RING;
+
+// Typedef for the shared memory object linking a client to the server on the same host
+typedef struct {
+    uint32_t magic;
+    // Process identifier of the attached client, the queue has a single producer
+    uint32_t attached;
+    // Commands from the client and acks from the server
+    COMMAND_RING commands;
+    COMMAND_RING acks;
+}COMMAND_QUEUE;
+
+// Method to get the name of the shared memory object of the queue of a port
+void command_queue_name(int port, char *name, size_t size) {
+    snprintf(name, size, "/ARP_COMMANDS_%d", port);
+}
+
+// Method to sleep while the futex word is equal to value, at most timeout_ns nanoseconds
+int futex_wait(uint32_t *word, uint32_t value, uint64_t timeout_ns) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000ULL;
+    timeout.tv_nsec = timeout_ns % 1000000000ULL;
+    return syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+// Method to wake the processes sleeping on the futex word
+int futex_wake(uint32_t *word) {
+    return syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Method to append a message to the ring, returns 0 if the ring is full
+int command_ring_push(COMMAND_RING *ring, const char *message) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == QUEUE_CAPACITY) {
+        return 0;
+    }
+
+    memcpy(ring->messages[head & (QUEUE_CAPACITY - 1)], message, QUEUE_MESSAGE_SIZE);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+    // Wake the consumer only if it is sleeping
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&ring->head);
+    }
+    return 1;
+}
+
+// Method to take the oldest message of the ring, returns 0 if the ring is empty
+int command_ring_pop(COMMAND_RING *ring, char *message) {
+    uint32_t tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    memcpy(message, ring->messages[tail & (QUEUE_CAPACITY - 1)], QUEUE_MESSAGE_SIZE);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Method to check if the ring is empty, from the consumer
+int command_ring_empty(COMMAND_RING *ring) {
+    return ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+// Method to sleep until the ring is not empty, at most timeout_ns nanoseconds
+void command_ring_wait(COMMAND_RING *ring, uint64_t timeout_ns) {
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+
+    // Check again after announcing the wait, a message pushed meanwhile is not missed
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    if (head == ring->tail) {
+        futex_wait(&ring->head, head, timeout_ns);
+    }
+
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+}
+
+// Method to append a key code to the ring, as the same NUL terminated string sent on the sockets
+int command_ring_send(COMMAND_RING *ring, int cmd) {
+    char message[QUEUE_MESSAGE_SIZE] = {0};
+    snprintf(message, QUEUE_MESSAGE_SIZE, "%d", cmd);
+    return command_ring_push(ring, message);
+}
+
+// Method to take the oldest key code of the ring, returns 0 if the ring is empty
+int command_ring_receive(COMMAND_RING *ring, int *cmd) {
+    char message[QUEUE_MESSAGE_SIZE];
+    if (!command_ring_pop(ring, message)) {
+        return 0;
+    }
+    message[QUEUE_MESSAGE_SIZE - 1] = '\0';
+    *cmd = atoi(message);
+    return 1;
+}
+
+// Method to create the queue of a port on the server, NULL on error
+COMMAND_QUEUE *command_queue_create(int port) {
+    char name[64];
+    command_queue_name(port, name, sizeof(name));
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(COMMAND_QUEUE)) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    COMMAND_QUEUE *queue = mmap(NULL, sizeof(COMMAND_QUEUE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (queue == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The new object is zeroed, the queue is valid once the magic is written
+    __atomic_store_n(&queue->magic, QUEUE_MAGIC, __ATOMIC_RELEASE);
+    return queue;
+}
+
+/*
+ * Method to attach a client to the queue of a port, taking the place of a
+ * client that died without detaching. Returns NULL on error, with EBUSY if
+ * another client is attached.
+ */
+COMMAND_QUEUE *command_queue_open(int port) {
+    char name[64];
+    command_queue_name(port, name, sizeof(name));
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    COMMAND_QUEUE *queue = mmap(NULL, sizeof(COMMAND_QUEUE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (queue == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint32_t owner = __atomic_load_n(&queue->attached, __ATOMIC_ACQUIRE);
+    if (owner != 0 && kill(owner, 0) == -1 && errno == ESRCH) {
+        // The previous client is dead, its commands still in the queue are applied anyway
+    }
+    else if (owner != 0) {
+        owner = (uint32_t)-1;
+    }
+    if (__atomic_load_n(&queue->magic, __ATOMIC_ACQUIRE) != QUEUE_MAGIC ||
+        !__atomic_compare_exchange_n(&queue->attached, &owner, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(queue, sizeof(COMMAND_QUEUE));
+        errno = EBUSY;
+        return NULL;
+    }
+    return queue;
+}
+
+// Method to detach a client from the queue
+void command_queue_close(COMMAND_QUEUE *queue) {
+    __atomic_store_n(&queue->attached, 0, __ATOMIC_RELEASE);
+    munmap(queue, sizeof(COMMAND_QUEUE));
+}
+
+// Method to remove the queue of a port, on the server
+void command_queue_destroy(COMMAND_QUEUE *queue, int port) {
+    char name[64];
+    command_queue_name(port, name, sizeof(name));
+    munmap(queue, sizeof(COMMAND_QUEUE));
+    shm_unlink(name);
+}
+
+#endif
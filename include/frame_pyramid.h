@@ -0,0 +1,165 @@
+#ifndef FRAME_PYRAMID_H
+#define FRAME_PYRAMID_H
+
+#include "pixel_kernels.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Occupancy pyramid of the frame, stored in the shared memory after it.
+ * Each level holds one byte per cell, set if the cell holds a non-black
+ * pixel: the cells of the first level are PYRAMID_FACTOR pixels wide, and
+ * each level reduces PYRAMID_FACTOR x PYRAMID_FACTOR cells of the level
+ * below with an OR, so the levels cover 1/4, 1/16 and 1/64 of the side of
+ * the frame. processA updates the cells over the rectangle of each frame
+ * that changed, inside the write of the frame, and the readers find the
+ * objects from the coarsest level down, only reading the pixels around them.
+ */
+
+// Number of levels and reduction of the side of the frame from a level to the next
+#define PYRAMID_LEVELS 3
+#define PYRAMID_FACTOR 4
+
+// Typedef for a level of the pyramid, its cells start offset bytes after the first level
+typedef struct {
+    int32_t width, height;
+    // Pixels per side of a cell
+    int32_t factor;
+    uint64_t offset;
+}PYRAMID_LEVEL;
+
+// Typedef for the scratch buffers of a search of the objects, sized for the first level
+typedef struct {
+    // Occupied cells of the first level, and cells waiting to be visited
+    int *cells;
+    int *stack;
+    // Group in which each cell was last visited, numbered across the searches so that the marks never need clearing
+    uint32_t *visited;
+    uint32_t stamp;
+    int capacity;
+}PYRAMID_SEARCH;
+
+// Method to compute the size and the offset of each level for a frame, returns the size in bytes of the pyramid
+uint64_t pyramid_layout(int width, int height, PYRAMID_LEVEL *levels) {
+    uint64_t size = 0;
+    int factor = 1;
+    for (int k = 0; k < PYRAMID_LEVELS; k++) {
+        factor *= PYRAMID_FACTOR;
+        levels[k].width = (width + factor - 1) / factor;
+        levels[k].height = (height + factor - 1) / factor;
+        levels[k].factor = factor;
+        levels[k].offset = size;
+        size += (uint64_t)levels[k].width * levels[k].height;
+    }
+    return size;
+}
+
+// Method to clear the cells of a rectangle of a level
+void pyramid_clear(const PYRAMID_LEVEL *level, uint8_t *cells, RECT box) {
+    for (int row = box.min_y; row <= box.max_y; row++) {
+        memset(cells + (size_t)row * level->width + box.min_x, 0, box.max_x - box.min_x + 1);
+    }
+}
+
+/*
+ * Method to update the cells of every level covering the rectangle dirty of
+ * the frame. The rows of the first level are walked by runs, found with the
+ * vector kernels, and each level above only reads the cells of the level
+ * below under the rectangle.
+ */
+void pyramid_update(const PYRAMID_LEVEL *levels, uint8_t *base, const rgb_pixel_t *frame, int width, int height, RECT dirty) {
+    if (dirty.max_x < dirty.min_x || dirty.max_y < dirty.min_y) {
+        return;
+    }
+
+    // First level, from the pixels of the cells touching the rectangle
+    const PYRAMID_LEVEL *level = &levels[0];
+    uint8_t *cells = base + level->offset;
+    RECT box = {dirty.min_x / PYRAMID_FACTOR, dirty.min_y / PYRAMID_FACTOR, dirty.max_x / PYRAMID_FACTOR, dirty.max_y / PYRAMID_FACTOR};
+    pyramid_clear(level, cells, box);
+
+    int x_start = box.min_x * PYRAMID_FACTOR;
+    int x_end = (box.max_x + 1) * PYRAMID_FACTOR < width ? (box.max_x + 1) * PYRAMID_FACTOR : width;
+    int y_end = (box.max_y + 1) * PYRAMID_FACTOR < height ? (box.max_y + 1) * PYRAMID_FACTOR : height;
+    for (int y = box.min_y * PYRAMID_FACTOR; y < y_end; y++) {
+        const rgb_pixel_t *row = frame + (size_t)y * width;
+        uint8_t *out = cells + (size_t)(y / PYRAMID_FACTOR) * level->width;
+        int x = frame_skip_black(row, x_start, x_end);
+        while (x < x_end) {
+            int end = frame_skip_nonblack(row, x, x_end);
+            memset(out + x / PYRAMID_FACTOR, 1, (end - 1) / PYRAMID_FACTOR - x / PYRAMID_FACTOR + 1);
+            x = frame_skip_black(row, end, x_end);
+        }
+    }
+
+    // Levels above, each cell is the OR of the cells below it
+    for (int k = 1; k < PYRAMID_LEVELS; k++) {
+        const PYRAMID_LEVEL *below = level;
+        const uint8_t *below_cells = cells;
+        level = &levels[k];
+        cells = base + level->offset;
+        RECT parent = {box.min_x / PYRAMID_FACTOR, box.min_y / PYRAMID_FACTOR, box.max_x / PYRAMID_FACTOR, box.max_y / PYRAMID_FACTOR};
+        pyramid_clear(level, cells, parent);
+
+        int col_end = (parent.max_x + 1) * PYRAMID_FACTOR < below->width ? (parent.max_x + 1) * PYRAMID_FACTOR : below->width;
+        int row_end = (parent.max_y + 1) * PYRAMID_FACTOR < below->height ? (parent.max_y + 1) * PYRAMID_FACTOR : below->height;
+        for (int row = parent.min_y * PYRAMID_FACTOR; row < row_end; row++) {
+            const uint8_t *in = below_cells + (size_t)row * below->width;
+            uint8_t *out = cells + (size_t)(row / PYRAMID_FACTOR) * level->width;
+            for (int col = parent.min_x * PYRAMID_FACTOR; col < col_end; col++) {
+                out[col / PYRAMID_FACTOR] |= in[col];
+            }
+        }
+        box = parent;
+    }
+}
+
+// Method to allocate the scratch buffers of a search on the pyramid of levels, returns -1 if the memory cannot be allocated
+int pyramid_search_init(PYRAMID_SEARCH *search, const PYRAMID_LEVEL *levels) {
+    search->capacity = levels[0].width * levels[0].height;
+    search->cells = malloc((size_t)search->capacity * sizeof(int));
+    search->stack = malloc((size_t)search->capacity * sizeof(int));
+    search->visited = calloc(search->capacity, sizeof(uint32_t));
+    search->stamp = 0;
+    return search->cells != NULL && search->stack != NULL && search->visited != NULL ? 0 : -1;
+}
+
+// Method to free the scratch buffers of a search
+void pyramid_search_destroy(PYRAMID_SEARCH *search) {
+    free(search->cells);
+    free(search->stack);
+    free(search->visited);
+    search->cells = NULL;
+    search->stack = NULL;
+    search->visited = NULL;
+    search->capacity = 0;
+}
+
+/*
+ * Method to collect the occupied cells of the first level under the cell
+ * (col, row) of a level, only descending into the occupied cells of the
+ * levels between. Returns the number of cells collected so far.
+ */
+int pyramid_collect(const PYRAMID_LEVEL *levels, const uint8_t *base, int k, int col, int row, int *out, int n) {
+    const PYRAMID_LEVEL *below = &levels[k - 1];
+    const uint8_t *cells = base + below->offset;
+    int col_end = (col + 1) * PYRAMID_FACTOR < below->width ? (col + 1) * PYRAMID_FACTOR : below->width;
+    int row_end = (row + 1) * PYRAMID_FACTOR < below->height ? (row + 1) * PYRAMID_FACTOR : below->height;
+    for (int r = row * PYRAMID_FACTOR; r < row_end; r++) {
+        for (int c = col * PYRAMID_FACTOR; c < col_end; c++) {
+            if (!cells[(size_t)r * below->width + c]) {
+                continue;
+            }
+            if (k == 1) {
+                out[n++] = r * below->width + c;
+            }
+            else {
+                n = pyramid_collect(levels, base, k - 1, c, r, out, n);
+            }
+        }
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/*
+ * Instances of the pipeline, so that many of them run on the same host.
+ * master passes the identifier of the instance to processA and processB in
+ * ARP_INSTANCE, and every name private to a pipeline gets it as a suffix:
+ * the shared memory object, the logs and the snapshots. Instance 0 keeps
+ * the names without suffix. The names shared by the client and the server,
+ * the command queue and the Unix domain socket, already carry the port.
+ */
+
+// Largest number of pipelines supervised by master
+#define MAX_PIPELINES 64
+
+// Largest instance identifier
+#define MAX_INSTANCE 9999
+
+// Method to read the identifier of the instance from ARP_INSTANCE, 0 if not set
+int instance_from_env() {
+    const char *value = getenv("ARP_INSTANCE");
+    int instance = value != NULL ? atoi(value) : 0;
+    return instance > 0 && instance <= MAX_INSTANCE ? instance : 0;
+}
+
+// Method to get the name of an object of an instance, from the base name and the extension
+char *instance_name(const char *base, const char *extension, int instance, char *buffer, size_t size) {
+    if (instance == 0) {
+        snprintf(buffer, size, "%s%s", base, extension);
+    }
+    else {
+        snprintf(buffer, size, "%s_%d%s", base, instance, extension);
+    }
+    return buffer;
+}
+
+/*
+ * Method to claim the first free instance from first, on the whole host:
+ * the claim is a lock on a file, released by the kernel when master exits
+ * or dies. Returns the instance and the descriptor of the file to close to
+ * release it, or -1 with errno set.
+ */
+int instance_claim(int first, int *fd) {
+    for (int instance = first; instance <= MAX_INSTANCE; instance++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/arp_instance_%d.lock", instance);
+        *fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0666);
+        if (*fd == -1) {
+            return -1;
+        }
+        if (flock(*fd, LOCK_EX | LOCK_NB) == 0) {
+            return instance;
+        }
+        close(*fd);
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+#endif
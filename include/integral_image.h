@@ -0,0 +1,210 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include "pixel_kernels.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Integral image (summed-area table) of the non-black pixels of the frame:
+ * the entry (x, y) counts the non-black pixels above and to the left of the
+ * pixel (x, y), so the pixels of any rectangle are counted with four reads.
+ * The table is built in a single pass over the frame, and when only a
+ * rectangle of the frame changed it is updated from the pixels of that
+ * rectangle.
+ */
+
+// Size in pixels of the cells of the coarse occupancy grid
+#define INTEGRAL_CELL 16
+
+// Typedef for the integral image of a frame
+typedef struct {
+    int width, height;
+    // (width + 1) x (height + 1) counts, the first row and column are zero
+    uint32_t *sums;
+    // Change of each column of the last row of the rectangle of an update, carried to the rows below
+    uint32_t *delta;
+    // Sequence number of the frame the table was computed from, valid if set
+    uint32_t seq;
+    int valid;
+    // Coarse grid of INTEGRAL_CELL pixels: component of each cell and cells waiting to be visited
+    int cols, rows;
+    int *cells;
+    int *stack;
+}INTEGRAL_IMAGE;
+
+// Method to allocate the integral image of a frame, returns -1 if the memory cannot be allocated
+int integral_init(INTEGRAL_IMAGE *ii, int width, int height) {
+    ii->width = width;
+    ii->height = height;
+    ii->sums = calloc((size_t)(width + 1) * (height + 1), sizeof(uint32_t));
+    ii->delta = malloc((size_t)width * sizeof(uint32_t));
+    ii->seq = 0;
+    ii->valid = 0;
+    ii->cols = (width + INTEGRAL_CELL - 1) / INTEGRAL_CELL;
+    ii->rows = (height + INTEGRAL_CELL - 1) / INTEGRAL_CELL;
+    ii->cells = malloc((size_t)ii->cols * ii->rows * sizeof(int));
+    ii->stack = malloc((size_t)ii->cols * ii->rows * sizeof(int));
+    return ii->sums != NULL && ii->delta != NULL && ii->cells != NULL && ii->stack != NULL ? 0 : -1;
+}
+
+// Method to free an integral image
+void integral_destroy(INTEGRAL_IMAGE *ii) {
+    free(ii->sums);
+    free(ii->delta);
+    free(ii->cells);
+    free(ii->stack);
+    ii->sums = NULL;
+    ii->delta = NULL;
+    ii->cells = NULL;
+    ii->stack = NULL;
+    ii->valid = 0;
+}
+
+/*
+ * Method to compute the counts of the pixels [x_start, x_end) of a row of
+ * the frame from the counts of the row above and the non-black pixels of the
+ * row left of x_start. The row is walked by runs, found with the vector
+ * kernels, and the count only grows inside the non-black ones.
+ */
+void integral_row(const rgb_pixel_t *row, const uint32_t *above, uint32_t *out, uint32_t run, int x_start, int x_end) {
+    int x = x_start;
+    while (x < x_end) {
+        int end = frame_skip_black(row, x, x_end);
+        if (run == 0) {
+            memcpy(out + x + 1, above + x + 1, (end - x) * sizeof(uint32_t));
+            x = end;
+        }
+        for (; x < end; x++) {
+            out[x + 1] = above[x + 1] + run;
+        }
+        end = frame_skip_nonblack(row, x, x_end);
+        for (; x < end; x++) {
+            out[x + 1] = above[x + 1] + ++run;
+        }
+    }
+}
+
+// Method to compute the integral image of a frame in a single pass
+void integral_build(INTEGRAL_IMAGE *ii, const rgb_pixel_t *frame) {
+    size_t stride = ii->width + 1;
+    for (int y = 0; y < ii->height; y++) {
+        integral_row(frame + (size_t)y * ii->width, ii->sums + y * stride, ii->sums + (y + 1) * stride, 0, 0, ii->width);
+    }
+}
+
+/*
+ * Method to update the integral image of the previous frame to a frame
+ * differing from it only inside dirty. Right of the rectangle, the count of a
+ * row changes as much as at the right side of the rectangle, and below it as
+ * much as the last row of the rectangle: only the pixels of the rectangle
+ * are read, and the counts right of and below it only change if the number
+ * of non-black pixels of the rectangle did, which is not the case when the
+ * circle moves inside it.
+ */
+void integral_update(INTEGRAL_IMAGE *ii, const rgb_pixel_t *frame, RECT dirty) {
+    if (dirty.max_x < dirty.min_x || dirty.max_y < dirty.min_y) {
+        return;
+    }
+
+    size_t stride = ii->width + 1;
+    int x0 = dirty.min_x, x1 = dirty.max_x + 1;
+    uint32_t change = 0;
+
+    // Rows of the rectangle: the counts left of it are the same, the ones inside are computed again
+    for (int y = dirty.min_y; y <= dirty.max_y; y++) {
+        const uint32_t *above = ii->sums + y * stride;
+        uint32_t *out = ii->sums + (y + 1) * stride;
+
+        // Keep the change of each column of the last row for the rows below
+        if (y == dirty.max_y) {
+            memcpy(ii->delta + x0, out + x0 + 1, (x1 - x0) * sizeof(uint32_t));
+        }
+        uint32_t before = out[x1];
+        integral_row(frame + (size_t)y * ii->width, above, out, out[x0] - above[x0], x0, x1);
+        change = out[x1] - before;
+
+        for (int x = x1; change != 0 && x < ii->width; x++) {
+            out[x + 1] += change;
+        }
+    }
+    for (int x = x0; x < x1; x++) {
+        ii->delta[x] = ii->sums[(dirty.max_y + 1) * stride + x + 1] - ii->delta[x];
+    }
+
+    // Rows below: their pixels did not change, so their counts change as much as the last row of the rectangle
+    for (int y = dirty.max_y + 1; y < ii->height; y++) {
+        uint32_t *out = ii->sums + (y + 1) * stride;
+        for (int x = x0; x < x1; x++) {
+            out[x + 1] += ii->delta[x];
+        }
+        for (int x = x1; change != 0 && x < ii->width; x++) {
+            out[x + 1] += change;
+        }
+    }
+}
+
+// Method to count the non-black pixels of the rectangle [min_x, max_x] x [min_y, max_y], bounds included
+uint32_t integral_box(const INTEGRAL_IMAGE *ii, int min_x, int min_y, int max_x, int max_y) {
+    size_t stride = ii->width + 1;
+    const uint32_t *top = ii->sums + min_y * stride;
+    const uint32_t *bottom = ii->sums + (max_y + 1) * stride;
+    return bottom[max_x + 1] - top[max_x + 1] - bottom[min_x] + top[min_x];
+}
+
+/*
+ * Method to shrink a rectangle holding non-black pixels to the smallest one
+ * holding the same pixels, with a binary search on each side: the count of
+ * the pixels up to a row or a column only grows with it.
+ */
+RECT integral_refine(const INTEGRAL_IMAGE *ii, RECT box) {
+    int lo, hi;
+
+    // First and last row
+    for (lo = box.min_y, hi = box.max_y; lo < hi;) {
+        int mid = (lo + hi) / 2;
+        if (integral_box(ii, box.min_x, box.min_y, box.max_x, mid) > 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    box.min_y = lo;
+    for (lo = box.min_y, hi = box.max_y; lo < hi;) {
+        int mid = (lo + hi + 1) / 2;
+        if (integral_box(ii, box.min_x, mid, box.max_x, box.max_y) > 0) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    box.max_y = lo;
+
+    // First and last column, within those rows
+    for (lo = box.min_x, hi = box.max_x; lo < hi;) {
+        int mid = (lo + hi) / 2;
+        if (integral_box(ii, box.min_x, box.min_y, mid, box.max_y) > 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    box.min_x = lo;
+    for (lo = box.min_x, hi = box.max_x; lo < hi;) {
+        int mid = (lo + hi + 1) / 2;
+        if (integral_box(ii, mid, box.min_y, box.max_x, box.max_y) > 0) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    box.max_x = lo;
+    return box;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "monotonic_clock.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Tracing of the latency of an input, from the key press on the client to
+ * the detection of the circle by processB on the server. Each input gets an
+ * identifier and the monotonic time it was sent, carried to processA by the
+ * stream transports; processA writes them in the shared header with the
+ * frame the input moved, and processB adds the time of each hop to its
+ * histograms once the frame is labelled. The times of different processes
+ * are only comparable on the same host: processA drops the send time of a
+ * client that is not on the Unix domain socket or a loopback address, and an
+ * input without send time has no network hop.
+ */
+
+// Hops of an input, and the whole path
+#define HOP_NETWORK 0  // from the send of the client to the receive of processA
+#define HOP_RENDER 1   // from the receive to the drawing of the frame, waiting for the tick of the simulation
+#define HOP_PUBLISH 2  // drawing of the frame, until it is published
+#define HOP_READ 3     // from the publish to a consistent read by processB, which waited on the lock before
+#define HOP_DETECT 4   // labelling of the frame read
+#define HOP_TOTAL 5
+#define HOPS 6
+
+// Buckets per power of two of the histograms, and number of buckets to cover 64 bit times
+#define HISTOGRAM_SUB 4
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB)
+
+// Oldest input carried by a frame, older inputs that did not move the circle are dropped
+#define TRACE_STALE_NS 1000000000ULL
+
+// Typedef for the stamp of an input, the send time is 0 if unknown
+typedef struct {
+    uint32_t id;
+    uint64_t sent;
+    uint64_t received;
+}INPUT_STAMP;
+
+// Typedef for the input a frame shows, written in the shared header with the frame
+typedef struct {
+    // Set if the frame shows an input
+    uint32_t traced;
+    uint32_t id;
+    uint64_t sent;
+    uint64_t received;
+    // Times processA started drawing the frame and published it
+    uint64_t drawn;
+    uint64_t published;
+}FRAME_TRACE;
+
+// Typedef for a histogram of times in nanoseconds, with HISTOGRAM_SUB buckets per power of two
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    // Identifier of the slowest input
+    uint32_t max_id;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+}HISTOGRAM;
+
+// Method to get the name of a hop
+const char *hop_name(int hop) {
+    switch (hop) {
+        case HOP_NETWORK:
+            return "network";
+        case HOP_RENDER:
+            return "render";
+        case HOP_PUBLISH:
+            return "publish";
+        case HOP_READ:
+            return "read";
+        case HOP_DETECT:
+            return "detect";
+        default:
+            return "total";
+    }
+}
+
+// Method to get the bucket of a time: the power of two and the next two bits below the leading one
+int histogram_bucket(uint64_t ns) {
+    if (ns < HISTOGRAM_SUB) {
+        return ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    return HISTOGRAM_SUB * (exponent - 1) + ((ns >> (exponent - 2)) & (HISTOGRAM_SUB - 1));
+}
+
+// Method to get the largest time of a bucket
+uint64_t histogram_bucket_max(int bucket) {
+    if (bucket < HISTOGRAM_SUB) {
+        return bucket;
+    }
+    int exponent = bucket / HISTOGRAM_SUB + 1;
+    uint64_t step = 1ULL << (exponent - 2);
+    return (HISTOGRAM_SUB + bucket % HISTOGRAM_SUB) * step + step - 1;
+}
+
+// Method to add the time of an input to a histogram
+void histogram_add(HISTOGRAM *histogram, uint64_t ns, uint32_t id) {
+    histogram->count++;
+    histogram->sum += ns;
+    if (ns >= histogram->max) {
+        histogram->max = ns;
+        histogram->max_id = id;
+    }
+    histogram->buckets[histogram_bucket(ns)]++;
+}
+
+// Method to get an upper bound of the time under which a fraction of the inputs are, within a quarter of the power of two
+uint64_t histogram_percentile(const HISTOGRAM *histogram, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * histogram->count + 0.5), seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank && seen > 0) {
+            uint64_t bound = histogram_bucket_max(bucket);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// Method to make an input the one shown by the next frame, unless an older input is still waiting for it
+void trace_input(FRAME_TRACE *trace, const INPUT_STAMP *stamp) {
+    if (trace->traced && stamp->received - trace->received < TRACE_STALE_NS) {
+        return;
+    }
+    trace->traced = 1;
+    trace->id = stamp->id;
+    trace->sent = stamp->sent;
+    trace->received = stamp->received;
+}
+
+// Method to add the hops of the input shown by a frame, read by processB at read and labelled at detected
+void latency_record(HISTOGRAM *histograms, const FRAME_TRACE *trace, uint64_t read, uint64_t detected) {
+    uint64_t start = trace->received;
+    if (trace->sent != 0 && trace->sent <= trace->received) {
+        histogram_add(&histograms[HOP_NETWORK], trace->received - trace->sent, trace->id);
+        start = trace->sent;
+    }
+    histogram_add(&histograms[HOP_RENDER], trace->drawn - trace->received, trace->id);
+    histogram_add(&histograms[HOP_PUBLISH], trace->published - trace->drawn, trace->id);
+    histogram_add(&histograms[HOP_READ], read - trace->published, trace->id);
+    histogram_add(&histograms[HOP_DETECT], detected - read, trace->id);
+    histogram_add(&histograms[HOP_TOTAL], detected - start, trace->id);
+}
+
+// Method to log the histogram of each hop, with the mean, median, 99th percentile and slowest input in milliseconds
+void latency_log(const HISTOGRAM *histograms, FILE *logFile, const char *timeString) {
+    for (int hop = 0; hop < HOPS; hop++) {
+        const HISTOGRAM *histogram = &histograms[hop];
+        if (histogram->count == 0) {
+            fprintf(logFile, "%s - Latency %-7s: no inputs\n", timeString, hop_name(hop));
+            continue;
+        }
+        fprintf(logFile, "%s - Latency %-7s: %llu inputs, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms (input %u)\n",
+                timeString, hop_name(hop), (unsigned long long)histogram->count, histogram->sum / 1e6 / histogram->count,
+                histogram_percentile(histogram, 0.5) / 1e6, histogram_percentile(histogram, 0.99) / 1e6, histogram->max / 1e6,
+                histogram->max_id);
+    }
+    fflush(logFile);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef MONOTONIC_CLOCK_H
+#define MONOTONIC_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Method to get the monotonic time in nanoseconds, the same clock in every process of the host
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
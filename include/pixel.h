@@ -0,0 +1,30 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+
+/*
+ * Pixel of the frame, in the BGRA byte order of the 32 bit BMP files.
+ * The reference kernels need libbmp, which defines the same type: programs
+ * using them are compiled with ARP_WITH_LIBBMP and take it from there.
+ */
+#ifdef ARP_WITH_LIBBMP
+#include <bmpfile.h>
+#else
+typedef struct {
+    uint8_t blue;
+    uint8_t green;
+    uint8_t red;
+    uint8_t alpha;
+}rgb_pixel_t;
+#endif
+
+// Typedef for a rectangle of pixels, bounds included, empty if max_x < min_x
+typedef struct {
+    int32_t min_x, min_y, max_x, max_y;
+}RECT;
+
+// Mask of the color channels of a pixel read as a little endian 32 bit word, alpha is ignored
+#define PIXEL_COLOR_MASK 0x00FFFFFFu
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include "pixel.h"
+#include "pixel_simd.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Kernels working on the raw frame, a row-major array of BGRA pixels as
+ * written in the shared memory. The reference implementations on the libbmp
+ * bitmap, which they must match, are in reference_kernels.h.
+ * Clearing, copying, converting and scanning the frame go through a table of
+ * kernels chosen at startup among the scalar ones below and the vector ones
+ * of pixel_simd.h, which give the same results.
+ */
+
+// Pixel formats a frame can be converted to
+#define PIXEL_BGRA32 0
+#define PIXEL_BGR24 1
+#define PIXEL_GRAY8 2
+#define PIXEL_FORMATS 3
+
+// Method to get the size in bytes of a pixel of the given format
+int pixel_size(int format) {
+    switch (format) {
+        case PIXEL_BGR24:
+            return 3;
+        case PIXEL_GRAY8:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
+// Method to get the name of a pixel format
+const char *pixel_format_name(int format) {
+    switch (format) {
+        case PIXEL_BGR24:
+            return "bgr24";
+        case PIXEL_GRAY8:
+            return "gray8";
+        default:
+            return "bgra32";
+    }
+}
+
+// Method to read the color channels of a pixel as a single word, zero if the pixel is black
+uint32_t pixel_color(const rgb_pixel_t *pixel) {
+    uint32_t word;
+    memcpy(&word, pixel, sizeof(word));
+    return word & PIXEL_COLOR_MASK;
+}
+
+// Method to set n pixels to black
+void frame_clear_scalar(rgb_pixel_t *frame, size_t n) {
+    memset(frame, 0, n * sizeof(rgb_pixel_t));
+}
+
+// Method to copy n pixels
+void frame_copy_scalar(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n) {
+    memcpy(dst, src, n * sizeof(rgb_pixel_t));
+}
+
+/*
+ * Method to draw a circle of radius one cell and a half centered in the cell (x, y).
+ * Each row of the circle is filled as a single span, clipped to the frame.
+ */
+void frame_draw_circle(rgb_pixel_t *frame, int width, int height, int x, int y, int scale) {
+    rgb_pixel_t pixel = {255, 0, 0, 0};
+    int radius = scale * 3 / 2;
+    int cx = x * scale, cy = y * scale;
+
+    for (int j = -radius; j <= radius; j++) {
+        int py = cy + j;
+        if (py < 0 || py >= height || j * j >= radius * radius) {
+            continue;
+        }
+
+        // Half width of the row: the largest i with i * i + j * j < radius * radius
+        int half = 0;
+        while ((half + 1) * (half + 1) + j * j < radius * radius) {
+            half++;
+        }
+
+        int x_start = cx - half < 0 ? 0 : cx - half;
+        int x_end = cx + half >= width ? width - 1 : cx + half;
+        rgb_pixel_t *row = frame + (size_t)py * width;
+        for (int px = x_start; px <= x_end; px++) {
+            row[px] = pixel;
+        }
+    }
+}
+
+// Method to get the rectangle covered by the circle drawn by frame_draw_circle in the cell (x, y), clipped to the frame
+RECT frame_circle_bounds(int width, int height, int x, int y, int scale) {
+    // The widest row and the tallest column of the circle reach radius - 1 pixels from the center
+    int reach = scale * 3 / 2 - 1;
+    RECT box = {x * scale - reach, y * scale - reach, x * scale + reach, y * scale + reach};
+    box.min_x = box.min_x < 0 ? 0 : box.min_x;
+    box.min_y = box.min_y < 0 ? 0 : box.min_y;
+    box.max_x = box.max_x >= width ? width - 1 : box.max_x;
+    box.max_y = box.max_y >= height ? height - 1 : box.max_y;
+    return box;
+}
+
+// Method to get the smallest rectangle covering two rectangles
+RECT rect_union(RECT a, RECT b) {
+    if (a.max_x < a.min_x) {
+        return b;
+    }
+    if (b.max_x < b.min_x) {
+        return a;
+    }
+    RECT box = {a.min_x < b.min_x ? a.min_x : b.min_x, a.min_y < b.min_y ? a.min_y : b.min_y,
+                a.max_x > b.max_x ? a.max_x : b.max_x, a.max_y > b.max_y ? a.max_y : b.max_y};
+    return box;
+}
+
+// Method to find the first non-black pixel of a row in [x, end), end if none
+int frame_skip_black_scalar(const rgb_pixel_t *row, int x, int end) {
+    while (x < end && pixel_color(&row[x]) == 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to find the first black pixel of a row in [x, end), end if none
+int frame_skip_nonblack_scalar(const rgb_pixel_t *row, int x, int end) {
+    while (x < end && pixel_color(&row[x]) != 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to convert n pixels to bgr24
+void frame_to_bgr24_scalar(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[3 * i] = src[i].blue;
+        dst[3 * i + 1] = src[i].green;
+        dst[3 * i + 2] = src[i].red;
+    }
+}
+
+// Method to convert n pixels to gray8, the integer approximation of the luma
+void frame_to_gray8_scalar(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (src[i].red * GRAY_RED + src[i].green * GRAY_GREEN + src[i].blue * GRAY_BLUE) >> 8;
+    }
+}
+
+// Instruction sets of the kernels, from the narrowest to the widest
+#define SIMD_SCALAR 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+#define SIMD_LEVELS 4
+
+// Typedef for the kernels of an instruction set
+typedef struct {
+    void (*clear_pixels)(rgb_pixel_t *frame, size_t n);
+    void (*copy_pixels)(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n);
+    void (*to_bgr24)(uint8_t *dst, const rgb_pixel_t *src, size_t n);
+    void (*to_gray8)(uint8_t *dst, const rgb_pixel_t *src, size_t n);
+    int (*skip_black)(const rgb_pixel_t *row, int x, int end);
+    int (*skip_nonblack)(const rgb_pixel_t *row, int x, int end);
+}PIXEL_KERNELS;
+
+// Kernels of each instruction set, SSE2 has no byte shuffle and converts to bgr24 with the scalar kernel
+#ifdef PIXEL_SIMD
+const PIXEL_KERNELS simd_kernels[SIMD_LEVELS] = {
+    {frame_clear_scalar, frame_copy_scalar, frame_to_bgr24_scalar, frame_to_gray8_scalar, frame_skip_black_scalar, frame_skip_nonblack_scalar},
+    {frame_clear_sse2, frame_copy_sse2, frame_to_bgr24_scalar, frame_to_gray8_sse2, frame_skip_black_sse2, frame_skip_nonblack_sse2},
+    {frame_clear_avx2, frame_copy_avx2, frame_to_bgr24_avx2, frame_to_gray8_avx2, frame_skip_black_avx2, frame_skip_nonblack_avx2},
+    {frame_clear_avx512, frame_copy_avx512, frame_to_bgr24_avx512, frame_to_gray8_avx512, frame_skip_black_avx512, frame_skip_nonblack_avx512},
+};
+#else
+const PIXEL_KERNELS simd_kernels[1] = {
+    {frame_clear_scalar, frame_copy_scalar, frame_to_bgr24_scalar, frame_to_gray8_scalar, frame_skip_black_scalar, frame_skip_nonblack_scalar},
+};
+#endif
+
+// Kernels in use, the scalar ones until simd_init runs at startup
+const PIXEL_KERNELS *active_kernels = &simd_kernels[SIMD_SCALAR];
+
+// Method to check if the processor supports an instruction set, from CPUID and the registers saved by the kernel
+int simd_supported(int level) {
+#ifdef PIXEL_SIMD
+    __builtin_cpu_init();
+    switch (level) {
+        case SIMD_SCALAR:
+            return 1;
+        case SIMD_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case SIMD_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    return 0;
+#else
+    return level == SIMD_SCALAR;
+#endif
+}
+
+// Method to get the name of an instruction set
+const char *simd_name(int level) {
+    switch (level) {
+        case SIMD_SSE2:
+            return "sse2";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+// Method to use the kernels of an instruction set, returns -1 if the processor does not support it
+int simd_select(int level) {
+    if (level < 0 || level >= SIMD_LEVELS || !simd_supported(level)) {
+        return -1;
+    }
+    active_kernels = &simd_kernels[level];
+    return 0;
+}
+
+// Method to get the widest instruction set supported by the processor, at most the one named by ARP_SIMD
+int simd_best() {
+    int limit = SIMD_LEVELS - 1;
+    const char *value = getenv("ARP_SIMD");
+    for (int level = 0; value != NULL && level < SIMD_LEVELS; level++) {
+        if (strcmp(value, simd_name(level)) == 0) {
+            limit = level;
+        }
+    }
+
+    int level = limit;
+    while (level > SIMD_SCALAR && !simd_supported(level)) {
+        level--;
+    }
+    return level;
+}
+
+// Method to choose the kernels when the program starts
+__attribute__((constructor)) void simd_init() {
+    simd_select(simd_best());
+}
+
+// Method to set n pixels to black
+void frame_clear(rgb_pixel_t *frame, size_t n) {
+    active_kernels->clear_pixels(frame, n);
+}
+
+// Method to copy n pixels
+void frame_copy(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n) {
+    active_kernels->copy_pixels(dst, src, n);
+}
+
+// Method to find the first non-black pixel of a row in [x, end), end if none
+int frame_skip_black(const rgb_pixel_t *row, int x, int end) {
+    return active_kernels->skip_black(row, x, end);
+}
+
+// Method to find the first black pixel of a row in [x, end), end if none
+int frame_skip_nonblack(const rgb_pixel_t *row, int x, int end) {
+    return active_kernels->skip_nonblack(row, x, end);
+}
+
+// Method to convert n pixels to the given format
+void frame_convert(void *dst, int format, const rgb_pixel_t *src, size_t n) {
+    switch (format) {
+        case PIXEL_BGR24:
+            active_kernels->to_bgr24((uint8_t *)dst, src, n);
+            break;
+        case PIXEL_GRAY8:
+            active_kernels->to_gray8((uint8_t *)dst, src, n);
+            break;
+        default:
+            active_kernels->copy_pixels((rgb_pixel_t *)dst, src, n);
+            break;
+    }
+}
+
+/*
+ * Method to find the center of the circle as find_center does, with the same
+ * result, scanning the frame row by row in blocks of columns instead of
+ * column by column.
+ * The runs of non-black pixels are followed down each column, continuing at
+ * the top of the next column, and the earliest of the longest runs gives the
+ * center; x and y are left unchanged if the frame is black.
+ */
+void frame_find_center(const rgb_pixel_t *frame, int width, int height, int scale, int *x, int *y) {
+    enum { BLOCK = 64 };
+    // Per column of the block: current run, run above the first black pixel, longest run ending on a black pixel
+    int length[BLOCK], top_length[BLOCK], first_black[BLOCK], best_length[BLOCK], best_row[BLOCK];
+
+    int max_length = 0;
+    // Run continuing from the bottom of the previous column
+    int carry = 0;
+
+    for (int c0 = 0; c0 < width; c0 += BLOCK) {
+        int n = width - c0 < BLOCK ? width - c0 : BLOCK;
+        for (int c = 0; c < n; c++) {
+            length[c] = 0;
+            first_black[c] = -1;
+            best_length[c] = 0;
+            best_row[c] = 0;
+        }
+
+        for (int j = 0; j < height; j++) {
+            const rgb_pixel_t *row = frame + (size_t)j * width + c0;
+            for (int c = 0; c < n; c++) {
+                if (pixel_color(&row[c]) != 0) {
+                    length[c]++;
+                }
+                else {
+                    if (first_black[c] == -1) {
+                        // The length of the first run depends on the previous column, resolved below
+                        first_black[c] = j;
+                        top_length[c] = length[c];
+                    }
+                    else if (length[c] > best_length[c]) {
+                        best_length[c] = length[c];
+                        best_row[c] = j;
+                    }
+                    length[c] = 0;
+                }
+            }
+        }
+
+        // Visit the columns in order, as the column by column scan does
+        for (int c = 0; c < n; c++) {
+            if (first_black[c] == -1) {
+                // No black pixel: the run goes on in the next column
+                carry += height;
+                continue;
+            }
+
+            // The first run of the column comes before the others, so it wins the ties
+            int column_length = best_length[c], column_row = best_row[c];
+            if (carry + top_length[c] >= column_length) {
+                column_length = carry + top_length[c];
+                column_row = first_black[c];
+            }
+
+            if (column_length > max_length) {
+                max_length = column_length;
+                *x = column_row / scale;
+                *y = (c0 + c - column_length / 2) / scale;
+            }
+
+            carry = length[c];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef PIXEL_SIMD_H
+#define PIXEL_SIMD_H
+
+#include "pixel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Vector versions of the pixel kernels of pixel_kernels.h, for SSE2, AVX2
+ * and AVX-512 (with the byte and word instructions of AVX512BW). Each one is
+ * compiled for its instruction set with the target attribute, so that the
+ * program still runs on any x86 processor: pixel_kernels.h picks the widest
+ * set the processor supports at startup. They write the same bytes as the
+ * scalar kernels, the pixels after the last full vector are done one by one.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Frames of at least this size are cleared with non-temporal stores, which do not fill the cache with zeros
+#define PIXEL_STREAM_BYTES (1UL << 20)
+
+// Weights of the red, green and blue channels in the luma of the gray8 format, out of 256
+#define GRAY_RED 77
+#define GRAY_GREEN 150
+#define GRAY_BLUE 29
+
+// Method to count the pixels before the first address of the frame aligned to align bytes, n if there is none
+size_t pixel_head(const rgb_pixel_t *frame, size_t n, size_t align) {
+    size_t head = (align - ((uintptr_t)frame & (align - 1))) & (align - 1);
+    if (head % sizeof(rgb_pixel_t) != 0 || head / sizeof(rgb_pixel_t) > n) {
+        return n;
+    }
+    return head / sizeof(rgb_pixel_t);
+}
+
+// Method to convert pixels [i, n) to bgr24 one by one, the tail of the vector conversions
+void bgr24_tail(uint8_t *dst, const rgb_pixel_t *src, size_t i, size_t n) {
+    for (; i < n; i++) {
+        dst[3 * i] = src[i].blue;
+        dst[3 * i + 1] = src[i].green;
+        dst[3 * i + 2] = src[i].red;
+    }
+}
+
+// Method to convert pixels [i, n) to gray8 one by one, the tail of the vector conversions
+void gray8_tail(uint8_t *dst, const rgb_pixel_t *src, size_t i, size_t n) {
+    for (; i < n; i++) {
+        dst[i] = (src[i].red * GRAY_RED + src[i].green * GRAY_GREEN + src[i].blue * GRAY_BLUE) >> 8;
+    }
+}
+
+// Method to read the color channels of pixel x of a row, the tail of the vector scans
+uint32_t pixel_word(const rgb_pixel_t *row, int x) {
+    uint32_t word;
+    memcpy(&word, &row[x], sizeof(word));
+    return word & PIXEL_COLOR_MASK;
+}
+
+#ifdef PIXEL_SIMD
+
+// Method to set n pixels to black, 4 pixels per store
+__attribute__((target("sse2")))
+void frame_clear_sse2(rgb_pixel_t *frame, size_t n) {
+    size_t i = pixel_head(frame, n, 16);
+    memset(frame, 0, i * sizeof(rgb_pixel_t));
+
+    __m128i zero = _mm_setzero_si128();
+    if (n * sizeof(rgb_pixel_t) >= PIXEL_STREAM_BYTES) {
+        for (; i + 4 <= n; i += 4) {
+            _mm_stream_si128((__m128i *)(frame + i), zero);
+        }
+        _mm_sfence();
+    }
+    else {
+        for (; i + 4 <= n; i += 4) {
+            _mm_store_si128((__m128i *)(frame + i), zero);
+        }
+    }
+    memset(frame + i, 0, (n - i) * sizeof(rgb_pixel_t));
+}
+
+// Method to copy n pixels, 16 pixels per iteration
+__attribute__((target("sse2")))
+void frame_copy_sse2(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 12));
+        _mm_storeu_si128((__m128i *)(dst + i), a);
+        _mm_storeu_si128((__m128i *)(dst + i + 4), b);
+        _mm_storeu_si128((__m128i *)(dst + i + 8), c);
+        _mm_storeu_si128((__m128i *)(dst + i + 12), d);
+    }
+    memcpy(dst + i, src + i, (n - i) * sizeof(rgb_pixel_t));
+}
+
+/*
+ * Method to convert 4 pixels to their luma, one per 32 bit lane: each channel
+ * is moved to the low half of the lane, where the products by the weights and
+ * their sum fit in 16 bits, as in the scalar kernel.
+ */
+__attribute__((target("sse2")))
+__m128i gray_sse2(__m128i pixels) {
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    __m128i sum = _mm_mullo_epi16(_mm_and_si128(pixels, byte), _mm_set1_epi32(GRAY_BLUE));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(pixels, 8), byte), _mm_set1_epi32(GRAY_GREEN)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(pixels, 16), byte), _mm_set1_epi32(GRAY_RED)));
+    return _mm_srli_epi32(sum, 8);
+}
+
+// Method to convert n pixels to gray8, 16 pixels per iteration
+__attribute__((target("sse2")))
+void frame_to_gray8_sse2(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = gray_sse2(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m128i b = gray_sse2(_mm_loadu_si128((const __m128i *)(src + i + 4)));
+        __m128i c = gray_sse2(_mm_loadu_si128((const __m128i *)(src + i + 8)));
+        __m128i d = gray_sse2(_mm_loadu_si128((const __m128i *)(src + i + 12)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+    gray8_tail(dst, src, i, n);
+}
+
+// Method to find the first non-black pixel of a row in [x, end), end if none, 4 pixels per comparison
+__attribute__((target("sse2")))
+int frame_skip_black_sse2(const rgb_pixel_t *row, int x, int end) {
+    const __m128i mask = _mm_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 4 <= end; x += 4) {
+        __m128i colors = _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + x)), mask);
+        int black = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(colors, _mm_setzero_si128())));
+        if (black != 0xF) {
+            return x + __builtin_ctz(~black);
+        }
+    }
+    while (x < end && pixel_word(row, x) == 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to find the first black pixel of a row in [x, end), end if none, 4 pixels per comparison
+__attribute__((target("sse2")))
+int frame_skip_nonblack_sse2(const rgb_pixel_t *row, int x, int end) {
+    const __m128i mask = _mm_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 4 <= end; x += 4) {
+        __m128i colors = _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + x)), mask);
+        int black = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(colors, _mm_setzero_si128())));
+        if (black != 0) {
+            return x + __builtin_ctz(black);
+        }
+    }
+    while (x < end && pixel_word(row, x) != 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to set n pixels to black, 8 pixels per store
+__attribute__((target("avx2")))
+void frame_clear_avx2(rgb_pixel_t *frame, size_t n) {
+    size_t i = pixel_head(frame, n, 32);
+    memset(frame, 0, i * sizeof(rgb_pixel_t));
+
+    __m256i zero = _mm256_setzero_si256();
+    if (n * sizeof(rgb_pixel_t) >= PIXEL_STREAM_BYTES) {
+        for (; i + 8 <= n; i += 8) {
+            _mm256_stream_si256((__m256i *)(frame + i), zero);
+        }
+        _mm_sfence();
+    }
+    else {
+        for (; i + 8 <= n; i += 8) {
+            _mm256_store_si256((__m256i *)(frame + i), zero);
+        }
+    }
+    memset(frame + i, 0, (n - i) * sizeof(rgb_pixel_t));
+}
+
+// Method to copy n pixels, 32 pixels per iteration
+__attribute__((target("avx2")))
+void frame_copy_avx2(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 24));
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), b);
+        _mm256_storeu_si256((__m256i *)(dst + i + 16), c);
+        _mm256_storeu_si256((__m256i *)(dst + i + 24), d);
+    }
+    memcpy(dst + i, src + i, (n - i) * sizeof(rgb_pixel_t));
+}
+
+/*
+ * Method to convert n pixels to bgr24, 8 pixels per iteration: the alpha
+ * bytes are dropped inside each 128 bit lane, then the two lanes of 12 bytes
+ * are packed together and exactly 24 bytes are stored.
+ */
+__attribute__((target("avx2")))
+void frame_to_bgr24_avx2(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i));
+        pixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, shuffle), pack);
+        _mm_storeu_si128((__m128i *)(dst + 3 * i), _mm256_castsi256_si128(pixels));
+        _mm_storel_epi64((__m128i *)(dst + 3 * i + 16), _mm256_extracti128_si256(pixels, 1));
+    }
+    bgr24_tail(dst, src, i, n);
+}
+
+// Method to convert 8 pixels to their luma, one per 32 bit lane, as gray_sse2 does
+__attribute__((target("avx2")))
+__m256i gray_avx2(__m256i pixels) {
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    __m256i sum = _mm256_mullo_epi16(_mm256_and_si256(pixels, byte), _mm256_set1_epi32(GRAY_BLUE));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte), _mm256_set1_epi32(GRAY_GREEN)));
+    sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte), _mm256_set1_epi32(GRAY_RED)));
+    return _mm256_srli_epi32(sum, 8);
+}
+
+// Method to convert n pixels to gray8, 32 pixels per iteration, the packs work inside the lanes and are put back in order
+__attribute__((target("avx2")))
+void frame_to_gray8_avx2(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = gray_avx2(_mm256_loadu_si256((const __m256i *)(src + i)));
+        __m256i b = gray_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 8)));
+        __m256i c = gray_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 16)));
+        __m256i d = gray_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 24)));
+        __m256i gray = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permutevar8x32_epi32(gray, order));
+    }
+    gray8_tail(dst, src, i, n);
+}
+
+// Method to find the first non-black pixel of a row in [x, end), end if none, 8 pixels per comparison
+__attribute__((target("avx2")))
+int frame_skip_black_avx2(const rgb_pixel_t *row, int x, int end) {
+    const __m256i mask = _mm256_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 8 <= end; x += 8) {
+        __m256i colors = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + x)), mask);
+        int black = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(colors, _mm256_setzero_si256())));
+        if (black != 0xFF) {
+            return x + __builtin_ctz(~black);
+        }
+    }
+    while (x < end && pixel_word(row, x) == 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to find the first black pixel of a row in [x, end), end if none, 8 pixels per comparison
+__attribute__((target("avx2")))
+int frame_skip_nonblack_avx2(const rgb_pixel_t *row, int x, int end) {
+    const __m256i mask = _mm256_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 8 <= end; x += 8) {
+        __m256i colors = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + x)), mask);
+        int black = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(colors, _mm256_setzero_si256())));
+        if (black != 0) {
+            return x + __builtin_ctz(black);
+        }
+    }
+    while (x < end && pixel_word(row, x) != 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to set n pixels to black, 16 pixels per store
+__attribute__((target("avx512f")))
+void frame_clear_avx512(rgb_pixel_t *frame, size_t n) {
+    size_t i = pixel_head(frame, n, 64);
+    memset(frame, 0, i * sizeof(rgb_pixel_t));
+
+    __m512i zero = _mm512_setzero_si512();
+    if (n * sizeof(rgb_pixel_t) >= PIXEL_STREAM_BYTES) {
+        for (; i + 16 <= n; i += 16) {
+            _mm512_stream_si512((void *)(frame + i), zero);
+        }
+        _mm_sfence();
+    }
+    else {
+        for (; i + 16 <= n; i += 16) {
+            _mm512_store_si512((void *)(frame + i), zero);
+        }
+    }
+    memset(frame + i, 0, (n - i) * sizeof(rgb_pixel_t));
+}
+
+// Method to copy n pixels, 64 pixels per iteration
+__attribute__((target("avx512f")))
+void frame_copy_avx512(rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void *)(src + i));
+        __m512i b = _mm512_loadu_si512((const void *)(src + i + 16));
+        __m512i c = _mm512_loadu_si512((const void *)(src + i + 32));
+        __m512i d = _mm512_loadu_si512((const void *)(src + i + 48));
+        _mm512_storeu_si512((void *)(dst + i), a);
+        _mm512_storeu_si512((void *)(dst + i + 16), b);
+        _mm512_storeu_si512((void *)(dst + i + 32), c);
+        _mm512_storeu_si512((void *)(dst + i + 48), d);
+    }
+    memcpy(dst + i, src + i, (n - i) * sizeof(rgb_pixel_t));
+}
+
+// Method to convert n pixels to bgr24, 16 pixels per iteration, the 4 lanes of 12 bytes are packed and 48 bytes stored
+__attribute__((target("avx512f,avx512bw")))
+void frame_to_bgr24_avx512(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    const __m512i pack = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i pixels = _mm512_loadu_si512((const void *)(src + i));
+        pixels = _mm512_permutexvar_epi32(pack, _mm512_shuffle_epi8(pixels, shuffle));
+        _mm512_mask_storeu_epi32(dst + 3 * i, 0x0FFF, pixels);
+    }
+    bgr24_tail(dst, src, i, n);
+}
+
+// Method to convert 16 pixels to their luma, one per 32 bit lane, as gray_sse2 does
+__attribute__((target("avx512f,avx512bw")))
+__m512i gray_avx512(__m512i pixels) {
+    const __m512i byte = _mm512_set1_epi32(0xFF);
+    __m512i sum = _mm512_mullo_epi16(_mm512_and_si512(pixels, byte), _mm512_set1_epi32(GRAY_BLUE));
+    sum = _mm512_add_epi16(sum, _mm512_mullo_epi16(_mm512_and_si512(_mm512_srli_epi32(pixels, 8), byte), _mm512_set1_epi32(GRAY_GREEN)));
+    sum = _mm512_add_epi16(sum, _mm512_mullo_epi16(_mm512_and_si512(_mm512_srli_epi32(pixels, 16), byte), _mm512_set1_epi32(GRAY_RED)));
+    return _mm512_srli_epi32(sum, 8);
+}
+
+// Method to convert n pixels to gray8, 64 pixels per iteration, the packs work inside the lanes and are put back in order
+__attribute__((target("avx512f,avx512bw")))
+void frame_to_gray8_avx512(uint8_t *dst, const rgb_pixel_t *src, size_t n) {
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i a = gray_avx512(_mm512_loadu_si512((const void *)(src + i)));
+        __m512i b = gray_avx512(_mm512_loadu_si512((const void *)(src + i + 16)));
+        __m512i c = gray_avx512(_mm512_loadu_si512((const void *)(src + i + 32)));
+        __m512i d = gray_avx512(_mm512_loadu_si512((const void *)(src + i + 48)));
+        __m512i gray = _mm512_packus_epi16(_mm512_packs_epi32(a, b), _mm512_packs_epi32(c, d));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_permutexvar_epi32(order, gray));
+    }
+    gray8_tail(dst, src, i, n);
+}
+
+// Method to find the first non-black pixel of a row in [x, end), end if none, 16 pixels per comparison
+__attribute__((target("avx512f")))
+int frame_skip_black_avx512(const rgb_pixel_t *row, int x, int end) {
+    const __m512i mask = _mm512_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 16 <= end; x += 16) {
+        __mmask16 colored = _mm512_test_epi32_mask(_mm512_loadu_si512((const void *)(row + x)), mask);
+        if (colored != 0) {
+            return x + __builtin_ctz(colored);
+        }
+    }
+    while (x < end && pixel_word(row, x) == 0) {
+        x++;
+    }
+    return x;
+}
+
+// Method to find the first black pixel of a row in [x, end), end if none, 16 pixels per comparison
+__attribute__((target("avx512f")))
+int frame_skip_nonblack_avx512(const rgb_pixel_t *row, int x, int end) {
+    const __m512i mask = _mm512_set1_epi32(PIXEL_COLOR_MASK);
+    for (; x + 16 <= end; x += 16) {
+        __mmask16 black = _mm512_testn_epi32_mask(_mm512_loadu_si512((const void *)(row + x)), mask);
+        if (black != 0) {
+            return x + __builtin_ctz(black);
+        }
+    }
+    while (x < end && pixel_word(row, x) != 0) {
+        x++;
+    }
+    return x;
+}
+
+#endif
+
+#endif
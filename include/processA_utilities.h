@@ -4,6 +4,7 @@
 #include <math.h>
 #include <time.h>
 #include <stdlib.h>
+#include "simulation.h"
 
 // Typedef for circle struct
 typedef struct {
@@ -35,7 +36,8 @@ void draw_btn(WINDOW *btn, char label, int color) {
     waddch(btn, label);
     attroff(A_BOLD);
 
-    wrefresh(btn);
+    // Stage the button, the terminal is written by the renderer
+    wnoutrefresh(btn);
 }
 
 // Utility method to check if button has been pressed
@@ -55,7 +57,11 @@ void draw_side_ui() {
 
     mvvline(0, COLS - BTN_SIZE_X - 1, ACS_VLINE, LINES);
     draw_btn(print_btn, 'P', 2);
-    refresh();
+}
+
+// Method to draw the help line at the bottom of the window
+void draw_help() {
+    mvprintw(LINES - 1, 1, "Press q to quit");
 }
 
 // Set circle's initial position in the center of the window
@@ -73,7 +79,6 @@ void draw_circle() {
     mvaddch(circle.y, circle.x - 1, '@');
     mvaddch(circle.y, circle.x + 1, '@');
     attroff(COLOR_PAIR(1));
-    refresh();
 }
 
 // Move circle window according to user's input
@@ -111,7 +116,77 @@ void move_circle(int cmd) {
         default:
             break;
     }
-    refresh();
+}
+
+// Method to apply an arrow key to the body followed by the circle
+void press_key(SIMULATION *sim, BODY *body, int cmd) {
+    switch (cmd)
+    {
+        case KEY_LEFT:
+            body_press(sim, body, -1, 0, monotonic_ns());
+            break;
+        case KEY_RIGHT:
+            body_press(sim, body, 1, 0, monotonic_ns());
+            break;
+        case KEY_UP:
+            body_press(sim, body, 0, -1, monotonic_ns());
+            break;
+        case KEY_DOWN:
+            body_press(sim, body, 0, 1, monotonic_ns());
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Move circle one character at a time towards the cell of the body.
+ * If the border stops the circle, the body is stopped there too.
+ * Returns TRUE if the circle moved.
+ */
+int follow_body(BODY *body) {
+    int target_x = (int)round(body->x);
+    int target_y = (int)round(body->y);
+    int moved = FALSE;
+
+    while (circle.x != target_x || circle.y != target_y) {
+        int prev_x = circle.x;
+        int prev_y = circle.y;
+
+        if (circle.x < target_x) {
+            move_circle(KEY_RIGHT);
+        }
+        else if (circle.x > target_x) {
+            move_circle(KEY_LEFT);
+        }
+        if (circle.y < target_y) {
+            move_circle(KEY_DOWN);
+        }
+        else if (circle.y > target_y) {
+            move_circle(KEY_UP);
+        }
+
+        if (circle.x == prev_x && circle.y == prev_y) {
+            // Blocked by the border
+            body_set(body, circle.x, circle.y);
+            break;
+        }
+        moved = TRUE;
+
+        // Stop on the border only along the blocked axis
+        if (circle.x == prev_x && circle.x != target_x) {
+            body->x = circle.x;
+            body->vx = 0;
+            target_x = circle.x;
+        }
+        if (circle.y == prev_y && circle.y != target_y) {
+            body->y = circle.y;
+            body->vy = 0;
+            target_y = circle.y;
+        }
+    }
+
+    return moved;
 }
 
 void init_console_ui() {
@@ -138,6 +213,7 @@ void init_console_ui() {
     // Draw UI elements
     draw_circle();
     draw_side_ui();
+    draw_help();
 
     // Activate input listening (keybord + mouse events ...)
     keypad(stdscr, TRUE);
@@ -163,6 +239,7 @@ void reset_console_ui() {
     // Draw UI elements
     draw_circle();
     draw_side_ui();
+    draw_help();
 }
 
 
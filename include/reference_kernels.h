@@ -0,0 +1,148 @@
+#ifndef ARP_WITH_LIBBMP
+#error "the reference kernels need libbmp: compile with -DARP_WITH_LIBBMP -lbmp"
+#endif
+
+#include "pixel_kernels.h"
+#include <bmpfile.h>
+#include <math.h>
+
+/*
+ * Reference implementations of the pixel kernels, pixel by pixel through
+ * libbmp as the processes first did. They define the expected output of the
+ * kernels of pixel_kernels.h and are checked against them by the benchmark.
+ */
+
+// Method to draw a circle of radius one cell and a half on a bitmap centered in given coordinates
+void draw_bmp_circle(bmpfile_t *bmp, int x, int y, int scale) {
+
+    // Data type for defining pixel colors (BGRA)
+    rgb_pixel_t pixel = {255, 0, 0, 0};
+
+    // Radius of the circle
+    int radius = scale * 3 / 2;
+
+    // Draw the circle
+    for (int i = -radius; i <= radius; i++) {
+        for (int j = -radius; j <= radius; j++) {
+            // If distance is smaller, point is within the circle
+            if (sqrt(i * i + j * j) < radius) {
+                /*
+                 * Color the pixel at the specified (x,y) position with a factor of scale
+                 * with the given pixel values
+                 */
+                bmp_set_pixel(bmp, x * scale + i, y * scale + j, pixel);
+            }
+        }
+    }
+}
+
+// Method to erase all the bitmap
+void erase_bmp(bmpfile_t *bmp, int width, int height) {
+
+    // Data type for defining pixel colors (BGRA)
+    rgb_pixel_t pixel = {0, 0, 0, 0};
+
+    // Erase the bitmap
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            bmp_set_pixel(bmp, i, j, pixel);
+        }
+    }
+}
+
+// Method to convert the bitmap to a matrix
+void bmp_to_static(bmpfile_t *bmp, rgb_pixel_t *matrix, int width, int height) {
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            // Get the pixel from the bitmap
+            rgb_pixel_t *pixel = bmp_get_pixel(bmp, i, j);
+            // Set the pixel in the matrix
+            matrix[i + width * j].alpha = pixel->alpha;
+            matrix[i + width * j].red = pixel->red;
+            matrix[i + width * j].green = pixel->green;
+            matrix[i + width * j].blue = pixel->blue;
+        }
+    }
+}
+
+// Method to convert a matrix to the bitmap
+void static_to_bmp(const rgb_pixel_t *matrix, bmpfile_t *bmp, int width, int height) {
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            // Set the pixel of the matrix in the bitmap
+            bmp_set_pixel(bmp, i, j, matrix[i + width * j]);
+        }
+    }
+}
+
+// Method to find center of the circle in the frame, scanning it column by column
+void find_center(const rgb_pixel_t *frame, int width, int height, int scale, int *x, int *y) {
+    // Variable to store the length of the current circumference rope
+    int length = 0;
+
+    // Variable to store the length of the longest circumference rope
+    int max_length = 0;
+
+    // Cycle through the frame
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            // Get the pixel at the specified (x,y) position
+            const rgb_pixel_t *pixel = &frame[i + width * j];
+
+            // If the pixel is not black
+            if (pixel->blue != 0 || pixel->green != 0 || pixel->red != 0) {
+                // Increment the length of the current circumference rope
+                length++;
+            }
+            else {
+                // If the current circumference rope is longer than the longest one
+                if (length > max_length) {
+                    // Update the longest circumference rope
+                    max_length = length;
+
+                    // Update the center of the circle
+                    *x = j / scale;
+                    *y = (i - length / 2) / scale;
+                }
+
+                // Reset the length of the current circumference rope
+                length = 0;
+            }
+        }
+    }
+}
+
+// Method to convert n pixels to the given format, one channel at a time
+void convert_reference(void *dst, int format, const rgb_pixel_t *src, size_t n) {
+    uint8_t *out = (uint8_t *)dst;
+    int size = pixel_size(format);
+
+    for (size_t i = 0; i < n; i++) {
+        if (format == PIXEL_GRAY8) {
+            out[i] = (src[i].red * 77 + src[i].green * 150 + src[i].blue * 29) >> 8;
+        }
+        else {
+            out[size * i] = src[i].blue;
+            out[size * i + 1] = src[i].green;
+            out[size * i + 2] = src[i].red;
+            if (size == 4) {
+                out[size * i + 3] = src[i].alpha;
+            }
+        }
+    }
+}
+
+// Method to count the runs of non-black pixels of a frame, pixel by pixel
+long count_runs_reference(const rgb_pixel_t *frame, int width, int height) {
+    long runs = 0;
+    for (int y = 0; y < height; y++) {
+        int inside = 0;
+        for (int x = 0; x < width; x++) {
+            const rgb_pixel_t *pixel = &frame[x + width * y];
+            int lit = pixel->blue != 0 || pixel->green != 0 || pixel->red != 0;
+            runs += lit && !inside;
+            inside = lit;
+        }
+    }
+    return runs;
+}
@@ -0,0 +1,402 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "pixel_kernels.h"
+#include "thread_pool.h"
+#include "trace_events.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Scene drawn by processA in the shared frame: filled circles of any radius
+ * and color, drawn in the order they were added. The frame is split in
+ * tiles of SCENE_TILE pixels; an object that moves, appears or disappears
+ * marks the tiles it covered and the ones it covers now. Each frame the
+ * objects are binned into the dirty tiles, keeping their order, and the
+ * dirty tiles are cleared and drawn again by the workers of a pool, each
+ * claiming the next tile with an atomic increment: a pixel belongs to a
+ * single tile, so the workers never write the same pixels.
+ */
+
+// Side in pixels of a tile
+#define SCENE_TILE 64
+
+// Dirty tiles under which the calling thread draws them alone, waking the workers costs more
+#define SCENE_PARALLEL_TILES 16
+
+// Typedef for an object of the scene, a filled circle
+typedef struct {
+    // Center and radius in pixels, and velocity in pixels per tick
+    int32_t x, y, radius;
+    int32_t vx, vy;
+    rgb_pixel_t color;
+    // Set while the object is in the scene, and when it changed since the last frame
+    int active;
+    int changed;
+    // Pixels covered in the last frame, empty if not drawn
+    RECT drawn;
+}OBJECT;
+
+// Typedef for the scene and its tiles
+typedef struct {
+    int width, height;
+    OBJECT *objects;
+    int n_objects, capacity;
+    // Set when an object changed since the last frame
+    int pending;
+    // Tiles, set if dirty, and position of each dirty tile in the list of the frame
+    int cols, rows;
+    uint8_t *dirty;
+    int *slot;
+    int *tiles;
+    int n_tiles;
+    // Objects of the k-th dirty tile: bins[bin_start[k]] to bins[bin_start[k + 1]], in drawing order
+    int *bin_start;
+    int *bins;
+    int bin_capacity;
+    // Frame drawn, and next dirty tile claimed by a worker
+    rgb_pixel_t *frame;
+    int next_tile;
+    // Frames, tiles drawn, objects binned and drawing time since the last log
+    unsigned long frames;
+    unsigned long tiles_drawn;
+    unsigned long binned;
+    uint64_t raster_ns;
+    uint64_t raster_max_ns;
+}SCENE;
+
+// Method to mark the tiles covering a rectangle of pixels as dirty
+void scene_mark(SCENE *scene, RECT box) {
+    if (box.max_x < box.min_x || box.max_y < box.min_y) {
+        return;
+    }
+    for (int row = box.min_y / SCENE_TILE; row <= box.max_y / SCENE_TILE; row++) {
+        memset(scene->dirty + row * scene->cols + box.min_x / SCENE_TILE, 1, box.max_x / SCENE_TILE - box.min_x / SCENE_TILE + 1);
+    }
+}
+
+// Method to create an empty scene for a frame, whose tiles are all dirty; returns -1 if the memory cannot be allocated
+int scene_init(SCENE *scene, int width, int height) {
+    memset(scene, 0, sizeof(SCENE));
+    scene->width = width;
+    scene->height = height;
+    scene->cols = (width + SCENE_TILE - 1) / SCENE_TILE;
+    scene->rows = (height + SCENE_TILE - 1) / SCENE_TILE;
+    int n = scene->cols * scene->rows;
+    scene->dirty = malloc(n);
+    scene->slot = malloc(n * sizeof(int));
+    scene->tiles = malloc(n * sizeof(int));
+    scene->bin_start = malloc((n + 1) * sizeof(int));
+    if (scene->dirty == NULL || scene->slot == NULL || scene->tiles == NULL || scene->bin_start == NULL) {
+        return -1;
+    }
+    memset(scene->dirty, 1, n);
+    scene->pending = 1;
+    return 0;
+}
+
+// Method to free a scene
+void scene_destroy(SCENE *scene) {
+    free(scene->objects);
+    free(scene->dirty);
+    free(scene->slot);
+    free(scene->tiles);
+    free(scene->bin_start);
+    free(scene->bins);
+    memset(scene, 0, sizeof(SCENE));
+}
+
+// Method to get the pixels covered by an object, clipped to the frame
+RECT object_bounds(const SCENE *scene, const OBJECT *object) {
+    // The widest row and the tallest column of the circle reach radius - 1 pixels from the center
+    int reach = object->radius - 1;
+    RECT box = {object->x - reach, object->y - reach, object->x + reach, object->y + reach};
+    box.min_x = box.min_x < 0 ? 0 : box.min_x;
+    box.min_y = box.min_y < 0 ? 0 : box.min_y;
+    box.max_x = box.max_x >= scene->width ? scene->width - 1 : box.max_x;
+    box.max_y = box.max_y >= scene->height ? scene->height - 1 : box.max_y;
+    if (box.max_x < box.min_x || box.max_y < box.min_y) {
+        RECT empty = {0, 0, -1, -1};
+        return empty;
+    }
+    return box;
+}
+
+// Method to add an object on top of the others, reusing the slot of a removed one; returns its index, -1 on error
+int scene_add(SCENE *scene, int x, int y, int radius, rgb_pixel_t color) {
+    int id = 0;
+    while (id < scene->n_objects && (scene->objects[id].active || scene->objects[id].changed)) {
+        id++;
+    }
+    if (id == scene->n_objects) {
+        if (scene->n_objects == scene->capacity) {
+            int capacity = scene->capacity > 0 ? scene->capacity * 2 : 64;
+            OBJECT *objects = realloc(scene->objects, capacity * sizeof(OBJECT));
+            if (objects == NULL) {
+                return -1;
+            }
+            scene->objects = objects;
+            scene->capacity = capacity;
+        }
+        scene->n_objects++;
+    }
+
+    OBJECT *object = &scene->objects[id];
+    memset(object, 0, sizeof(OBJECT));
+    object->x = x;
+    object->y = y;
+    object->radius = radius < 1 ? 1 : radius;
+    object->color = color;
+    object->active = 1;
+    object->changed = 1;
+    object->drawn.max_x = -1;
+    scene->pending = 1;
+    return id;
+}
+
+// Method to remove an object, its pixels are cleared in the next frame
+void scene_remove(SCENE *scene, int id) {
+    scene->objects[id].active = 0;
+    scene->objects[id].changed = 1;
+    scene->pending = 1;
+}
+
+// Method to move an object to the pixel (x, y)
+void scene_move(SCENE *scene, int id, int x, int y) {
+    OBJECT *object = &scene->objects[id];
+    if (object->x != x || object->y != y) {
+        object->x = x;
+        object->y = y;
+        object->changed = 1;
+        scene->pending = 1;
+    }
+}
+
+// Method to move the objects with a velocity by the elapsed ticks, bouncing on the sides of the frame
+void scene_advance(SCENE *scene, int ticks) {
+    for (int id = 0; id < scene->n_objects; id++) {
+        OBJECT *object = &scene->objects[id];
+        if (!object->active || (object->vx == 0 && object->vy == 0)) {
+            continue;
+        }
+        for (int t = 0; t < ticks; t++) {
+            if (object->x + object->vx < 0 || object->x + object->vx >= scene->width) {
+                object->vx = -object->vx;
+            }
+            if (object->y + object->vy < 0 || object->y + object->vy >= scene->height) {
+                object->vy = -object->vy;
+            }
+            object->x += object->vx;
+            object->y += object->vy;
+        }
+        object->changed = 1;
+        scene->pending = 1;
+    }
+}
+
+/*
+ * Method to add n objects drifting across the frame, with radii from 2 to
+ * max_radius pixels, random colors and velocities up to 2 pixels per tick.
+ * The same seed always gives the same objects.
+ */
+void scene_scatter(SCENE *scene, int n, int max_radius, unsigned int seed) {
+    for (int k = 0; k < n; k++) {
+        rgb_pixel_t color = {rand_r(&seed) % 255 + 1, rand_r(&seed) % 256, rand_r(&seed) % 256, 0};
+        int x = rand_r(&seed) % scene->width, y = rand_r(&seed) % scene->height;
+        int radius = 2 + rand_r(&seed) % (max_radius > 2 ? max_radius - 1 : 1);
+        int id = scene_add(scene, x, y, radius, color);
+        if (id == -1) {
+            return;
+        }
+        scene->objects[id].vx = rand_r(&seed) % 5 - 2;
+        scene->objects[id].vy = rand_r(&seed) % 5 - 2;
+    }
+}
+
+// Method to draw the rows of an object inside a tile
+void object_draw(const OBJECT *object, rgb_pixel_t *frame, int width, RECT tile) {
+    int r2 = object->radius * object->radius;
+    int y_start = object->y - object->radius + 1 > tile.min_y ? object->y - object->radius + 1 : tile.min_y;
+    int y_end = object->y + object->radius - 1 < tile.max_y ? object->y + object->radius - 1 : tile.max_y;
+
+    for (int py = y_start; py <= y_end; py++) {
+        // Half width of the row: the largest i with i * i + j * j < radius * radius, as frame_draw_circle
+        int j = py - object->y, n = r2 - j * j - 1;
+        int half = (int)sqrt((double)n);
+        while (half * half > n) {
+            half--;
+        }
+        while ((half + 1) * (half + 1) <= n) {
+            half++;
+        }
+
+        int x_start = object->x - half > tile.min_x ? object->x - half : tile.min_x;
+        int x_end = object->x + half < tile.max_x ? object->x + half : tile.max_x;
+        rgb_pixel_t *row = frame + (size_t)py * width;
+        for (int px = x_start; px <= x_end; px++) {
+            row[px] = object->color;
+        }
+    }
+}
+
+// Method to get the pixels of a tile, clipped to the frame
+RECT tile_bounds(const SCENE *scene, int tile) {
+    int col = tile % scene->cols, row = tile / scene->cols;
+    RECT box = {col * SCENE_TILE, row * SCENE_TILE, (col + 1) * SCENE_TILE - 1, (row + 1) * SCENE_TILE - 1};
+    box.max_x = box.max_x >= scene->width ? scene->width - 1 : box.max_x;
+    box.max_y = box.max_y >= scene->height ? scene->height - 1 : box.max_y;
+    return box;
+}
+
+// Worker task clearing and drawing the dirty tiles it claims, until none is left
+void raster_tiles(void *arg, int index, int n_workers) {
+    SCENE *scene = (SCENE *)arg;
+    uint64_t span = span_begin();
+
+    int k;
+    while ((k = __atomic_fetch_add(&scene->next_tile, 1, __ATOMIC_RELAXED)) < scene->n_tiles) {
+        RECT tile = tile_bounds(scene, scene->tiles[k]);
+        for (int y = tile.min_y; y <= tile.max_y; y++) {
+            frame_clear(scene->frame + (size_t)y * scene->width + tile.min_x, tile.max_x - tile.min_x + 1);
+        }
+        for (int b = scene->bin_start[k]; b < scene->bin_start[k + 1]; b++) {
+            object_draw(&scene->objects[scene->bins[b]], scene->frame, scene->width, tile);
+        }
+    }
+
+    span_end("raster_tiles", span);
+}
+
+/*
+ * Method to draw the changes of the scene since the last frame in frame,
+ * on the workers of the pool. Returns the rectangle of the pixels that may
+ * have changed, covering the dirty tiles, empty if nothing changed, or a
+ * rectangle with min_x set to -1 if the bins cannot be allocated.
+ */
+RECT scene_render(SCENE *scene, THREAD_POOL *pool, rgb_pixel_t *frame) {
+    RECT changed = {0, 0, -1, -1}, empty = {0, 0, -1, -1};
+    uint64_t start = monotonic_ns();
+    uint64_t span = span_begin();
+    scene->pending = 0;
+
+    // Mark the tiles an object left and the ones it entered
+    for (int id = 0; id < scene->n_objects; id++) {
+        OBJECT *object = &scene->objects[id];
+        if (!object->changed) {
+            continue;
+        }
+        RECT box = object->active ? object_bounds(scene, object) : empty;
+        scene_mark(scene, object->drawn);
+        scene_mark(scene, box);
+        object->drawn = box;
+        object->changed = 0;
+    }
+
+    // List the dirty tiles
+    scene->n_tiles = 0;
+    for (int tile = 0; tile < scene->cols * scene->rows; tile++) {
+        scene->slot[tile] = -1;
+        if (scene->dirty[tile]) {
+            scene->dirty[tile] = 0;
+            scene->slot[tile] = scene->n_tiles;
+            scene->tiles[scene->n_tiles++] = tile;
+            changed = rect_union(changed, tile_bounds(scene, tile));
+        }
+    }
+    if (scene->n_tiles == 0) {
+        return changed;
+    }
+
+    // Count the objects of each dirty tile, then store them in drawing order
+    memset(scene->bin_start, 0, (scene->n_tiles + 1) * sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int id = 0; id < scene->n_objects; id++) {
+            RECT box = scene->objects[id].drawn;
+            if (!scene->objects[id].active || box.max_x < box.min_x) {
+                continue;
+            }
+            for (int row = box.min_y / SCENE_TILE; row <= box.max_y / SCENE_TILE; row++) {
+                for (int col = box.min_x / SCENE_TILE; col <= box.max_x / SCENE_TILE; col++) {
+                    int k = scene->slot[row * scene->cols + col];
+                    if (k == -1) {
+                        continue;
+                    }
+                    if (pass == 0) {
+                        scene->bin_start[k + 1]++;
+                    }
+                    else {
+                        scene->bins[scene->bin_start[k]++] = id;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0) {
+            // Start of each bin, and room for all of them
+            for (int k = 0; k < scene->n_tiles; k++) {
+                scene->bin_start[k + 1] += scene->bin_start[k];
+            }
+            int total = scene->bin_start[scene->n_tiles];
+            if (total > scene->bin_capacity) {
+                int *bins = realloc(scene->bins, total * sizeof(int));
+                if (bins == NULL) {
+                    changed.min_x = -1;
+                    return changed;
+                }
+                scene->bins = bins;
+                scene->bin_capacity = total;
+            }
+            scene->binned += total;
+        }
+    }
+
+    // The second pass moved each start to the end of its bin, which is the start of the next one
+    for (int k = scene->n_tiles; k > 0; k--) {
+        scene->bin_start[k] = scene->bin_start[k - 1];
+    }
+    scene->bin_start[0] = 0;
+    span_end("scene_bin", span);
+
+    // Draw the dirty tiles, on the workers when there are enough of them
+    scene->frame = frame;
+    scene->next_tile = 0;
+    if (scene->n_tiles >= SCENE_PARALLEL_TILES && pool != NULL && pool->n_workers > 1) {
+        pool_run(pool, raster_tiles, scene);
+    }
+    else {
+        raster_tiles(scene, 0, 1);
+    }
+
+    uint64_t elapsed = monotonic_ns() - start;
+    scene->frames++;
+    scene->tiles_drawn += scene->n_tiles;
+    scene->raster_ns += elapsed;
+    scene->raster_max_ns = elapsed > scene->raster_max_ns ? elapsed : scene->raster_max_ns;
+    return changed;
+}
+
+// Method to log the objects and tiles of the scene and the drawing time per frame since the last log
+void scene_log(SCENE *scene, FILE *logFile, const char *timeString) {
+    int objects = 0;
+    for (int id = 0; id < scene->n_objects; id++) {
+        objects += scene->objects[id].active;
+    }
+    if (scene->frames == 0) {
+        fprintf(logFile, "%s - Scene: %d objects, %d tiles of %d pixels, no frames drawn\n", timeString, objects,
+                scene->cols * scene->rows, SCENE_TILE);
+        return;
+    }
+    fprintf(logFile, "%s - Scene: %d objects, %d tiles of %d pixels, %.1f dirty tiles and %.1f objects binned per frame, "
+            "raster %.3f ms per frame, max %.3f ms, over %lu frames\n", timeString, objects, scene->cols * scene->rows, SCENE_TILE,
+            (double)scene->tiles_drawn / scene->frames, (double)scene->binned / scene->frames, scene->raster_ns / 1e6 / scene->frames,
+            scene->raster_max_ns / 1e6, scene->frames);
+    scene->frames = 0;
+    scene->tiles_drawn = 0;
+    scene->binned = 0;
+    scene->raster_ns = 0;
+    scene->raster_max_ns = 0;
+}
+
+#endif
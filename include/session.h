@@ -0,0 +1,488 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "client_set.h"
+#include "transport.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Commands kept by the client to send them again after a reconnection
+#define SESSION_HISTORY 64
+
+// Delay before the first reconnection attempt, doubled after each failure up to the maximum
+#define RECONNECT_MIN_NS 10000000ULL
+#define RECONNECT_MAX_NS 500000000ULL
+
+// Bytes of the messages kept while the server does not read them, the connection is given up when they overflow
+#define SESSION_QUEUE_SIZE 4096
+
+// Time the client waits for the connection and the answer of the server when opening a session
+#define WELCOME_TIMEOUT_NS 500000000ULL
+
+// Steps of the opening of a connection: open, waiting for the handshake, waiting for the answer of the server
+#define OPENING_DONE 0
+#define OPENING_CONNECT 1
+#define OPENING_WELCOME 2
+
+// The prediction of a client at rest for this time is compared with the state of the server as is
+#define RECONCILE_QUIET_NS 500000000ULL
+
+// Events returned by session_poll and session_receive
+#define SESSION_IDLE 0
+#define SESSION_LOST 1
+#define SESSION_OPENED 2
+#define SESSION_RESUMED 3
+#define SESSION_ACKED 4
+
+/*
+ * Typedef for the session of a client over a stream transport. The client
+ * sends a heartbeat when idle and gives up the connection when the server is
+ * silent for PEER_TIMEOUT_NS or closes it; it then reconnects with the token
+ * of the session, learns how many of its commands the server applied and the
+ * position of the circle, and sends again the commands that were lost.
+ * The server owns the position: the client moves its circle at once and
+ * keeps the cell it predicted after each command, then moves its circle by
+ * the difference when the server acks the command with a different cell.
+ * The socket never blocks: the handshake and the answer of the server are
+ * completed from the loop when the socket is ready, and the messages the
+ * socket cannot take are queued and sent when it becomes writable.
+ */
+typedef struct {
+    int transport;
+    const char *host;
+    int port;
+    // Address of the server, resolved at the first connection
+    struct sockaddr_storage addr;
+    int addr_size;
+    // Socket of the connection, -1 while disconnected
+    int fd;
+    // Step of the opening of the connection, answer of the server read so far and time the opening is given up
+    int opening;
+    char welcome_buffer[sizeof(SESSION_WELCOME)];
+    int welcome_filled;
+    uint64_t opening_deadline;
+    // Bytes of the messages not taken by the socket yet, in order
+    char queue[SESSION_QUEUE_SIZE];
+    int queued;
+    // Token given by the server, 0 before the first connection
+    uint32_t token;
+    // Commands of the session, including those given while disconnected, and the last ones of them
+    uint32_t sent;
+    int history[SESSION_HISTORY];
+    // Cell predicted after each of the last commands, indexed by sequence number, the cell before the first one at 0
+    int predicted_x[SESSION_HISTORY];
+    int predicted_y[SESSION_HISTORY];
+    // Newest state acked by the server, set when not reconciled yet and when it acks a new command
+    uint32_t acked;
+    int state_x, state_y;
+    int new_state;
+    int new_ack;
+    char state_buffer[sizeof(SESSION_STATE)];
+    int state_filled;
+    // Time of the last message sent and received
+    uint64_t last_send;
+    uint64_t last_receive;
+    // Time of the next reconnection attempt and current delay between attempts
+    uint64_t next_attempt;
+    uint64_t backoff;
+    // State of the server at the last opening of the session
+    uint32_t applied;
+    int x, y;
+    // Reconnections, commands sent again, commands lost because older than the history and corrections of the prediction
+    unsigned long reconnects;
+    unsigned long resent;
+    unsigned long lost;
+    unsigned long corrections;
+}CLIENT_SESSION;
+
+// Method to initialize a session, not yet connected
+void session_init(CLIENT_SESSION *session, int transport, const char *host, int port) {
+    memset(session, 0, sizeof(CLIENT_SESSION));
+    session->transport = transport;
+    session->host = host;
+    session->port = port;
+    session->fd = -1;
+    session->backoff = RECONNECT_MIN_NS;
+}
+
+// Method to close the connection, the next attempt to reconnect is after the current delay
+void session_close(CLIENT_SESSION *session, uint64_t now) {
+    if (session->fd != -1) {
+        close(session->fd);
+        session->fd = -1;
+    }
+    session->opening = OPENING_DONE;
+    session->queued = 0;
+    session->next_attempt = now + session->backoff;
+}
+
+// Method to give up an attempt to open the connection, doubling the delay before the next one
+void session_retry(CLIENT_SESSION *session, uint64_t now) {
+    session_close(session, now);
+    session->backoff = session->backoff * 2 > RECONNECT_MAX_NS ? RECONNECT_MAX_NS : session->backoff * 2;
+}
+
+// Method to send the queued bytes the socket takes without blocking, closing the connection on error
+int session_flush(CLIENT_SESSION *session, uint64_t now) {
+    if (session->queued == 0) {
+        return 0;
+    }
+    ssize_t n = send(session->fd, session->queue, session->queued, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        session_close(session, now);
+        return -1;
+    }
+    if (n > 0) {
+        session->queued -= n;
+        memmove(session->queue, session->queue + n, session->queued);
+    }
+    return 0;
+}
+
+/*
+ * Method to send a message of the session after the queued ones, queueing
+ * what the socket does not take. Closes the connection on error, or when
+ * the queue overflows because the server stopped reading.
+ */
+int session_write(CLIENT_SESSION *session, const void *message, size_t size, uint64_t now) {
+    if (session->queued + size > SESSION_QUEUE_SIZE) {
+        session_close(session, now);
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(session->queue + session->queued, message, size);
+    session->queued += size;
+    session->last_send = now;
+    return session_flush(session, now);
+}
+
+/*
+ * Method to send a command, with the cell the client predicted after it.
+ * The command is kept to be sent again after a reconnection if the
+ * connection is down. Returns SESSION_LOST if the connection broke, SESSION_IDLE otherwise.
+ */
+int session_send_key(CLIENT_SESSION *session, int key, int x, int y, uint64_t now) {
+    session->history[session->sent % SESSION_HISTORY] = key;
+    session->sent++;
+    session->predicted_x[session->sent % SESSION_HISTORY] = x;
+    session->predicted_y[session->sent % SESSION_HISTORY] = y;
+    if (session->fd == -1 || session->opening != OPENING_DONE) {
+        return SESSION_IDLE;
+    }
+
+    // The command goes with its stamp, its number in the session and the send time
+    struct {
+        COMMAND_STAMP stamp;
+        char message[MESSAGE_SIZE];
+    }stamped;
+    memcpy(stamped.stamp.magic, STAMP_MAGIC, MESSAGE_SIZE);
+    stamped.stamp.id = htonl(session->sent);
+    stamped.stamp.sent_high = htonl(now >> 32);
+    stamped.stamp.sent_low = htonl(now & 0xFFFFFFFFu);
+    memset(stamped.message, 0, MESSAGE_SIZE);
+    snprintf(stamped.message, MESSAGE_SIZE, "%d", key);
+    return session_write(session, &stamped, sizeof(stamped), now) == -1 ? SESSION_LOST : SESSION_IDLE;
+}
+
+/*
+ * Method to start connecting to the server, resolving its address at the
+ * first attempt. The opening goes on with session_progress once the socket
+ * is ready. Returns -1 on error, with the next attempt after the current delay.
+ */
+int session_connect(CLIENT_SESSION *session, uint64_t now) {
+    if (session->addr_size == 0) {
+        int size = transport_address(session->transport, session->host, session->port, &session->addr);
+        session->addr_size = size > 0 ? size : 0;
+    }
+    session->fd = session->addr_size > 0 ? transport_connect_start(&session->addr, session->addr_size) : -1;
+    if (session->fd < 0) {
+        session->fd = -1;
+        session->next_attempt = now + session->backoff;
+        return -1;
+    }
+    session->opening = OPENING_CONNECT;
+    session->opening_deadline = now + WELCOME_TIMEOUT_NS;
+    return 0;
+}
+
+// Method to check if the socket of the session has to be watched for writing, while the handshake is in progress or messages are queued
+int session_wants_write(const CLIENT_SESSION *session) {
+    return session->fd != -1 && (session->opening == OPENING_CONNECT || session->queued > 0);
+}
+
+// Method to send the opening of the session once connected, with its token; returns -1 on error
+int session_hello(CLIENT_SESSION *session, uint64_t now) {
+    int failure = 0;
+    socklen_t size = sizeof(failure);
+    if (getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &failure, &size) < 0 || failure != 0) {
+        errno = failure != 0 ? failure : errno;
+        return -1;
+    }
+
+    char hello[2 * MESSAGE_SIZE];
+    uint32_t token = htonl(session->token);
+    memcpy(hello, SESSION_MAGIC, MESSAGE_SIZE);
+    memcpy(hello + MESSAGE_SIZE, &token, sizeof(token));
+    if (session_write(session, hello, sizeof(hello), now) == -1) {
+        return -1;
+    }
+    session->opening = OPENING_WELCOME;
+    session->welcome_filled = 0;
+    return 0;
+}
+
+/*
+ * Method to open the session from the answer of the server, resuming it if
+ * the server still knows its token. Returns SESSION_OPENED or
+ * SESSION_RESUMED, or -1 on error with the connection closed.
+ */
+int session_welcome(CLIENT_SESSION *session, const SESSION_WELCOME *welcome, uint64_t now) {
+    session->opening = OPENING_DONE;
+    uint32_t previous = session->token;
+    session->token = ntohl(welcome->token);
+    session->applied = ntohl(welcome->applied);
+    session->x = ntohl(welcome->x);
+    session->y = ntohl(welcome->y);
+    session->last_receive = now;
+    session->backoff = RECONNECT_MIN_NS;
+    session->state_filled = 0;
+    if (previous != 0) {
+        session->reconnects++;
+    }
+
+    // A new session: the server never saw the commands of the previous one, start from its position
+    if (session->token != previous) {
+        session->sent = 0;
+        session->acked = 0;
+        session->predicted_x[0] = session->x;
+        session->predicted_y[0] = session->y;
+        return SESSION_OPENED;
+    }
+
+    // The position of the server is the state after the commands it applied
+    session->acked = session->applied;
+    session->state_x = session->x;
+    session->state_y = session->y;
+    session->new_state = 1;
+    session->new_ack = 1;
+
+    // Send again the commands the server did not apply, those older than the history are lost
+    uint32_t missing = session->sent - session->applied;
+    if (missing > SESSION_HISTORY) {
+        session->lost += missing - SESSION_HISTORY;
+        missing = SESSION_HISTORY;
+    }
+    char message[MESSAGE_SIZE];
+    for (uint32_t seq = session->sent - missing; seq != session->sent && session->fd != -1; seq++) {
+        memset(message, 0, MESSAGE_SIZE);
+        snprintf(message, MESSAGE_SIZE, "%d", session->history[seq % SESSION_HISTORY]);
+        if (session_write(session, message, MESSAGE_SIZE, now) == 0) {
+            session->resent++;
+        }
+    }
+    return session->fd == -1 ? -1 : SESSION_RESUMED;
+}
+
+// Method to read the answer of the server without blocking, returns SESSION_IDLE until it is complete and -1 on error
+int session_read_welcome(CLIENT_SESSION *session, uint64_t now) {
+    ssize_t n = recv(session->fd, session->welcome_buffer + session->welcome_filled,
+                     sizeof(SESSION_WELCOME) - session->welcome_filled, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return SESSION_IDLE;
+    }
+    if (n <= 0) {
+        errno = n == 0 ? ECONNRESET : errno;
+        return -1;
+    }
+    session->welcome_filled += n;
+    if (session->welcome_filled < (int)sizeof(SESSION_WELCOME)) {
+        return SESSION_IDLE;
+    }
+
+    SESSION_WELCOME welcome;
+    memcpy(&welcome, session->welcome_buffer, sizeof(welcome));
+    if (memcmp(welcome.magic, SESSION_MAGIC, MESSAGE_SIZE) != 0) {
+        return -1;
+    }
+    return session_welcome(session, &welcome, now);
+}
+
+/*
+ * Method to go on opening the connection when its socket is ready. Returns
+ * SESSION_OPENED or SESSION_RESUMED once the server answered, SESSION_IDLE
+ * otherwise; on error the connection is closed and tried again later.
+ */
+int session_progress(CLIENT_SESSION *session, uint64_t now) {
+    int opened;
+    if (session->opening == OPENING_CONNECT) {
+        opened = session_hello(session, now);
+    }
+    else {
+        opened = session_flush(session, now) == -1 ? -1 : session_read_welcome(session, now);
+    }
+    if (opened == -1) {
+        session_retry(session, now);
+        return SESSION_IDLE;
+    }
+    return opened;
+}
+
+// Method to open the session before the loop starts, waiting at most WELCOME_TIMEOUT_NS for each step; returns -1 on error
+int session_open(CLIENT_SESSION *session, uint64_t now) {
+    if (session_connect(session, now) == -1) {
+        return -1;
+    }
+    int opened = SESSION_IDLE;
+    while (opened == SESSION_IDLE && session->fd != -1) {
+        struct pollfd pfd = {session->fd, session->opening == OPENING_CONNECT ? POLLOUT : POLLIN | (session->queued > 0 ? POLLOUT : 0), 0};
+        if (poll(&pfd, 1, WELCOME_TIMEOUT_NS / 1000000) <= 0) {
+            session_close(session, now);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        opened = session_progress(session, now);
+    }
+    return session->fd == -1 ? -1 : opened;
+}
+
+/*
+ * Method to read the states acked by the server, keeping the newest one.
+ * Returns SESSION_ACKED if a state was received, SESSION_LOST and closes the
+ * connection if the server closed it or the stream is corrupted, SESSION_IDLE otherwise.
+ */
+int session_receive(CLIENT_SESSION *session, uint64_t now) {
+    if (session->opening != OPENING_DONE) {
+        return session_progress(session, now);
+    }
+    if (session_flush(session, now) == -1) {
+        return SESSION_LOST;
+    }
+
+    char buffer[16 * sizeof(SESSION_STATE)];
+    ssize_t n = recv(session->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        session_close(session, now);
+        return SESSION_LOST;
+    }
+    if (n < 0) {
+        return SESSION_IDLE;
+    }
+    session->last_receive = now;
+
+    int received = SESSION_IDLE;
+    for (ssize_t k = 0; k < n; k++) {
+        session->state_buffer[session->state_filled++] = buffer[k];
+        if (session->state_filled < (int)sizeof(SESSION_STATE)) {
+            continue;
+        }
+        session->state_filled = 0;
+
+        SESSION_STATE state;
+        memcpy(&state, session->state_buffer, sizeof(state));
+        if (memcmp(state.magic, STATE_MAGIC, MESSAGE_SIZE) != 0) {
+            // An ack was cut short: start again from a clean connection
+            session_close(session, now);
+            return SESSION_LOST;
+        }
+        session->new_ack = session->new_ack || ntohl(state.seq) != session->acked;
+        session->acked = ntohl(state.seq);
+        session->state_x = ntohl(state.x);
+        session->state_y = ntohl(state.y);
+        session->new_state = 1;
+        received = SESSION_ACKED;
+    }
+    return received;
+}
+
+/*
+ * Method to reconcile the prediction of the client, at cell (x, y), with the
+ * newest state acked by the server. The cell acked for a command is compared
+ * with the one predicted after it, and the later predictions are moved by
+ * the same difference; while the circle moves, a difference of one cell is
+ * the timing of the ticks and is ignored. Once all the commands are acked and
+ * the client is at rest, its cell is compared with the cell of the server
+ * directly, as the heartbeats keep acking the last state.
+ * Returns 1 and the correction to apply to the client in dx and dy, 0 if none.
+ */
+int session_reconcile(CLIENT_SESSION *session, int x, int y, int at_rest, int *dx, int *dy) {
+    if (!session->new_state) {
+        return 0;
+    }
+    int new_ack = session->new_ack;
+    session->new_state = 0;
+    session->new_ack = 0;
+
+    uint32_t seq = session->acked;
+    if ((int32_t)(session->sent - seq) < 0 || session->sent - seq >= SESSION_HISTORY) {
+        return 0;
+    }
+
+    if (seq == session->sent && at_rest) {
+        *dx = session->state_x - x;
+        *dy = session->state_y - y;
+    }
+    else if (!new_ack) {
+        return 0;
+    }
+    else {
+        *dx = session->state_x - session->predicted_x[seq % SESSION_HISTORY];
+        *dy = session->state_y - session->predicted_y[seq % SESSION_HISTORY];
+        if (!at_rest && abs(*dx) <= 1 && abs(*dy) <= 1) {
+            return 0;
+        }
+    }
+    if (*dx == 0 && *dy == 0) {
+        return 0;
+    }
+
+    for (uint32_t s = seq; s != session->sent + 1; s++) {
+        session->predicted_x[s % SESSION_HISTORY] += *dx;
+        session->predicted_y[s % SESSION_HISTORY] += *dy;
+    }
+    session->corrections++;
+    return 1;
+}
+
+/*
+ * Method to keep the session alive, called at every pass of the loop: sends
+ * a heartbeat when idle, gives up a silent server and starts reconnecting
+ * when due, giving up an opening that takes longer than WELCOME_TIMEOUT_NS.
+ * Returns SESSION_LOST when the connection was lost, SESSION_IDLE otherwise.
+ */
+int session_poll(CLIENT_SESSION *session, uint64_t now) {
+    if (session->fd == -1) {
+        if (now >= session->next_attempt && session_connect(session, now) == -1) {
+            session->backoff = session->backoff * 2 > RECONNECT_MAX_NS ? RECONNECT_MAX_NS : session->backoff * 2;
+        }
+        return SESSION_IDLE;
+    }
+
+    if (session->opening != OPENING_DONE) {
+        if (now > session->opening_deadline) {
+            session_retry(session, now);
+        }
+        return SESSION_IDLE;
+    }
+
+    if (now - session->last_receive > PEER_TIMEOUT_NS) {
+        session_close(session, now);
+        return SESSION_LOST;
+    }
+
+    if (now - session->last_send >= HEARTBEAT_NS) {
+        char heartbeat[MESSAGE_SIZE] = {0};
+        snprintf(heartbeat, MESSAGE_SIZE, "%d", HEARTBEAT_KEY);
+        if (session_write(session, heartbeat, MESSAGE_SIZE, now) == -1) {
+            return SESSION_LOST;
+        }
+    }
+    return SESSION_IDLE;
+}
+
+#endif
@@ -0,0 +1,702 @@
+#include "trajectory_ring.h"
+#include "pixel.h"
+#include "latency.h"
+#include "frame_pyramid.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Name of the shared memory object
+#define SHM_NAME "/SHARED_IMAGE"
+
+// Value written in the header once it is valid
+#define SHM_MAGIC 0x41525032
+
+// Version of the layout of the object, a process only attaches to the layout it was built with
+#define SHM_VERSION 5
+
+// Bytes reserved to the header, the trajectory ring starts on the next page
+#define SHM_HEADER_SIZE 4096
+
+// Size of a page, the frame starts on the first page after the ring and the pyramid on the first page after the frame
+#define SHM_PAGE_SIZE 4096
+
+// Default geometry of the image and size in pixels of a cell of the processA window
+#define DEFAULT_WIDTH 1600
+#define DEFAULT_HEIGHT 600
+#define DEFAULT_DEPTH 4
+#define DEFAULT_SCALE 20
+
+// Largest accepted side of the image
+#define MAX_SIDE 16384
+
+// Allocation policy flags of the shared memory object
+#define SHM_POLICY_POPULATE 1  // prefault the pages when mapping
+#define SHM_POLICY_LOCK 2      // lock the pages in memory
+#define SHM_POLICY_THP 4       // advise transparent huge pages
+#define SHM_POLICY_HUGETLB 8   // allocate from hugetlbfs
+
+// Mount point of hugetlbfs and size of a huge page
+#define HUGETLBFS_DIR "/dev/hugepages"
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+// Typedef for the geometry of the image
+typedef struct {
+    int width, height, depth;
+    // Pixels per cell of the processA window
+    int scale;
+}GEOMETRY;
+
+// Largest number of processes reading the frame at the same time
+#define MAX_READERS 32
+
+// Spins of a reader waiting for a frame being drawn between two checks that processA is still alive
+#define OWNER_CHECK_SPINS 1024
+
+// Milliseconds a restarted processA waits for the owner lock before creating a new object
+#define OWNER_LOCK_TIMEOUT_MS 100
+
+/*
+ * Typedef for the slot of a reader of the frame, in its own cache line so
+ * that readers do not share the lines they write. processA reads the slots
+ * to log how many frames each reader is behind.
+ */
+typedef struct {
+    // Process identifier of the reader, 0 if the slot is free
+    uint32_t pid __attribute__((aligned(64)));
+    // Sequence number of the last frame read
+    uint32_t seq;
+    // Frames read and reads started again because processA was drawing
+    uint64_t frames;
+    uint64_t retries;
+}READER_SLOT;
+
+// Typedef for the header at the beginning of the shared memory object
+typedef struct {
+    uint32_t magic;
+    // Layout of the object, SHM_VERSION
+    uint32_t version;
+    GEOMETRY geometry;
+    // Allocation policy in effect
+    int32_t policy;
+    // Offset in bytes of the trajectory ring
+    uint64_t ring_offset;
+    // Offset and size in bytes of the frame and size of the whole object
+    uint64_t frame_offset;
+    uint64_t frame_size;
+    uint64_t total_size;
+    // Offset in bytes of the occupancy pyramid of the frame and its levels, written with the frame
+    uint64_t pyramid_offset;
+    PYRAMID_LEVEL pyramid[PYRAMID_LEVELS];
+    /*
+     * Ownership of the object: processA holds the robust lock as long as it
+     * runs, so when it dies the kernel hands the lock to the next process
+     * locking it with EOWNERDEAD. A restarted processA takes over the object
+     * of a dead one, keeping the frame, the trajectory and the readers, and
+     * the generation counts the processes that owned it.
+     */
+    pthread_mutex_t owner_lock;
+    uint32_t owner_pid;
+    uint32_t generation;
+    /*
+     * Sequence number of the frame, odd while processA is drawing it: the
+     * readers copy the frame without locking and start again if the number
+     * changed meanwhile, so they never block processA nor each other.
+     */
+    uint32_t frame_seq __attribute__((aligned(64)));
+    // Input shown by the frame, written and read with it
+    FRAME_TRACE trace;
+    // Pixels that may differ from the previous frame, written and read with it
+    RECT dirty;
+    READER_SLOT readers[MAX_READERS];
+}SHARED_HEADER;
+
+_Static_assert(sizeof(SHARED_HEADER) <= SHM_HEADER_SIZE, "the header does not fit before the trajectory ring");
+
+// Typedef for a reader registered in the header, through a writable mapping of the header only
+typedef struct {
+    SHARED_HEADER *header;
+    uint64_t size;
+    READER_SLOT *slot;
+}READER;
+
+// Method to read an integer environment variable, falling back to a default value
+int env_int(const char *name, int default_value) {
+    const char *value = getenv(name);
+    if (value == NULL || atoi(value) <= 0) {
+        return default_value;
+    }
+    return atoi(value);
+}
+
+// Method to read the geometry chosen at launch from ARP_WIDTH, ARP_HEIGHT and ARP_SCALE
+GEOMETRY geometry_from_env() {
+    GEOMETRY geometry;
+    geometry.width = env_int("ARP_WIDTH", DEFAULT_WIDTH);
+    geometry.height = env_int("ARP_HEIGHT", DEFAULT_HEIGHT);
+    geometry.depth = DEFAULT_DEPTH;
+    geometry.scale = env_int("ARP_SCALE", DEFAULT_SCALE);
+
+    if (geometry.width > MAX_SIDE) {
+        geometry.width = MAX_SIDE;
+    }
+    if (geometry.height > MAX_SIDE) {
+        geometry.height = MAX_SIDE;
+    }
+    return geometry;
+}
+
+// Method to compute the size in bytes of the frame
+uint64_t frame_size(GEOMETRY *geometry) {
+    return (uint64_t)geometry->width * geometry->height * sizeof(rgb_pixel_t);
+}
+
+// Method to compute the offset in bytes of the frame, after the header and the ring
+uint64_t frame_offset() {
+    return SHM_HEADER_SIZE + ((ring_size(RING_CAPACITY) + SHM_PAGE_SIZE - 1) & ~(uint64_t)(SHM_PAGE_SIZE - 1));
+}
+
+// Method to get the frame stored after the ring
+rgb_pixel_t *shared_frame(SHARED_HEADER *header) {
+    return (rgb_pixel_t *)((char *)header + header->frame_offset);
+}
+
+// Method to compute the offset in bytes of the pyramid, after the frame
+uint64_t pyramid_offset(GEOMETRY *geometry) {
+    return frame_offset() + ((frame_size(geometry) + SHM_PAGE_SIZE - 1) & ~(uint64_t)(SHM_PAGE_SIZE - 1));
+}
+
+// Method to get the cells of the pyramid stored after the frame
+uint8_t *shared_pyramid(SHARED_HEADER *header) {
+    return (uint8_t *)header + header->pyramid_offset;
+}
+
+// Method to get the trajectory ring stored after the header
+TRAJECTORY_RING *shared_ring(SHARED_HEADER *header) {
+    return (TRAJECTORY_RING *)((char *)header + header->ring_offset);
+}
+
+// Method to read the allocation policy from ARP_SHM_POLICY, a comma separated list of populate, lock, thp and hugetlb
+int policy_from_env() {
+    const char *value = getenv("ARP_SHM_POLICY");
+    if (value == NULL) {
+        return 0;
+    }
+
+    char list[64];
+    snprintf(list, sizeof(list), "%s", value);
+
+    int policy = 0;
+    for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+        if (strcmp(token, "populate") == 0) {
+            policy |= SHM_POLICY_POPULATE;
+        }
+        else if (strcmp(token, "lock") == 0) {
+            policy |= SHM_POLICY_LOCK;
+        }
+        else if (strcmp(token, "thp") == 0) {
+            policy |= SHM_POLICY_THP;
+        }
+        else if (strcmp(token, "hugetlb") == 0) {
+            policy |= SHM_POLICY_HUGETLB;
+        }
+    }
+    return policy;
+}
+
+// Method to write the allocation policy as a readable string
+char *policy_to_string(int policy, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s%s%s%s",
+             policy == 0 ? "default" : "",
+             policy & SHM_POLICY_HUGETLB ? "hugetlb " : "",
+             policy & SHM_POLICY_THP ? "thp " : "",
+             policy & SHM_POLICY_POPULATE ? "populate " : "",
+             policy & SHM_POLICY_LOCK ? "lock " : "");
+
+    // Remove the trailing space
+    size_t length = strlen(buffer);
+    if (length > 0 && buffer[length - 1] == ' ') {
+        buffer[length - 1] = '\0';
+    }
+    return buffer;
+}
+
+// Method to get the path of the object on hugetlbfs
+char *hugetlbfs_path(const char *name, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s", HUGETLBFS_DIR, name);
+    return buffer;
+}
+
+// Method to fault in all the pages of a mapping without changing their content
+void prefault(void *ptr, uint64_t size, int prot) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, size, (prot & PROT_WRITE) ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) {
+        return;
+    }
+#endif
+    // Older kernels: read one byte per page
+    for (uint64_t offset = 0; offset < size; offset += 4096) {
+        (void)*(volatile char *)((char *)ptr + offset);
+    }
+}
+
+/*
+ * Method to map a shared memory object applying the allocation policy.
+ * The flags that cannot be applied are removed from policy.
+ * Returns MAP_FAILED on error.
+ */
+void *map_shared_object(int fd, uint64_t size, int prot, int *policy) {
+    int flags = MAP_SHARED;
+    void *addr = NULL;
+    void *reserve = MAP_FAILED;
+
+    // Transparent huge pages are only used on huge page aligned addresses, so reserve room to align the mapping
+    if (*policy & SHM_POLICY_THP) {
+        reserve = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserve != MAP_FAILED) {
+            addr = (void *)(((uintptr_t)reserve + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+            flags |= MAP_FIXED;
+        }
+    }
+    // Without the advice the pages can be prefaulted directly by mmap
+    else if (*policy & SHM_POLICY_POPULATE) {
+        flags |= MAP_POPULATE;
+    }
+
+    void *ptr = mmap(addr, size, prot, flags, fd, 0);
+    int err_no = errno;
+
+    // Release the parts of the reservation around the mapping
+    if (reserve != MAP_FAILED) {
+        char *reserve_end = (char *)reserve + size + HUGE_PAGE_SIZE;
+        if (ptr == MAP_FAILED) {
+            munmap(reserve, size + HUGE_PAGE_SIZE);
+        }
+        else {
+            if ((char *)addr > (char *)reserve) {
+                munmap(reserve, (char *)addr - (char *)reserve);
+            }
+            if ((char *)addr + size < reserve_end) {
+                munmap((char *)addr + size, reserve_end - ((char *)addr + size));
+            }
+        }
+    }
+
+    if (ptr == MAP_FAILED) {
+        errno = err_no;
+        return MAP_FAILED;
+    }
+
+    // Advise huge pages before any page is faulted in, then prefault
+    if (*policy & SHM_POLICY_THP) {
+        if (madvise(ptr, size, MADV_HUGEPAGE) == -1) {
+            *policy &= ~SHM_POLICY_THP;
+        }
+        if (*policy & SHM_POLICY_POPULATE) {
+            prefault(ptr, size, prot);
+        }
+    }
+
+    // Keep the pages resident, which needs enough RLIMIT_MEMLOCK
+    if ((*policy & SHM_POLICY_LOCK) && mlock(ptr, size) == -1) {
+        *policy &= ~SHM_POLICY_LOCK;
+    }
+
+    return ptr;
+}
+
+// Method to remove the shared memory object, wherever it was allocated
+int shared_image_unlink(const char *name) {
+    char path[256];
+    int shm_result = shm_unlink(name);
+    int hugetlbfs_result = unlink(hugetlbfs_path(name, path, sizeof(path)));
+    return shm_result == 0 || hugetlbfs_result == 0 ? 0 : -1;
+}
+
+/*
+ * Method to create the shared memory object for the given geometry and write its header.
+ * Any previous object with the same name is removed first. If huge pages cannot be
+ * allocated from hugetlbfs the object falls back to shared memory with transparent huge pages.
+ * Returns the mapped header, whose policy field holds the policy in effect, or NULL with errno set.
+ */
+SHARED_HEADER *shared_image_create(const char *name, GEOMETRY *geometry, int policy) {
+    PYRAMID_LEVEL levels[PYRAMID_LEVELS];
+    uint64_t total_size = pyramid_offset(geometry) + pyramid_layout(geometry->width, geometry->height, levels);
+    SHARED_HEADER *header = MAP_FAILED;
+    char path[256];
+
+    // Start from an empty object, so that readers never see a stale header
+    shared_image_unlink(name);
+
+    // Try to allocate the object from hugetlbfs, sized in whole huge pages
+    if (policy & SHM_POLICY_HUGETLB) {
+        uint64_t huge_size = (total_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        int huge_fd = open(hugetlbfs_path(name, path, sizeof(path)), O_CREAT | O_RDWR, 0666);
+        if (huge_fd != -1) {
+            int huge_policy = policy & ~SHM_POLICY_THP;
+            if (ftruncate(huge_fd, huge_size) == 0) {
+                header = map_shared_object(huge_fd, huge_size, PROT_READ | PROT_WRITE, &huge_policy);
+            }
+            close(huge_fd);
+            if (header != MAP_FAILED) {
+                total_size = huge_size;
+                policy = huge_policy;
+            }
+            else {
+                unlink(path);
+            }
+        }
+
+        // Fall back to transparent huge pages
+        if (header == MAP_FAILED) {
+            policy = (policy & ~SHM_POLICY_HUGETLB) | SHM_POLICY_THP;
+        }
+    }
+
+    if (header == MAP_FAILED) {
+        int shm_fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+        if (shm_fd == -1) {
+            return NULL;
+        }
+
+        // Configure the size of the shared memory object
+        if (ftruncate(shm_fd, total_size) == -1) {
+            int err_no = errno;
+            close(shm_fd);
+            shm_unlink(name);
+            errno = err_no;
+            return NULL;
+        }
+
+        // Map the shared memory object into the address space of the process
+        header = map_shared_object(shm_fd, total_size, PROT_READ | PROT_WRITE, &policy);
+        int err_no = errno;
+        close(shm_fd);
+        if (header == MAP_FAILED) {
+            shm_unlink(name);
+            errno = err_no;
+            return NULL;
+        }
+    }
+
+    // Fill the header, publishing the magic number last
+    header->version = SHM_VERSION;
+    header->geometry = *geometry;
+    header->policy = policy;
+    header->ring_offset = SHM_HEADER_SIZE;
+    ring_init(shared_ring(header), RING_CAPACITY);
+    header->frame_offset = frame_offset();
+    header->frame_size = frame_size(geometry);
+    header->total_size = total_size;
+    header->pyramid_offset = pyramid_offset(geometry);
+    memcpy(header->pyramid, levels, sizeof(levels));
+
+    // The creator is the first owner
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->owner_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_lock(&header->owner_lock);
+    header->owner_pid = getpid();
+    header->generation = 1;
+
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return header;
+}
+
+/*
+ * Method to map an existing shared memory object, waiting up to timeout_ms
+ * for its creator to write the header. The mapping follows the allocation
+ * policy written in the header, with protection prot (PROT_READ for readers).
+ * Returns the mapped header, or NULL with errno set.
+ */
+SHARED_HEADER *shared_image_attach(const char *name, int timeout_ms, int prot) {
+    int shm_fd = -1;
+    SHARED_HEADER *header = MAP_FAILED;
+    char path[256];
+
+    // Objects on hugetlbfs can only be mapped in whole huge pages
+    uint64_t header_size = SHM_HEADER_SIZE;
+
+    for (int waited = 0; ; waited += 10) {
+        if (shm_fd == -1) {
+            shm_fd = shm_open(name, (prot & PROT_WRITE) ? O_RDWR : O_RDONLY, 0666);
+        }
+        if (shm_fd == -1) {
+            shm_fd = open(hugetlbfs_path(name, path, sizeof(path)), (prot & PROT_WRITE) ? O_RDWR : O_RDONLY);
+            if (shm_fd != -1) {
+                header_size = HUGE_PAGE_SIZE;
+            }
+        }
+
+        // Map the header as soon as the object has been sized
+        struct stat st;
+        if (shm_fd != -1 && header == MAP_FAILED && fstat(shm_fd, &st) == 0 && st.st_size >= header_size) {
+            header = mmap(0, header_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+        }
+
+        if (header != MAP_FAILED && __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC) {
+            // An object of another layout cannot be read
+            if (header->version != SHM_VERSION) {
+                munmap(header, header_size);
+                close(shm_fd);
+                errno = EPROTO;
+                return NULL;
+            }
+            break;
+        }
+
+        if (waited >= timeout_ms) {
+            if (header != MAP_FAILED) {
+                munmap(header, header_size);
+            }
+            if (shm_fd != -1) {
+                close(shm_fd);
+            }
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+        usleep(10000);
+    }
+
+    // Map the whole object now that its size and policy are known
+    uint64_t total_size = header->total_size;
+    int policy = header->policy & ~SHM_POLICY_HUGETLB;
+    munmap(header, header_size);
+    header = map_shared_object(shm_fd, total_size, prot, &policy);
+    int err_no = errno;
+    close(shm_fd);
+    if (header == MAP_FAILED) {
+        errno = err_no;
+        return NULL;
+    }
+
+    return header;
+}
+
+// Method to unmap the shared memory object
+int shared_image_detach(SHARED_HEADER *header) {
+    return munmap(header, header->total_size);
+}
+
+/*
+ * Method to take the ownership of the object, waiting up to timeout_ms for
+ * the owner lock. If the previous owner died holding it, the lock is made
+ * consistent again. Returns 0, or -1 with errno set to EBUSY if a live
+ * process owns the object.
+ */
+int shared_owner_acquire(SHARED_HEADER *header, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int result = pthread_mutex_timedlock(&header->owner_lock, &deadline);
+    if (result == EOWNERDEAD) {
+        pthread_mutex_consistent(&header->owner_lock);
+    }
+    else if (result != 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    __atomic_store_n(&header->owner_pid, getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&header->generation, header->generation + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Method to give up the ownership of the object, on a clean exit
+void shared_owner_release(SHARED_HEADER *header) {
+    __atomic_store_n(&header->owner_pid, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&header->owner_lock);
+}
+
+// Method to check through a writable mapping of the header if the owner of the object is alive, without blocking
+int shared_owner_alive(SHARED_HEADER *header) {
+    int result = pthread_mutex_trylock(&header->owner_lock);
+    if (result == EBUSY) {
+        return 1;
+    }
+
+    // The owner died holding the lock, or exited: leave the lock free for the next owner
+    if (result == EOWNERDEAD) {
+        pthread_mutex_consistent(&header->owner_lock);
+    }
+    if (result == 0 || result == EOWNERDEAD) {
+        pthread_mutex_unlock(&header->owner_lock);
+    }
+    return 0;
+}
+
+/*
+ * Method to take over the object left by a processA that died or exited,
+ * if it has the same layout and geometry, without initializing it again.
+ * Returns the mapped header, or NULL with errno set to EBUSY if a live
+ * process owns the object.
+ */
+SHARED_HEADER *shared_image_adopt(const char *name, GEOMETRY *geometry) {
+    SHARED_HEADER *header = shared_image_attach(name, 0, PROT_READ | PROT_WRITE);
+    if (header == NULL) {
+        return NULL;
+    }
+
+    GEOMETRY *found = &header->geometry;
+    if (found->width != geometry->width || found->height != geometry->height || found->depth != geometry->depth || found->scale != geometry->scale) {
+        shared_image_detach(header);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (shared_owner_acquire(header, OWNER_LOCK_TIMEOUT_MS) == -1) {
+        shared_image_detach(header);
+        errno = EBUSY;
+        return NULL;
+    }
+    return header;
+}
+
+// Method to start drawing the frame, on processA. The number stays odd if a previous owner died while drawing
+void frame_write_begin(SHARED_HEADER *header) {
+    __atomic_store_n(&header->frame_seq, (header->frame_seq + 1) | 1, __ATOMIC_RELAXED);
+    // The odd sequence number is visible before any pixel of the new frame
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Method to publish the frame drawn since frame_write_begin, on processA
+void frame_write_end(SHARED_HEADER *header) {
+    __atomic_store_n(&header->frame_seq, header->frame_seq + 1, __ATOMIC_RELEASE);
+}
+
+// Method to get the sequence number of the frame before reading it, waiting for processA to finish drawing
+uint32_t frame_read_begin(const SHARED_HEADER *header) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&header->frame_seq, __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+// Method to check after reading the frame if processA changed it meanwhile, so that the read must start again
+int frame_read_retry(const SHARED_HEADER *header, uint32_t seq) {
+    // The pixels are read before the sequence number is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&header->frame_seq, __ATOMIC_RELAXED) != seq;
+}
+
+// Method to claim a free reader slot of the header, or the slot of a dead reader. Returns NULL with EBUSY if all are taken
+READER_SLOT *reader_slot_claim(SHARED_HEADER *header) {
+    for (int i = 0; i < MAX_READERS; i++) {
+        READER_SLOT *slot = &header->readers[i];
+        uint32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        if (pid != 0 && !(kill(pid, 0) == -1 && errno == ESRCH)) {
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&slot->pid, &pid, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            slot->frames = 0;
+            slot->retries = 0;
+            __atomic_store_n(&slot->seq, __atomic_load_n(&header->frame_seq, __ATOMIC_ACQUIRE) & ~1U, __ATOMIC_RELEASE);
+            return slot;
+        }
+    }
+    errno = EBUSY;
+    return NULL;
+}
+
+// Method to free a reader slot
+void reader_slot_release(READER_SLOT *slot) {
+    __atomic_store_n(&slot->pid, 0, __ATOMIC_RELEASE);
+}
+
+// Method to record in its slot that a reader read the frame seq, after retries attempts that failed
+void reader_slot_done(READER_SLOT *slot, uint32_t seq, int retries) {
+    __atomic_store_n(&slot->frames, slot->frames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->retries, slot->retries + retries, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+}
+
+// Method to get how many frames processA published since a reader read its last one
+uint32_t reader_slot_lag(const SHARED_HEADER *header, const READER_SLOT *slot) {
+    uint32_t published = __atomic_load_n(&header->frame_seq, __ATOMIC_ACQUIRE) & ~1U;
+    return (published - __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) / 2;
+}
+
+/*
+ * Method to register a reader of the shared memory object mapped read-only
+ * at header: only the header is mapped again, writable, to claim a slot.
+ * Returns 0, or -1 with errno set.
+ */
+int shared_reader_register(const char *name, SHARED_HEADER *header, READER *reader) {
+    char path[256];
+    int hugetlb = (header->policy & SHM_POLICY_HUGETLB) != 0;
+    int fd = hugetlb ? open(hugetlbfs_path(name, path, sizeof(path)), O_RDWR) : shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Objects on hugetlbfs can only be mapped in whole huge pages
+    reader->size = hugetlb ? HUGE_PAGE_SIZE : SHM_HEADER_SIZE;
+    reader->header = mmap(0, reader->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err_no = errno;
+    close(fd);
+    if (reader->header == MAP_FAILED) {
+        errno = err_no;
+        return -1;
+    }
+
+    reader->slot = reader_slot_claim(reader->header);
+    if (reader->slot == NULL) {
+        munmap(reader->header, reader->size);
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+// Method to unregister a reader
+void shared_reader_unregister(READER *reader) {
+    reader_slot_release(reader->slot);
+    munmap(reader->header, reader->size);
+}
+
+/*
+ * Method to get the sequence number of the frame before reading it, waiting
+ * for processA to finish drawing. Returns -1 if processA died while drawing,
+ * leaving a torn frame until a new processA takes over the object.
+ */
+int reader_frame_begin(READER *reader, uint32_t *seq) {
+    for (int spins = 1; (*seq = __atomic_load_n(&reader->header->frame_seq, __ATOMIC_ACQUIRE)) & 1; spins++) {
+        if (spins % OWNER_CHECK_SPINS == 0 && !shared_owner_alive(reader->header)) {
+            return -1;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+// Method to log the readers registered in the header, with the frames they read and how many they are behind
+void readers_log(const SHARED_HEADER *header, FILE *logFile, const char *timeString) {
+    for (int i = 0; i < MAX_READERS; i++) {
+        const READER_SLOT *slot = &header->readers[i];
+        uint32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        if (pid != 0) {
+            fprintf(logFile, "%s - Reader %u: %llu frames read, %llu reads started again, %u frames behind\n", timeString, pid,
+                    (unsigned long long)slot->frames, (unsigned long long)slot->retries, reader_slot_lag(header, slot));
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#include "monotonic_clock.h"
+#include <math.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Default number of simulation ticks per second and speed of a held key in cells per second
+#define DEFAULT_TICK_HZ 60
+#define DEFAULT_SPEED 15
+
+// A press of the same key within this time is an auto-repeat, so the key is being held
+#define REPEAT_WINDOW_NS 600000000ULL
+
+// A held key is released when it is not repeated within this time
+#define RELEASE_NS 100000000ULL
+
+// Largest number of ticks integrated at once, to avoid jumps after a stall
+#define MAX_TICKS_PER_STEP 5
+
+/*
+ * Typedef for a moving body, with a sub-cell position and a velocity.
+ * Terminals do not report key releases: a single press moves the body by one
+ * cell, while a key held down (auto-repeat) moves it at constant speed until
+ * the repeats stop.
+ */
+typedef struct {
+    double x, y;
+    // Velocity in cells per second
+    double vx, vy;
+    // Direction and time of the last press
+    int last_dx, last_dy;
+    uint64_t last_press;
+}BODY;
+
+// Typedef for the fixed timestep simulation, driven by a timerfd
+typedef struct {
+    int timer_fd;
+    // Duration of a tick in seconds
+    double dt;
+    double speed;
+    unsigned long ticks;
+}SIMULATION;
+
+// Method to start the periodic timer of the simulation, returns -1 on error
+int simulation_init(SIMULATION *sim, int tick_hz, int speed) {
+    sim->dt = 1.0 / tick_hz;
+    sim->speed = speed;
+    sim->ticks = 0;
+
+    sim->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sim->timer_fd == -1) {
+        return -1;
+    }
+
+    struct itimerspec period;
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = 1000000000L / tick_hz;
+    if (tick_hz == 1) {
+        period.it_interval.tv_sec = 1;
+        period.it_interval.tv_nsec = 0;
+    }
+    period.it_value = period.it_interval;
+
+    return timerfd_settime(sim->timer_fd, 0, &period, NULL);
+}
+
+// Method to get the time in nanoseconds until the next expiration of the timer, 0 on error
+uint64_t simulation_next_tick(SIMULATION *sim) {
+    struct itimerspec remaining;
+    if (timerfd_gettime(sim->timer_fd, &remaining) == -1) {
+        return 0;
+    }
+    return (uint64_t)remaining.it_value.tv_sec * 1000000000ULL + remaining.it_value.tv_nsec;
+}
+
+// Method to stop the timer of the simulation
+void simulation_destroy(SIMULATION *sim) {
+    close(sim->timer_fd);
+}
+
+// Method to get the number of ticks elapsed since the last call, 0 if none
+int simulation_ticks(SIMULATION *sim) {
+    uint64_t expirations;
+    if (read(sim->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+    sim->ticks += expirations;
+    return expirations > MAX_TICKS_PER_STEP ? MAX_TICKS_PER_STEP : (int)expirations;
+}
+
+// Method to place a body still at the given cell
+void body_set(BODY *body, int x, int y) {
+    body->x = x;
+    body->y = y;
+    body->vx = 0;
+    body->vy = 0;
+    body->last_dx = 0;
+    body->last_dy = 0;
+    body->last_press = 0;
+}
+
+// Method to apply the press of a key moving in direction (dx, dy)
+void body_press(SIMULATION *sim, BODY *body, int dx, int dy, uint64_t now) {
+    int repeat = dx == body->last_dx && dy == body->last_dy && now - body->last_press < REPEAT_WINDOW_NS;
+
+    if (repeat) {
+        // The key is held: move at constant speed
+        body->vx = dx * sim->speed;
+        body->vy = dy * sim->speed;
+    }
+    else {
+        // A new press: move by one cell
+        body->vx = 0;
+        body->vy = 0;
+        body->x = round(body->x) + dx;
+        body->y = round(body->y) + dy;
+    }
+
+    body->last_dx = dx;
+    body->last_dy = dy;
+    body->last_press = now;
+}
+
+// Method to advance a body by the given number of ticks
+void body_advance(SIMULATION *sim, BODY *body, int ticks, uint64_t now) {
+
+    // Stop on the nearest cell when the held key is released
+    if ((body->vx != 0 || body->vy != 0) && now - body->last_press > RELEASE_NS) {
+        body->vx = 0;
+        body->vy = 0;
+        body->x = round(body->x);
+        body->y = round(body->y);
+    }
+
+    body->x += body->vx * sim->dt * ticks;
+    body->y += body->vy * sim->dt * ticks;
+}
@@ -0,0 +1,156 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Typedef for a task run by every worker of the pool, index goes from 0 to n_workers - 1
+typedef void (*POOL_TASK)(void *arg, int index, int n_workers);
+
+// Typedef for a persistent pool of worker threads
+typedef struct THREAD_POOL THREAD_POOL;
+
+// Typedef for the arguments of a worker thread
+typedef struct {
+    THREAD_POOL *pool;
+    int index;
+}POOL_WORKER;
+
+struct THREAD_POOL {
+    // Number of workers, including the thread calling pool_run
+    int n_workers;
+    pthread_t *threads;
+    POOL_WORKER *workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+
+    // Task being run, its generation and the number of workers still running it
+    POOL_TASK task;
+    void *arg;
+    unsigned long generation;
+    int pending;
+    int stop;
+};
+
+// Body of the worker threads: wait for a new generation, run the task, report completion
+void *pool_worker(void *arg) {
+    POOL_WORKER *worker = (POOL_WORKER *)arg;
+    THREAD_POOL *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        POOL_TASK task = pool->task;
+        void *task_arg = pool->arg;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task(task_arg, worker->index, pool->n_workers);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/*
+ * Method to start a pool of n_workers workers, the calling thread being worker 0.
+ * Returns 0 on success, -1 on error.
+ */
+int pool_create(THREAD_POOL *pool, int n_workers) {
+    memset(pool, 0, sizeof(THREAD_POOL));
+    pool->n_workers = n_workers < 1 ? 1 : n_workers;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    pool->threads = malloc(pool->n_workers * sizeof(pthread_t));
+    pool->workers = malloc(pool->n_workers * sizeof(POOL_WORKER));
+    if (pool->threads == NULL || pool->workers == NULL) {
+        return -1;
+    }
+
+    for (int i = 1; i < pool->n_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, &pool->workers[i]) != 0) {
+            // Run with the workers started so far
+            pool->n_workers = i;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Method to run a task on all the workers and wait for all of them to finish
+void pool_run(THREAD_POOL *pool, POOL_TASK task, void *arg) {
+
+    if (pool->n_workers > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->task = task;
+        pool->arg = arg;
+        pool->pending = pool->n_workers - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start_cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    // The calling thread takes the first share of the work
+    task(arg, 0, pool->n_workers);
+
+    if (pool->n_workers > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->pending > 0) {
+            pthread_cond_wait(&pool->done_cond, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+// Method to stop the workers and free the pool
+void pool_destroy(THREAD_POOL *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->n_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free(pool->threads);
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+}
+
+// Method to read the number of workers from the ARP_THREADS environment variable, default is one per core
+int pool_size_from_env() {
+    const char *value = getenv("ARP_THREADS");
+    if (value != NULL && atoi(value) > 0) {
+        return atoi(value);
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+// Method to compute the rows [y_start, y_end) of stripe index out of n_stripes
+void stripe_rows(int height, int index, int n_stripes, int *y_start, int *y_end) {
+    *y_start = (int)((long)height * index / n_stripes);
+    *y_end = (int)((long)height * (index + 1) / n_stripes);
+}
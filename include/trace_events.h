@@ -0,0 +1,200 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include "monotonic_clock.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Opt-in tracing of the hot paths as Chrome trace events, to be opened in
+ * chrome://tracing or ui.perfetto.dev. With ARP_TRACE_EVENTS set to the path
+ * of the trace, each process records the spans of its stages in its own
+ * buffer: a span only claims a slot with an atomic increment, so the worker
+ * threads record without locks. The main thread appends the buffer to the
+ * file <path>.<pid> when it is half full and when the process exits, and
+ * master merges the files of all the processes into <path>. All the spans
+ * use CLOCK_MONOTONIC, the same clock in every process of the host.
+ */
+
+// Number of spans of the buffer of a process, and number written at once to the file of the process
+#define TRACE_CAPACITY 65536
+#define TRACE_FLUSH_SPANS (TRACE_CAPACITY / 2)
+
+// Typedef for a span of a stage, in nanoseconds
+typedef struct {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+    uint32_t tid;
+}SPAN;
+
+// Typedef for the spans of the process
+typedef struct {
+    // Path of the merged trace, NULL when tracing is off
+    const char *path;
+    const char *process;
+    SPAN *spans;
+    // Slots claimed, may go past the capacity when the buffer is full
+    uint32_t claimed;
+    uint64_t dropped;
+    // Set once the name of the process is written
+    int started;
+}TRACE_EVENTS;
+
+TRACE_EVENTS trace_events = {0};
+
+// Method to start tracing the process if ARP_TRACE_EVENTS is set, returns 1 if tracing
+int trace_events_init(const char *process) {
+    trace_events.path = getenv("ARP_TRACE_EVENTS");
+    trace_events.process = process;
+    if (trace_events.path != NULL && trace_events.path[0] != '\0') {
+        trace_events.spans = malloc(TRACE_CAPACITY * sizeof(SPAN));
+    }
+    if (trace_events.spans == NULL) {
+        trace_events.path = NULL;
+    }
+    return trace_events.path != NULL;
+}
+
+// Method to get the start of a span, 0 when tracing is off
+uint64_t span_begin() {
+    return trace_events.path != NULL ? monotonic_ns() : 0;
+}
+
+// Method to record a span started at begin, from any thread; the span is dropped if the buffer is full
+void span_end(const char *name, uint64_t begin) {
+    if (begin == 0) {
+        return;
+    }
+    uint32_t slot = __atomic_fetch_add(&trace_events.claimed, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_CAPACITY) {
+        __atomic_fetch_add(&trace_events.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    SPAN *span = &trace_events.spans[slot];
+    span->name = name;
+    span->begin = begin;
+    span->end = monotonic_ns();
+    span->tid = syscall(SYS_gettid);
+}
+
+/*
+ * Method to append the spans of the buffer to the file of the process, if
+ * the buffer is half full or if force is set. Only called from the main
+ * thread while no other thread records spans.
+ */
+void trace_events_flush(int force) {
+    uint32_t claimed = __atomic_load_n(&trace_events.claimed, __ATOMIC_ACQUIRE);
+    if (trace_events.path == NULL || (!force && claimed < TRACE_FLUSH_SPANS)) {
+        return;
+    }
+
+    char part[512];
+    snprintf(part, sizeof(part), "%s.%d", trace_events.path, getpid());
+    FILE *file = fopen(part, "a");
+    if (file == NULL) {
+        return;
+    }
+
+    // Each event is followed by a comma, master removes the last one when merging
+    if (!trace_events.started) {
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", getpid(), trace_events.process);
+        trace_events.started = 1;
+    }
+    uint32_t n = claimed < TRACE_CAPACITY ? claimed : TRACE_CAPACITY;
+    for (uint32_t i = 0; i < n; i++) {
+        SPAN *span = &trace_events.spans[i];
+        fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u},\n",
+                span->name, trace_events.process, span->begin / 1e3, (span->end - span->begin) / 1e3, getpid(), span->tid);
+    }
+    if (trace_events.dropped > 0) {
+        fprintf(file, "{\"name\":\"spans dropped\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"dropped\":%llu}},\n",
+                monotonic_ns() / 1e3, getpid(), (unsigned long long)trace_events.dropped);
+    }
+    fclose(file);
+
+    __atomic_store_n(&trace_events.claimed, 0, __ATOMIC_RELEASE);
+}
+
+// Method to write the last spans of the process and stop tracing
+void trace_events_close() {
+    trace_events_flush(1);
+    free(trace_events.spans);
+    trace_events.spans = NULL;
+    trace_events.path = NULL;
+}
+
+/*
+ * Method to merge the files of all the processes traced into a single JSON
+ * array at path, removing them. Returns the number of files merged, -1 on error.
+ */
+int trace_events_merge(const char *path) {
+    char dir_path[512], prefix[512];
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
+    char *slash = strrchr(dir_path, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        snprintf(prefix, sizeof(prefix), "%s.", slash + 1);
+    }
+    else {
+        snprintf(prefix, sizeof(prefix), "%s.", path);
+        snprintf(dir_path, sizeof(dir_path), ".");
+    }
+
+    DIR *dir = opendir(dir_path);
+    FILE *trace = fopen(path, "w");
+    if (dir == NULL || trace == NULL) {
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        if (trace != NULL) {
+            fclose(trace);
+        }
+        return -1;
+    }
+    fprintf(trace, "[\n");
+
+    int merged = 0;
+    long written = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Only the files <path>.<pid>
+        const char *pid = entry->d_name + strlen(prefix);
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0 || *pid == '\0' || strspn(pid, "0123456789") != strlen(pid)) {
+            continue;
+        }
+
+        char part[1024];
+        snprintf(part, sizeof(part), "%s/%s", dir_path, entry->d_name);
+        FILE *file = fopen(part, "r");
+        if (file == NULL) {
+            continue;
+        }
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            fwrite(buffer, 1, n, trace);
+            written += n;
+        }
+        fclose(file);
+        unlink(part);
+        merged++;
+    }
+    closedir(dir);
+
+    // Replace the comma after the last event with the end of the array
+    if (written >= 2) {
+        fseek(trace, -2, SEEK_END);
+    }
+    fprintf(trace, "\n]\n");
+    fclose(trace);
+    return merged;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef TRAJECTORY_RING_H
+#define TRAJECTORY_RING_H
+
+#include "monotonic_clock.h"
+#include <stdint.h>
+#include <time.h>
+
+// Number of positions kept in the ring, must be a power of two
+#define RING_CAPACITY 4096
+
+// Typedef for a position of the circle, in cells of the processA window
+typedef struct {
+    // Sequence number plus one, zero while the event is being written
+    uint64_t sequence;
+    // Monotonic time of the move in nanoseconds
+    uint64_t timestamp;
+    int32_t x, y;
+}POSITION_EVENT;
+
+/*
+ * Typedef for a single-producer, multi-consumer ring of positions.
+ * The producer never waits for the consumers: a consumer falling more than
+ * capacity events behind loses the oldest ones and is told how many.
+ */
+typedef struct {
+    // Number of events written so far, alone in its cache line
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t capacity __attribute__((aligned(64)));
+    POSITION_EVENT events[] __attribute__((aligned(64)));
+}TRAJECTORY_RING;
+
+// Typedef for the position of a consumer in the ring
+typedef struct {
+    // Sequence number of the next event to read
+    uint64_t next;
+    // Number of events overwritten before they could be read
+    uint64_t lost;
+}RING_CURSOR;
+
+// Method to compute the size in bytes of a ring
+uint64_t ring_size(uint32_t capacity) {
+    return sizeof(TRAJECTORY_RING) + (uint64_t)capacity * sizeof(POSITION_EVENT);
+}
+
+// Method to initialize an empty ring
+void ring_init(TRAJECTORY_RING *ring, uint32_t capacity) {
+    ring->capacity = capacity;
+    for (uint32_t i = 0; i < capacity; i++) {
+        ring->events[i].sequence = 0;
+    }
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+}
+
+// Method to append a position to the ring, only called by the producer
+void ring_publish(TRAJECTORY_RING *ring, int x, int y) {
+    uint64_t n = ring->head;
+    POSITION_EVENT *event = &ring->events[n & (ring->capacity - 1)];
+
+    // Invalidate the slot before overwriting it
+    __atomic_store_n(&event->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&event->timestamp, monotonic_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&event->x, x, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->y, y, __ATOMIC_RELAXED);
+
+    // Publish the slot, then the new head
+    __atomic_store_n(&event->sequence, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+// Method to place a cursor on the oldest position still in the ring, or on the next one to be written
+void ring_cursor_init(TRAJECTORY_RING *ring, RING_CURSOR *cursor, int from_oldest) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    cursor->lost = 0;
+    if (!from_oldest) {
+        cursor->next = head;
+    }
+    else {
+        cursor->next = head > ring->capacity ? head - ring->capacity : 0;
+    }
+}
+
+/*
+ * Method to read the next position of a consumer.
+ * Returns 1 if a position was read, 0 if the consumer is up to date.
+ */
+int ring_read(TRAJECTORY_RING *ring, RING_CURSOR *cursor, POSITION_EVENT *out) {
+    while (1) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (cursor->next >= head) {
+            return 0;
+        }
+
+        // Skip the events already overwritten by the producer
+        if (head - cursor->next > ring->capacity) {
+            cursor->lost += head - ring->capacity - cursor->next;
+            cursor->next = head - ring->capacity;
+        }
+
+        POSITION_EVENT *event = &ring->events[cursor->next & (ring->capacity - 1)];
+        uint64_t sequence = __atomic_load_n(&event->sequence, __ATOMIC_ACQUIRE);
+        if (sequence != cursor->next + 1) {
+            // The slot is being overwritten, read the head again
+            continue;
+        }
+
+        out->sequence = sequence - 1;
+        out->timestamp = __atomic_load_n(&event->timestamp, __ATOMIC_RELAXED);
+        out->x = __atomic_load_n(&event->x, __ATOMIC_RELAXED);
+        out->y = __atomic_load_n(&event->y, __ATOMIC_RELAXED);
+
+        // The copy is valid only if the slot was not overwritten meanwhile
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&event->sequence, __ATOMIC_RELAXED) != sequence) {
+            continue;
+        }
+
+        cursor->next++;
+        return 1;
+    }
+}
+
+// Method to read the last position published, returns 0 if the ring is empty
+int ring_last(TRAJECTORY_RING *ring, POSITION_EVENT *out) {
+    RING_CURSOR cursor = {0, 0};
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == 0) {
+        return 0;
+    }
+    cursor.next = head - 1;
+    return ring_read(ring, &cursor, out);
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "udp_link.h"
+#include "command_queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Transports of the commands between client and server. All of them carry
+ * the same 4 byte messages, the key code as a NUL terminated string, and the
+ * server acks every command with the same message: TCP and the Unix domain
+ * socket are byte streams read by the client set, UDP adds the sequence
+ * numbers of udp_link.h and the shared memory queue of command_queue.h links
+ * a single client on the same host without system calls on the fast path.
+ */
+#define TRANSPORT_TCP 0
+#define TRANSPORT_UDP 1
+#define TRANSPORT_UNIX 2
+#define TRANSPORT_SHM 3
+#define TRANSPORTS 4
+
+// Method to get the name of a transport
+const char *transport_name(int transport) {
+    switch (transport) {
+        case TRANSPORT_UDP:
+            return "udp";
+        case TRANSPORT_UNIX:
+            return "unix";
+        case TRANSPORT_SHM:
+            return "shm";
+        default:
+            return "tcp";
+    }
+}
+
+// Method to parse the name of a transport, -1 if unknown
+int transport_parse(const char *name) {
+    for (int transport = 0; transport < TRANSPORTS; transport++) {
+        if (strcmp(name, transport_name(transport)) == 0) {
+            return transport;
+        }
+    }
+    return -1;
+}
+
+// Method to read the transport from the environment variable ARP_TRANSPORT, TCP if not set or unknown
+int transport_from_env() {
+    const char *value = getenv("ARP_TRANSPORT");
+    int transport = value != NULL ? transport_parse(value) : -1;
+    return transport == -1 ? TRANSPORT_TCP : transport;
+}
+
+// Method to check if a transport is a byte stream, whose clients are kept in a client set
+int transport_is_stream(int transport) {
+    return transport == TRANSPORT_TCP || transport == TRANSPORT_UNIX;
+}
+
+// Method to get the bytes received on a socket and not read yet, the size of the next datagram over UDP
+int transport_pending(int fd) {
+    int n = 0;
+    return ioctl(fd, FIONREAD, &n) == 0 ? n : 0;
+}
+
+// Method to get the path of the Unix domain socket of a port
+void transport_unix_path(int port, char *path, size_t size) {
+    snprintf(path, size, "/tmp/arp_%d.sock", port);
+}
+
+/*
+ * Method to open the socket of the server on a port: listening for TCP and
+ * the Unix domain socket, bound for UDP. Returns the socket or -1 on error.
+ */
+int transport_listen(int transport, int port) {
+    int fd;
+
+    if (transport == TRANSPORT_UNIX) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        transport_unix_path(port, addr.sun_path, sizeof(addr.sun_path));
+
+        // Remove the socket left by a previous server
+        unlink(addr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+
+        fd = socket(AF_INET, transport == TRANSPORT_UDP ? SOCK_DGRAM : SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+
+        // Restart on the same port while the connections of a previous server are closing
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (transport_is_stream(transport) && listen(fd, 5) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Method to resolve the address of the server, the host is ignored by the Unix domain socket. Returns the size of the address or -1 on error
+int transport_address(int transport, const char *host, int port, struct sockaddr_storage *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+
+    if (transport == TRANSPORT_UNIX) {
+        struct sockaddr_un *path_addr = (struct sockaddr_un *)addr;
+        path_addr->sun_family = AF_UNIX;
+        transport_unix_path(port, path_addr->sun_path, sizeof(path_addr->sun_path));
+        return sizeof(struct sockaddr_un);
+    }
+
+    struct hostent *server = gethostbyname(host);
+    if (server == NULL) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    struct sockaddr_in *server_addr = (struct sockaddr_in *)addr;
+    server_addr->sin_family = AF_INET;
+    memcpy(&server_addr->sin_addr.s_addr, server->h_addr, server->h_length);
+    server_addr->sin_port = htons(port);
+    return sizeof(struct sockaddr_in);
+}
+
+/*
+ * Method to start connecting a stream client to a resolved address without
+ * waiting for the handshake: the socket is non-blocking and writable once
+ * connected. Returns the socket or -1 on error.
+ */
+int transport_connect_start(const struct sockaddr_storage *addr, int size) {
+    int fd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 ||
+        (connect(fd, (const struct sockaddr *)addr, size) < 0 && errno != EINPROGRESS)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Method to connect a client to the server, the host is ignored by the Unix domain socket. Returns the socket or -1 on error
+int transport_connect(int transport, const char *host, int port) {
+    struct sockaddr_storage addr;
+    int size = transport_address(transport, host, port, &addr);
+    if (size < 0) {
+        return -1;
+    }
+
+    int fd = socket(addr.ss_family, transport == TRANSPORT_UDP ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Method to send a command from a client over its transport, returns -1 on error and EAGAIN if the queue is full
+int transport_send_key(int transport, int fd, UDP_SENDER *sender, COMMAND_QUEUE *queue, int key) {
+    char message[QUEUE_MESSAGE_SIZE] = {0};
+
+    switch (transport) {
+        case TRANSPORT_UDP:
+            return udp_send_key(sender, fd, key);
+        case TRANSPORT_SHM:
+            if (!command_ring_send(&queue->commands, key)) {
+                errno = EAGAIN;
+                return -1;
+            }
+            return 0;
+        default:
+            snprintf(message, QUEUE_MESSAGE_SIZE, "%d", key);
+            return send(fd, message, QUEUE_MESSAGE_SIZE, MSG_NOSIGNAL) == QUEUE_MESSAGE_SIZE ? 0 : -1;
+    }
+}
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef UDP_LINK_H
+#define UDP_LINK_H
+
+#include "monotonic_clock.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Value at the beginning of every datagram
+#define UDP_MAGIC 0x41525055
+
+// Types of datagram
+#define UDP_COMMANDS 1
+#define UDP_ACK 2
+
+// Default and maximum number of commands repeated in each datagram
+#define UDP_DEFAULT_REDUNDANCY 4
+#define UDP_MAX_REDUNDANCY 16
+
+// The last datagram is sent again when not acked within this time, at most UDP_MAX_RESENDS times
+#define UDP_RESEND_NS 20000000ULL
+#define UDP_MAX_RESENDS 5
+
+// Maximum number of clients tracked by the server
+#define UDP_MAX_PEERS 64
+
+// A client silent for this time can be forgotten to track a new one when the table is full
+#define UDP_PEER_IDLE_NS 1000000000ULL
+
+/*
+ * Typedef for a datagram. A command datagram carries the newest command and
+ * the ones before it, newest first: keys[i] has sequence number seq - i.
+ * An ack carries in seq the newest command applied by the server.
+ * All the fields are in network byte order.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t count;
+    uint32_t seq;
+    int32_t keys[UDP_MAX_REDUNDANCY];
+}UDP_DATAGRAM;
+
+// Typedef for the sending side of a client
+typedef struct {
+    // Sequence number of the last command, the first one is 1
+    uint32_t seq;
+    // Last commands sent, indexed by sequence number
+    int32_t history[UDP_MAX_REDUNDANCY];
+    int redundancy;
+    // Newest command acked by the server
+    uint32_t acked;
+    // Time of the last send and number of resends of the last datagram
+    uint64_t last_send;
+    int resends;
+    // Number of datagrams sent, and of those sent again for a missing ack
+    unsigned long sent;
+    unsigned long resent;
+    // Percentage of datagrams dropped instead of sent, to simulate a lossy link
+    int drop_percent;
+}UDP_SENDER;
+
+// Typedef for a client as seen by the server
+typedef struct {
+    struct sockaddr_in addr;
+    // Newest command applied and time of the last datagram
+    uint32_t last_seq;
+    uint64_t last_seen;
+    // Datagrams received, commands applied, commands recovered from the copies of a later datagram
+    unsigned long datagrams;
+    unsigned long applied;
+    unsigned long recovered;
+    // Commands never received, datagrams older than the last applied command, datagrams repeating it
+    unsigned long lost;
+    unsigned long reordered;
+    unsigned long duplicates;
+}UDP_PEER;
+
+// Typedef for the receiving side of the server
+typedef struct {
+    UDP_PEER peers[UDP_MAX_PEERS];
+    int n_peers;
+    // Datagrams discarded because malformed or because the table of clients is full of active ones
+    unsigned long invalid;
+    // Idle clients forgotten to make room for new ones
+    unsigned long evicted;
+}UDP_RECEIVER;
+
+// Method to initialize the sending side, repeating each command in the next redundancy - 1 datagrams
+void udp_sender_init(UDP_SENDER *sender, int redundancy) {
+    memset(sender, 0, sizeof(UDP_SENDER));
+    if (redundancy < 1) {
+        redundancy = 1;
+    }
+    sender->redundancy = redundancy > UDP_MAX_REDUNDANCY ? UDP_MAX_REDUNDANCY : redundancy;
+    sender->resends = UDP_MAX_RESENDS;
+}
+
+// Method to send the newest commands not yet acked, up to the redundancy, returns -1 on error
+int udp_sender_flush(UDP_SENDER *sender, int fd) {
+    UDP_DATAGRAM datagram;
+    uint32_t count = sender->seq - sender->acked;
+    if (count > (uint32_t)sender->redundancy) {
+        count = sender->redundancy;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    datagram.magic = htonl(UDP_MAGIC);
+    datagram.type = htons(UDP_COMMANDS);
+    datagram.count = htons(count);
+    datagram.seq = htonl(sender->seq);
+    for (uint32_t i = 0; i < count; i++) {
+        datagram.keys[i] = htonl(sender->history[(sender->seq - i) % UDP_MAX_REDUNDANCY]);
+    }
+
+    size_t size = offsetof(UDP_DATAGRAM, keys) + count * sizeof(int32_t);
+    if (sender->drop_percent > 0 && rand() % 100 < sender->drop_percent) {
+        // The datagram is lost on the way
+    }
+    else if (send(fd, &datagram, size, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+        return -1;
+    }
+    sender->last_send = monotonic_ns();
+    sender->sent++;
+    return 0;
+}
+
+// Method to send a new command on a connected datagram socket, returns -1 on error
+int udp_send_key(UDP_SENDER *sender, int fd, int key) {
+    sender->seq++;
+    sender->history[sender->seq % UDP_MAX_REDUNDANCY] = key;
+    sender->resends = 0;
+    return udp_sender_flush(sender, fd);
+}
+
+// Method to send the last commands again if their ack is late, returns -1 on error
+int udp_sender_poll(UDP_SENDER *sender, int fd, uint64_t now) {
+    if (sender->acked == sender->seq || sender->resends >= UDP_MAX_RESENDS || now - sender->last_send < UDP_RESEND_NS) {
+        return 0;
+    }
+    sender->resends++;
+    sender->resent++;
+    return udp_sender_flush(sender, fd);
+}
+
+/*
+ * Method to read an ack from the server, returns 1 if one was read, 0 if
+ * there are none and -1 on error.
+ */
+int udp_sender_receive(UDP_SENDER *sender, int fd) {
+    UDP_DATAGRAM datagram;
+    ssize_t size = recv(fd, &datagram, sizeof(datagram), MSG_DONTWAIT);
+    if (size < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED ? 0 : -1;
+    }
+    if (size < (ssize_t)offsetof(UDP_DATAGRAM, keys) || ntohl(datagram.magic) != UDP_MAGIC || ntohs(datagram.type) != UDP_ACK) {
+        return 0;
+    }
+
+    // Acks may arrive out of order, keep the newest
+    uint32_t seq = ntohl(datagram.seq);
+    if ((int32_t)(seq - sender->acked) > 0 && (int32_t)(sender->seq - seq) >= 0) {
+        sender->acked = seq;
+    }
+    return 1;
+}
+
+/*
+ * Method to find the state of a client, adding it if new. When the table is
+ * full, the client seen least recently is replaced if it was silent for
+ * UDP_PEER_IDLE_NS, longer than any resend of its last datagram.
+ * Returns NULL if the table is full of active clients.
+ */
+UDP_PEER *udp_find_peer(UDP_RECEIVER *receiver, struct sockaddr_in *addr, uint64_t now) {
+    UDP_PEER *oldest = NULL;
+    for (int i = 0; i < receiver->n_peers; i++) {
+        UDP_PEER *peer = &receiver->peers[i];
+        if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr && peer->addr.sin_port == addr->sin_port) {
+            peer->last_seen = now;
+            return peer;
+        }
+        if (oldest == NULL || peer->last_seen < oldest->last_seen) {
+            oldest = peer;
+        }
+    }
+
+    UDP_PEER *peer;
+    if (receiver->n_peers < UDP_MAX_PEERS) {
+        peer = &receiver->peers[receiver->n_peers++];
+    }
+    else if (now - oldest->last_seen > UDP_PEER_IDLE_NS) {
+        peer = oldest;
+        receiver->evicted++;
+    }
+    else {
+        return NULL;
+    }
+    memset(peer, 0, sizeof(UDP_PEER));
+    peer->addr = *addr;
+    peer->last_seen = now;
+    return peer;
+}
+
+/*
+ * Method to read a datagram on the server and extract the commands not yet
+ * applied, oldest first. Stale and duplicate commands are dropped, and every
+ * datagram is acked with the newest command applied.
+ * Returns the number of commands stored in keys, 0 if none and -1 on error.
+ */
+int udp_receive(UDP_RECEIVER *receiver, int fd, int *keys) {
+    UDP_DATAGRAM datagram;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    ssize_t size = recvfrom(fd, &datagram, sizeof(datagram), MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+    if (size < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+
+    if (size < (ssize_t)offsetof(UDP_DATAGRAM, keys) || ntohl(datagram.magic) != UDP_MAGIC || ntohs(datagram.type) != UDP_COMMANDS) {
+        receiver->invalid++;
+        return 0;
+    }
+    uint32_t count = ntohs(datagram.count);
+    if (count == 0 || count > UDP_MAX_REDUNDANCY || size < (ssize_t)(offsetof(UDP_DATAGRAM, keys) + count * sizeof(int32_t))) {
+        receiver->invalid++;
+        return 0;
+    }
+
+    UDP_PEER *peer = udp_find_peer(receiver, &addr, monotonic_ns());
+    if (peer == NULL) {
+        receiver->invalid++;
+        return 0;
+    }
+    peer->datagrams++;
+
+    uint32_t seq = ntohl(datagram.seq);
+    int n = 0;
+    int32_t ahead = seq - peer->last_seq;
+
+    if (ahead <= 0) {
+        // Nothing new: a copy of the last datagram, or an older one arriving late
+        if (ahead == 0) {
+            peer->duplicates++;
+        }
+        else {
+            peer->reordered++;
+        }
+    }
+    else {
+        // Commands between the last applied and the oldest of the datagram are lost for good
+        if ((uint32_t)ahead > count) {
+            peer->lost += ahead - count;
+            ahead = count;
+        }
+
+        // Apply the new commands oldest first
+        for (int i = ahead - 1; i >= 0; i--) {
+            keys[n++] = ntohl(datagram.keys[i]);
+        }
+        peer->recovered += ahead - 1;
+        peer->applied += ahead;
+        peer->last_seq = seq;
+    }
+
+    // Ack the newest command applied
+    UDP_DATAGRAM ack;
+    ack.magic = htonl(UDP_MAGIC);
+    ack.type = htons(UDP_ACK);
+    ack.count = 0;
+    ack.seq = htonl(peer->last_seq);
+    sendto(fd, &ack, offsetof(UDP_DATAGRAM, keys), MSG_DONTWAIT, (struct sockaddr *)&addr, addr_len);
+
+    return n;
+}
+
+// Method to write the counters of all the clients of the server to a file
+void udp_log_counters(UDP_RECEIVER *receiver, FILE *file, const char *timeString) {
+    for (int i = 0; i < receiver->n_peers; i++) {
+        UDP_PEER *peer = &receiver->peers[i];
+        fprintf(file, "%s - UDP client %s:%d: %lu datagrams, %lu commands applied, %lu recovered from copies, "
+                "%lu lost, %lu reordered, %lu duplicates\n", timeString, inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port),
+                peer->datagrams, peer->applied, peer->recovered, peer->lost, peer->reordered, peer->duplicates);
+    }
+    if (receiver->invalid > 0 || receiver->evicted > 0) {
+        fprintf(file, "%s - UDP: %lu invalid datagrams, %lu idle clients forgotten\n", timeString, receiver->invalid, receiver->evicted);
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "monotonic_clock.h"
+#include <ncurses.h>
+#include <stdint.h>
+#include <time.h>
+
+// Default maximum number of screen updates per second
+#define DEFAULT_MAX_FPS 60
+
+/*
+ * Typedef for the renderer of a GUI. The drawing functions only change the
+ * ncurses buffers and mark the screen as damaged: the terminal is written at
+ * most once per tick, with a single doupdate, and only if something changed.
+ * The keys are read from a window of one cell that is never drawn, as wgetch
+ * on a changed window writes it to the terminal on its own.
+ */
+typedef struct {
+    // Minimum time between two updates and time of the last one, in nanoseconds
+    uint64_t min_interval;
+    uint64_t last_update;
+    int damaged;
+    // Window drawn over stdscr, restaged after it on every update
+    WINDOW **overlay;
+    // Window the keys are read from, never drawn
+    WINDOW *input;
+    // Number of updates written and of passes with nothing to write
+    unsigned long updates;
+    unsigned long skipped;
+}RENDERER;
+
+// Method to initialize a renderer writing at most max_fps updates per second
+void renderer_init(RENDERER *renderer, int max_fps, WINDOW **overlay) {
+    renderer->min_interval = max_fps > 0 ? 1000000000ULL / max_fps : 0;
+    renderer->last_update = 0;
+    renderer->damaged = TRUE;
+    renderer->overlay = overlay;
+    renderer->updates = 0;
+    renderer->skipped = 0;
+
+    renderer->input = newwin(1, 1, 0, 0);
+    keypad(renderer->input, TRUE);
+    nodelay(renderer->input, TRUE);
+}
+
+// Method to read a key without waiting, ERR if none, without writing to the terminal
+int renderer_getch(RENDERER *renderer) {
+    untouchwin(renderer->input);
+    return wgetch(renderer->input);
+}
+
+// Method to mark the screen as changed
+void renderer_damage(RENDERER *renderer) {
+    renderer->damaged = TRUE;
+}
+
+// Method to write the changes to the terminal in a single doupdate
+void renderer_force(RENDERER *renderer) {
+    wnoutrefresh(stdscr);
+    if (renderer->overlay != NULL && *renderer->overlay != NULL) {
+        touchwin(*renderer->overlay);
+        wnoutrefresh(*renderer->overlay);
+    }
+    doupdate();
+
+    renderer->last_update = monotonic_ns();
+    renderer->damaged = FALSE;
+    renderer->updates++;
+}
+
+/*
+ * Method to write the changes to the terminal if the screen is damaged and
+ * the last update is older than the minimum interval.
+ * Returns TRUE if the terminal was written.
+ */
+int renderer_update(RENDERER *renderer) {
+    if (!renderer->damaged) {
+        renderer->skipped++;
+        return FALSE;
+    }
+    if (monotonic_ns() - renderer->last_update < renderer->min_interval) {
+        return FALSE;
+    }
+
+    renderer_force(renderer);
+    return TRUE;
+}
@@ -0,0 +1,659 @@
+#include "./../include/udp_link.h"
+#include <ncurses.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Size in bytes of a command, as sent by processA in client mode
+#define MESSAGE_SIZE 4
+
+// Maximum number of connections and of commands waiting for their ack on each of them
+#define MAX_CONNECTIONS 64
+#define MAX_IN_FLIGHT 4096
+
+// Maximum number of keys of a pattern or of a trace
+#define MAX_KEYS 65536
+
+// Time to wait for the last acks at the end of the run, in nanoseconds
+#define DRAIN_NS 1000000000ULL
+
+// Typedef for a key of the stream, sent delay nanoseconds after the previous one
+typedef struct {
+    uint64_t delay;
+    int key;
+}TRACE_EVENT;
+
+// Typedef for a connection to the server
+typedef struct {
+    int fd;
+    // Position in the stream of keys and time of the next send
+    int next_key;
+    uint64_t next_send;
+    // Bytes of the current command written and of the current ack read
+    int written;
+    int ack_filled;
+    char out[MESSAGE_SIZE];
+    char ack[MESSAGE_SIZE];
+    // Send times of the commands waiting for their ack, oldest first
+    uint64_t in_flight[MAX_IN_FLIGHT];
+    int in_flight_head;
+    int in_flight_count;
+    // Number of commands sent and acked
+    unsigned long sent;
+    unsigned long acked;
+    int finished;
+    // Sending side of the UDP transport
+    UDP_SENDER sender;
+}CONNECTION;
+
+// Typedef for the options of a run
+typedef struct {
+    const char *host;
+    int port;
+    // Pipelines launched by master with ARP_PIPELINES, on consecutive ports from port
+    int pipelines;
+    int connections;
+    // Commands per second of each connection, 0 to send as fast as the window allows
+    double rate;
+    // Commands sent back to back, followed by a pause in milliseconds
+    int burst;
+    int pause_ms;
+    // Maximum commands waiting for their ack on a connection
+    int window;
+    double duration;
+    const char *trace;
+    // UDP transport, commands repeated in each datagram and percentage of datagrams dropped
+    int udp;
+    int redundancy;
+    int drop_percent;
+}OPTIONS;
+
+// Keys sent by every connection, cyclically unless replaying a trace
+TRACE_EVENT events[MAX_KEYS];
+int n_events;
+
+// Latencies of all the acks in nanoseconds
+uint64_t *latencies;
+unsigned long n_latencies;
+unsigned long latencies_capacity;
+
+// Function to convert a key name or code to a key code, -1 if unknown
+int parse_key(const char *name)
+{
+    if (strcasecmp(name, "left") == 0)
+    {
+        return KEY_LEFT;
+    }
+    if (strcasecmp(name, "right") == 0)
+    {
+        return KEY_RIGHT;
+    }
+    if (strcasecmp(name, "up") == 0)
+    {
+        return KEY_UP;
+    }
+    if (strcasecmp(name, "down") == 0)
+    {
+        return KEY_DOWN;
+    }
+    if (strcasecmp(name, "print") == 0)
+    {
+        return KEY_MOUSE;
+    }
+    if (atoi(name) > 0 && atoi(name) < 1000)
+    {
+        return atoi(name);
+    }
+    return -1;
+}
+
+// Function to read a comma separated list of keys, returns -1 on error
+int load_pattern(const char *pattern)
+{
+    char copy[1024];
+    snprintf(copy, sizeof(copy), "%s", pattern);
+
+    n_events = 0;
+    for (char *name = strtok(copy, ","); name != NULL && n_events < MAX_KEYS; name = strtok(NULL, ","))
+    {
+        int key = parse_key(name);
+        if (key == -1)
+        {
+            fprintf(stderr, "Unknown key: %s\n", name);
+            return -1;
+        }
+        events[n_events].delay = 0;
+        events[n_events].key = key;
+        n_events++;
+    }
+    return n_events > 0 ? 0 : -1;
+}
+
+/*
+ * Function to read a trace recorded by processA in client mode (ARP_TRACE):
+ * one key per line, preceded by the milliseconds elapsed since the previous one.
+ * Returns -1 on error.
+ */
+int load_trace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror("Error while opening the trace");
+        return -1;
+    }
+
+    char line[128], name[64];
+    double delay_ms;
+    n_events = 0;
+    while (fgets(line, sizeof(line), file) != NULL && n_events < MAX_KEYS)
+    {
+        if (line[0] == '#' || sscanf(line, "%lf %63s", &delay_ms, name) != 2)
+        {
+            continue;
+        }
+        int key = parse_key(name);
+        if (key == -1)
+        {
+            fprintf(stderr, "Unknown key in the trace: %s\n", name);
+            fclose(file);
+            return -1;
+        }
+        events[n_events].delay = delay_ms * 1e6;
+        events[n_events].key = key;
+        n_events++;
+    }
+
+    fclose(file);
+    return n_events > 0 ? 0 : -1;
+}
+
+// Function to open a connection to the server, a connected datagram socket with UDP, -1 on error
+int connect_to_server(const char *host, int port, int udp)
+{
+    struct hostent *server = gethostbyname(host);
+    if (server == NULL)
+    {
+        fprintf(stderr, "Unknown host: %s\n", host);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("Error while creating the socket");
+        return -1;
+    }
+
+    struct sockaddr_in serv_addr;
+    bzero((char *)&serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+    serv_addr.sin_port = htons(port);
+
+    if (connect(fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        perror("Error while connecting to the server");
+        close(fd);
+        return -1;
+    }
+
+    // Send each command as soon as it is written, as a user would
+    int one = 1;
+    if (!udp)
+    {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Function to store the latency of an ack
+void record_latency(uint64_t latency)
+{
+    if (n_latencies == latencies_capacity)
+    {
+        unsigned long capacity = latencies_capacity == 0 ? 65536 : latencies_capacity * 2;
+        uint64_t *grown = realloc(latencies, capacity * sizeof(uint64_t));
+        if (grown == NULL)
+        {
+            return;
+        }
+        latencies = grown;
+        latencies_capacity = capacity;
+    }
+    latencies[n_latencies++] = latency;
+}
+
+// Function to compute the time of the next send of a connection after the key just sent
+void schedule_next(CONNECTION *conn, OPTIONS *options, uint64_t now)
+{
+    // A trace keeps its own timing
+    if (options->trace != NULL)
+    {
+        if (conn->next_key == n_events)
+        {
+            conn->finished = 1;
+        }
+        else
+        {
+            conn->next_send += events[conn->next_key].delay;
+        }
+        return;
+    }
+
+    // After a whole burst, pause
+    if (options->burst > 0)
+    {
+        if (conn->sent % options->burst == 0)
+        {
+            conn->next_send = now + options->pause_ms * 1000000ULL;
+        }
+        return;
+    }
+
+    if (options->rate > 0)
+    {
+        conn->next_send += 1e9 / options->rate;
+    }
+}
+
+// Function to write the commands due on a connection, returns -1 on error
+int send_due(CONNECTION *conn, OPTIONS *options, uint64_t now)
+{
+    // Send the last datagram again if its ack is late
+    if (options->udp && udp_sender_poll(&conn->sender, conn->fd, now) == -1)
+    {
+        return -1;
+    }
+
+    while (!conn->finished && conn->next_send <= now)
+    {
+        // A datagram is never sent in part
+        if (options->udp)
+        {
+            if (conn->in_flight_count >= options->window)
+            {
+                return 0;
+            }
+            if (udp_send_key(&conn->sender, conn->fd, events[conn->next_key % n_events].key) == -1)
+            {
+                return -1;
+            }
+            conn->written = MESSAGE_SIZE;
+        }
+
+        // Start a new command, if the window allows it
+        else if (conn->written == 0)
+        {
+            if (conn->in_flight_count >= options->window)
+            {
+                return 0;
+            }
+            memset(conn->out, 0, MESSAGE_SIZE);
+            snprintf(conn->out, MESSAGE_SIZE, "%d", events[conn->next_key % n_events].key);
+        }
+
+        if (!options->udp)
+        {
+            int n = send(conn->fd, conn->out + conn->written, MESSAGE_SIZE - conn->written, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            }
+            conn->written += n;
+        }
+        if (conn->written < MESSAGE_SIZE)
+        {
+            return 0;
+        }
+
+        // The command is sent, wait for its ack
+        conn->written = 0;
+        conn->in_flight[(conn->in_flight_head + conn->in_flight_count) % MAX_IN_FLIGHT] = monotonic_ns();
+        conn->in_flight_count++;
+        conn->next_key++;
+        conn->sent++;
+        schedule_next(conn, options, now);
+    }
+    return 0;
+}
+
+// Function to mark as acked the oldest commands waiting for their ack
+void ack_commands(CONNECTION *conn, unsigned long count, uint64_t now)
+{
+    for (unsigned long k = 0; k < count; k++)
+    {
+        if (conn->in_flight_count > 0)
+        {
+            record_latency(now - conn->in_flight[conn->in_flight_head]);
+            conn->in_flight_head = (conn->in_flight_head + 1) % MAX_IN_FLIGHT;
+            conn->in_flight_count--;
+        }
+        conn->acked++;
+    }
+}
+
+// Function to read the acks of a datagram socket, each covers all the commands up to its sequence number
+int read_udp_acks(CONNECTION *conn)
+{
+    uint32_t acked = conn->sender.acked;
+    int n;
+    while ((n = udp_sender_receive(&conn->sender, conn->fd)) == 1)
+    {
+        // Only the newest ack matters
+    }
+    ack_commands(conn, conn->sender.acked - acked, monotonic_ns());
+    return n;
+}
+
+// Function to read the acks of a connection, returns -1 if the server closed it
+int read_acks(CONNECTION *conn)
+{
+    char buffer[1024];
+    int n = recv(conn->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < n; i++)
+    {
+        conn->ack[conn->ack_filled++] = buffer[i];
+        if (conn->ack_filled < MESSAGE_SIZE)
+        {
+            continue;
+        }
+        conn->ack_filled = 0;
+
+        // The acks arrive in the order of the commands
+        ack_commands(conn, 1, now);
+    }
+    return 0;
+}
+
+// Function to compare two latencies
+int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Function to get a percentile of the sorted latencies in microseconds
+double percentile(double p)
+{
+    if (n_latencies == 0)
+    {
+        return 0;
+    }
+    unsigned long i = p / 100 * (n_latencies - 1);
+    return latencies[i] / 1e3;
+}
+
+// Function to print the usage of the program
+void usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -h host         address of processA in server mode (default: localhost)\n");
+    printf("  -p port         port of the server (default: 5000)\n");
+    printf("  -P pipelines    spread the connections over the pipelines launched by master on consecutive ports from port (default: 1)\n");
+    printf("  -c connections  number of connections (default: 1, at most %d)\n", MAX_CONNECTIONS);
+    printf("  -r rate         commands per second of each connection, 0 for as fast as the window allows (default: 100)\n");
+    printf("  -b count,ms     send count commands back to back, then pause for ms milliseconds\n");
+    printf("  -w window       maximum commands waiting for their ack on a connection (default: 64)\n");
+    printf("  -d seconds      duration of the run (default: 10)\n");
+    printf("  -k keys         comma separated keys sent cyclically: left, right, up, down, print or a key code (default: left,right)\n");
+    printf("  -t trace        replay a trace recorded by processA in client mode with ARP_TRACE\n");
+    printf("  -u              use the UDP transport, for processA started with ARP_TRANSPORT=udp\n");
+    printf("  -R count        with UDP, commands repeated in each datagram (default: %d, at most %d)\n", UDP_DEFAULT_REDUNDANCY, UDP_MAX_REDUNDANCY);
+    printf("  -l percent      with UDP, percentage of datagrams dropped to simulate a lossy link (default: 0)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    OPTIONS options = {"localhost", 5000, 1, 1, 100, 0, 0, 64, 10, NULL, 0, UDP_DEFAULT_REDUNDANCY, 0};
+    const char *pattern = "left,right";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:P:c:r:b:w:d:k:t:uR:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            options.host = optarg;
+            break;
+        case 'p':
+            options.port = atoi(optarg);
+            break;
+        case 'P':
+            options.pipelines = atoi(optarg);
+            break;
+        case 'c':
+            options.connections = atoi(optarg);
+            break;
+        case 'r':
+            options.rate = atof(optarg);
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d,%d", &options.burst, &options.pause_ms) != 2)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w':
+            options.window = atoi(optarg);
+            break;
+        case 'd':
+            options.duration = atof(optarg);
+            break;
+        case 'k':
+            pattern = optarg;
+            break;
+        case 't':
+            options.trace = optarg;
+            break;
+        case 'u':
+            options.udp = 1;
+            break;
+        case 'R':
+            options.redundancy = atoi(optarg);
+            break;
+        case 'l':
+            options.drop_percent = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.pipelines < 1 || options.port + options.pipelines - 1 > 65535 || options.connections < 1 || options.connections > MAX_CONNECTIONS || options.window < 1 || options.window > MAX_IN_FLIGHT ||
+        options.duration <= 0 || options.rate < 0 || options.burst < 0 || options.pause_ms < 0 ||
+        options.redundancy < 1 || options.redundancy > UDP_MAX_REDUNDANCY || options.drop_percent < 0 || options.drop_percent > 100)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Keys to send
+    if ((options.trace != NULL ? load_trace(options.trace) : load_pattern(pattern)) == -1)
+    {
+        return 1;
+    }
+
+    // Open the connections
+    CONNECTION *conns = calloc(options.connections, sizeof(CONNECTION));
+    struct pollfd *fds = calloc(options.connections, sizeof(struct pollfd));
+    if (conns == NULL || fds == NULL)
+    {
+        perror("Error while allocating the connections");
+        return 1;
+    }
+
+    uint64_t start = monotonic_ns();
+    for (int c = 0; c < options.connections; c++)
+    {
+        conns[c].fd = connect_to_server(options.host, options.port + c % options.pipelines, options.udp);
+        if (conns[c].fd == -1)
+        {
+            return 1;
+        }
+        udp_sender_init(&conns[c].sender, options.redundancy);
+        conns[c].sender.drop_percent = options.drop_percent;
+        conns[c].next_send = start + (options.trace != NULL ? events[0].delay : 0);
+        fds[c].fd = conns[c].fd;
+    }
+
+    uint64_t end = start + options.duration * 1e9;
+    uint64_t drain_end = 0;
+    int open = options.connections;
+
+    while (open > 0)
+    {
+        uint64_t now = monotonic_ns();
+
+        // Stop sending at the end of the run, then wait a while for the last acks
+        if (now >= end || drain_end != 0)
+        {
+            int waiting = 0;
+            for (int c = 0; c < options.connections; c++)
+            {
+                conns[c].finished = 1;
+                waiting += conns[c].fd != -1 ? conns[c].in_flight_count : 0;
+            }
+            if (drain_end == 0)
+            {
+                drain_end = now + DRAIN_NS;
+            }
+            if (waiting == 0 || now >= drain_end)
+            {
+                break;
+            }
+        }
+
+        // Write the commands due and find the time of the next one
+        uint64_t wake = drain_end != 0 ? drain_end : end;
+        int all_finished = 1;
+        for (int c = 0; c < options.connections; c++)
+        {
+            CONNECTION *conn = &conns[c];
+            fds[c].events = 0;
+            if (conn->fd == -1)
+            {
+                continue;
+            }
+
+            if (send_due(conn, &options, now) == -1)
+            {
+                fprintf(stderr, "Connection %d closed while sending\n", c);
+                close(conn->fd);
+                conn->fd = -1;
+                fds[c].fd = -1;
+                open--;
+                continue;
+            }
+
+            fds[c].events = POLLIN;
+            if (!conn->finished)
+            {
+                all_finished = 0;
+                if (conn->written > 0)
+                {
+                    // The socket buffer is full, wait until it can be written
+                    fds[c].events |= POLLOUT;
+                }
+                else if (conn->in_flight_count < options.window && conn->next_send < wake)
+                {
+                    wake = conn->next_send;
+                }
+            }
+
+            // Wake up to send the last datagram again if its ack is late
+            if (options.udp && conn->sender.acked != conn->sender.seq && conn->sender.resends < UDP_MAX_RESENDS &&
+                conn->sender.last_send + UDP_RESEND_NS < wake)
+            {
+                wake = conn->sender.last_send + UDP_RESEND_NS;
+            }
+        }
+
+        // A replayed trace ends when all its keys are acked
+        if (all_finished && drain_end == 0)
+        {
+            drain_end = monotonic_ns() + DRAIN_NS;
+        }
+
+        now = monotonic_ns();
+        int timeout = wake > now ? (wake - now + 999999) / 1000000 : 0;
+        if (poll(fds, options.connections, timeout) == -1 && errno != EINTR)
+        {
+            perror("Error while waiting for the server");
+            break;
+        }
+
+        // Read the acks
+        for (int c = 0; c < options.connections; c++)
+        {
+            if (conns[c].fd != -1 && (fds[c].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                (options.udp ? read_udp_acks(&conns[c]) : read_acks(&conns[c])) == -1)
+            {
+                fprintf(stderr, "Connection %d closed by the server\n", c);
+                close(conns[c].fd);
+                conns[c].fd = -1;
+                fds[c].fd = -1;
+                open--;
+            }
+        }
+    }
+
+    double elapsed = (monotonic_ns() - start) / 1e9;
+
+    // Print the results of every connection and of the whole run
+    unsigned long sent = 0, acked = 0;
+    printf("%-10s %6s %10s %10s %12s\n", "connection", "port", "sent", "acked", "accepted/s");
+    for (int c = 0; c < options.connections; c++)
+    {
+        printf("%-10d %6d %10lu %10lu %12.1f\n", c, options.port + c % options.pipelines, conns[c].sent, conns[c].acked, conns[c].acked / elapsed);
+        sent += conns[c].sent;
+        acked += conns[c].acked;
+        if (conns[c].fd != -1)
+        {
+            close(conns[c].fd);
+        }
+    }
+
+    qsort(latencies, n_latencies, sizeof(uint64_t), compare_latency);
+    printf("\n%lu commands sent and %lu acked in %.2f s: %.1f sent/s, %.1f accepted/s, %lu without ack\n", sent, acked, elapsed,
+           sent / elapsed, acked / elapsed, sent - acked);
+    if (options.udp)
+    {
+        unsigned long datagrams = 0, resent = 0;
+        for (int c = 0; c < options.connections; c++)
+        {
+            datagrams += conns[c].sender.sent;
+            resent += conns[c].sender.resent;
+        }
+        printf("UDP: %lu datagrams sent, %lu sent again for a late ack, %d%% dropped on purpose\n", datagrams, resent, options.drop_percent);
+    }
+    printf("Ack latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", percentile(50), percentile(90), percentile(99),
+           percentile(99.9), percentile(100));
+
+    free(latencies);
+    free(fds);
+    free(conns);
+    return 0;
+}
@@ -0,0 +1,1623 @@
+#define _GNU_SOURCE
+#include "./../include/shared_image.h"
+#include "./../include/blob_detection.h"
+#include "./../include/reference_kernels.h"
+#include "./../include/bmp_writer.h"
+#include "./../include/client_set.h"
+#include "./../include/transport.h"
+#include "./../include/scene.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Name of the shared memory object used by the benchmarks, so that a running pipeline is not disturbed
+#define BENCH_SHM_NAME "/SHARED_IMAGE_benchmark"
+
+// Function to get the current monotonic time in seconds
+double now()
+{
+    return monotonic_ns() * 1e-9;
+}
+
+// Function to draw a filled circle of radius one cell and a half directly on a frame
+void draw_frame_circle(rgb_pixel_t *frame, GEOMETRY *geometry, int x, int y)
+{
+    rgb_pixel_t pixel = {255, 0, 0, 0};
+    int radius = geometry->scale * 3 / 2;
+
+    for (int i = -radius; i <= radius; i++)
+    {
+        for (int j = -radius; j <= radius; j++)
+        {
+            int px = x * geometry->scale + i;
+            int py = y * geometry->scale + j;
+            if (sqrt(i * i + j * j) < radius && px >= 0 && px < geometry->width && py >= 0 && py < geometry->height)
+            {
+                frame[px + geometry->width * py] = pixel;
+            }
+        }
+    }
+}
+
+// Benchmark of the frame costs across image resolutions
+int bench_geometry(int iterations)
+{
+    // Resolutions of the sweep, the first one is the default geometry
+    int sizes[][2] = {{1600, 600}, {1920, 1080}, {2560, 1440}, {3840, 2160}, {5120, 2880}, {7680, 4320}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    LABELLER lab = {0};
+    BLOB blobs[MAX_BLOBS];
+
+    printf("%-11s %9s %10s %10s %10s %10s\n", "resolution", "frame MB", "create ms", "clear ms", "copy ms", "label ms");
+
+    for (int s = 0; s < n_sizes; s++)
+    {
+        GEOMETRY geometry = {sizes[s][0], sizes[s][1], DEFAULT_DEPTH, DEFAULT_SCALE};
+
+        // Create the shared memory object, including the first write of the whole frame
+        double start = now();
+        SHARED_HEADER *header = shared_image_create(BENCH_SHM_NAME, &geometry, 0);
+        if (header == NULL)
+        {
+            perror("Error while creating the shared memory object");
+            return 1;
+        }
+        rgb_pixel_t *frame = shared_frame(header);
+        memset(frame, 0, header->frame_size);
+        double create_time = now() - start;
+
+        // Snapshot buffer on the reader side
+        rgb_pixel_t *snapshot = malloc(header->frame_size);
+        if (snapshot == NULL)
+        {
+            perror("Error while allocating the snapshot");
+            return 1;
+        }
+
+        double clear_time = 0, copy_time = 0, label_time = 0;
+        int cols = geometry.width / geometry.scale;
+        int rows = geometry.height / geometry.scale;
+
+        for (int it = 0; it < iterations; it++)
+        {
+            // Clear the frame and draw the circle in a new position, as processA does
+            start = now();
+            memset(frame, 0, header->frame_size);
+            draw_frame_circle(frame, &geometry, 2 + it % (cols - 4), 2 + it % (rows - 4));
+            clear_time += now() - start;
+
+            // Copy the frame, as processB does
+            start = now();
+            memcpy(snapshot, frame, header->frame_size);
+            copy_time += now() - start;
+
+            // Label the objects of the copy
+            start = now();
+            label_frame_rows(snapshot, geometry.width, &lab, 0, geometry.height);
+            labeller_collect(&lab, blobs, MAX_BLOBS);
+            label_time += now() - start;
+        }
+
+        char resolution[16];
+        sprintf(resolution, "%dx%d", geometry.width, geometry.height);
+        printf("%-11s %9.1f %10.3f %10.3f %10.3f %10.3f\n", resolution, header->frame_size / 1048576.0,
+               create_time * 1e3, clear_time * 1e3 / iterations, copy_time * 1e3 / iterations, label_time * 1e3 / iterations);
+
+        free(snapshot);
+        shared_image_detach(header);
+        shared_image_unlink(BENCH_SHM_NAME);
+    }
+
+    labeller_destroy(&lab);
+    return 0;
+}
+
+// Function to open a counter of the data TLB read misses of this process, -1 if not available
+int open_tlb_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Function to read a counter, -1 if not available
+long long read_counter(int fd)
+{
+    long long value;
+    if (fd == -1 || read(fd, &value, sizeof(value)) != sizeof(value))
+    {
+        return -1;
+    }
+    return value;
+}
+
+// Function to print a row of the kernel benchmark, returns 1 if the check failed
+int print_kernel(const char *kernel, const char *format, GEOMETRY *geometry, double reference, double optimized, int ok)
+{
+    char resolution[16], optimized_ms[16], speedup[16];
+    sprintf(resolution, "%dx%d", geometry->width, geometry->height);
+    if (optimized > 0)
+    {
+        sprintf(optimized_ms, "%.3f", optimized * 1e3);
+        sprintf(speedup, "%.1fx", reference / optimized);
+    }
+    else
+    {
+        sprintf(optimized_ms, "-");
+        sprintf(speedup, "-");
+    }
+    printf("%-11s %-7s %-11s %13.3f %13s %8s %6s\n", kernel, format, resolution, reference * 1e3, optimized_ms, speedup,
+           ok < 0 ? "-" : ok ? "ok" : "FAIL");
+    return ok == 0;
+}
+
+// Function to count the runs of non-black pixels of a frame, as the labelling does
+long count_runs(const rgb_pixel_t *frame, int width, int height)
+{
+    long runs = 0;
+    for (int y = 0; y < height; y++)
+    {
+        const rgb_pixel_t *row = frame + (size_t)y * width;
+        int x = frame_skip_black(row, 0, width);
+        while (x < width)
+        {
+            runs++;
+            x = frame_skip_black(row, frame_skip_nonblack(row, x, width), width);
+        }
+    }
+    return runs;
+}
+
+/*
+ * Benchmark of the pixel kernels against their reference implementations on
+ * libbmp, across resolutions and pixel formats. The output of every kernel is
+ * compared with the reference before timing it.
+ */
+int bench_kernels(int iterations)
+{
+    int sizes[][2] = {{1600, 600}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    // The reference kernels go through libbmp one pixel at a time, so they are timed on fewer runs
+    int reference_iterations = iterations < 5 ? iterations : 5;
+    int failures = 0;
+
+    printf("Reference timed over %d runs, optimized over %d runs, with the %s kernels\n", reference_iterations, iterations,
+           simd_name(simd_best()));
+    printf("%-11s %-7s %-11s %13s %13s %8s %6s\n", "kernel", "format", "resolution", "reference ms", "optimized ms", "speedup", "check");
+
+    for (int s = 0; s < n_sizes; s++)
+    {
+        GEOMETRY geometry = {sizes[s][0], sizes[s][1], DEFAULT_DEPTH, DEFAULT_SCALE};
+        int width = geometry.width, height = geometry.height, scale = geometry.scale;
+        size_t n = (size_t)width * height;
+        int cols = width / scale, rows = height / scale;
+
+        bmpfile_t *bmp = bmp_create(width, height, geometry.depth);
+        rgb_pixel_t *reference = malloc(n * sizeof(rgb_pixel_t));
+        rgb_pixel_t *frame = malloc(n * sizeof(rgb_pixel_t));
+        uint8_t *converted = malloc(n * sizeof(rgb_pixel_t));
+        uint8_t *converted_reference = malloc(n * sizeof(rgb_pixel_t));
+        if (bmp == NULL || reference == NULL || frame == NULL || converted == NULL || converted_reference == NULL)
+        {
+            perror("Error while allocating the frames");
+            return 1;
+        }
+
+        // Clear
+        memset(frame, 0xAB, n * sizeof(rgb_pixel_t));
+        draw_bmp_circle(bmp, 3, 3, scale);
+        erase_bmp(bmp, width, height);
+        frame_clear(frame, n);
+        bmp_to_static(bmp, reference, width, height);
+        int ok = memcmp(reference, frame, n * sizeof(rgb_pixel_t)) == 0;
+
+        double start = now();
+        for (int it = 0; it < reference_iterations; it++)
+        {
+            erase_bmp(bmp, width, height);
+        }
+        double reference_time = (now() - start) / reference_iterations;
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            frame_clear(frame, n);
+        }
+        failures += print_kernel("clear", "bgra32", &geometry, reference_time, (now() - start) / iterations, ok);
+
+        // Circle, also across the borders of the image
+        int positions[][2] = {{cols / 2, rows / 2}, {0, 0}, {1, rows - 1}, {cols - 1, rows / 3}, {cols, rows}, {-1, 2}};
+        int n_positions = sizeof(positions) / sizeof(positions[0]);
+        ok = 1;
+        for (int p = 0; p < n_positions; p++)
+        {
+            erase_bmp(bmp, width, height);
+            draw_bmp_circle(bmp, positions[p][0], positions[p][1], scale);
+            bmp_to_static(bmp, reference, width, height);
+            frame_clear(frame, n);
+            frame_draw_circle(frame, width, height, positions[p][0], positions[p][1], scale);
+            ok = ok && memcmp(reference, frame, n * sizeof(rgb_pixel_t)) == 0;
+        }
+
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            draw_bmp_circle(bmp, 2 + it % (cols - 4), 2 + it % (rows - 4), scale);
+        }
+        reference_time = (now() - start) / iterations;
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            frame_draw_circle(frame, width, height, 2 + it % (cols - 4), 2 + it % (rows - 4), scale);
+        }
+        failures += print_kernel("circle", "bgra32", &geometry, reference_time, (now() - start) / iterations, ok);
+
+        // Bitmap to frame, the optimized pipeline draws in the frame and only copies it
+        erase_bmp(bmp, width, height);
+        draw_bmp_circle(bmp, cols / 2, rows / 2, scale);
+        frame_clear(frame, n);
+        frame_draw_circle(frame, width, height, cols / 2, rows / 2, scale);
+        start = now();
+        for (int it = 0; it < reference_iterations; it++)
+        {
+            bmp_to_static(bmp, reference, width, height);
+        }
+        reference_time = (now() - start) / reference_iterations;
+        rgb_pixel_t *copy = (rgb_pixel_t *)converted;
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            frame_copy(copy, frame, n);
+        }
+        double optimized_time = (now() - start) / iterations;
+        ok = memcmp(reference, copy, n * sizeof(rgb_pixel_t)) == 0;
+        failures += print_kernel("to_static", "bgra32", &geometry, reference_time, optimized_time, ok);
+
+        // Frame to bitmap, only done to save a snapshot
+        start = now();
+        for (int it = 0; it < reference_iterations; it++)
+        {
+            static_to_bmp(frame, bmp, width, height);
+        }
+        bmp_to_static(bmp, reference, width, height);
+        ok = memcmp(reference, frame, n * sizeof(rgb_pixel_t)) == 0;
+        failures += print_kernel("to_bmp", "bgra32", &geometry, (now() - start) / reference_iterations, 0, ok);
+
+        // Center of the circle, with two circles and a column lit from top to bottom
+        int center_x = -1, center_y = -1, x = -1, y = -1;
+        ok = 1;
+        for (int p = 0; p < n_positions; p++)
+        {
+            frame_clear(frame, n);
+            frame_draw_circle(frame, width, height, positions[p][0], positions[p][1], scale);
+            if (p % 2 == 1)
+            {
+                frame_draw_circle(frame, width, height, positions[p - 1][0], positions[p - 1][1], scale);
+            }
+            if (p == n_positions - 1)
+            {
+                for (int j = 0; j < height; j++)
+                {
+                    frame[width / 3 + (size_t)width * j].red = 1;
+                }
+            }
+            find_center(frame, width, height, scale, &center_x, &center_y);
+            frame_find_center(frame, width, height, scale, &x, &y);
+            ok = ok && x == center_x && y == center_y;
+        }
+
+        frame_clear(frame, n);
+        frame_draw_circle(frame, width, height, cols / 2, rows / 2, scale);
+        start = now();
+        for (int it = 0; it < reference_iterations; it++)
+        {
+            find_center(frame, width, height, scale, &center_x, &center_y);
+        }
+        reference_time = (now() - start) / reference_iterations;
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            frame_find_center(frame, width, height, scale, &x, &y);
+        }
+        failures += print_kernel("find_center", "bgra32", &geometry, reference_time, (now() - start) / iterations, ok);
+
+        // Scan for the runs of non-black pixels, on a frame with many objects
+        srand(s + 1);
+        for (int k = 0; k < 200; k++)
+        {
+            frame_draw_circle(frame, width, height, rand() % cols, rand() % rows, 1 + rand() % scale);
+        }
+        long runs_reference = count_runs_reference(frame, width, height), runs = 0;
+        start = now();
+        for (int it = 0; it < reference_iterations; it++)
+        {
+            runs_reference = count_runs_reference(frame, width, height);
+        }
+        reference_time = (now() - start) / reference_iterations;
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            runs = count_runs(frame, width, height);
+        }
+        failures += print_kernel("scan", "bgra32", &geometry, reference_time, (now() - start) / iterations, runs == runs_reference);
+
+        // Conversion to each pixel format
+        for (int format = 0; format < PIXEL_FORMATS; format++)
+        {
+            convert_reference(converted_reference, format, frame, n);
+            frame_convert(converted, format, frame, n);
+            ok = memcmp(converted_reference, converted, n * pixel_size(format)) == 0;
+
+            start = now();
+            for (int it = 0; it < reference_iterations; it++)
+            {
+                convert_reference(converted_reference, format, frame, n);
+            }
+            reference_time = (now() - start) / reference_iterations;
+            start = now();
+            for (int it = 0; it < iterations; it++)
+            {
+                frame_convert(converted, format, frame, n);
+            }
+            failures += print_kernel("convert", pixel_format_name(format), &geometry, reference_time, (now() - start) / iterations, ok);
+        }
+
+        bmp_destroy(bmp);
+        free(reference);
+        free(frame);
+        free(converted);
+        free(converted_reference);
+    }
+
+    if (failures > 0)
+    {
+        printf("%d kernels differ from their reference\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to sum the start and end of the runs of non-black pixels of a frame, found with the kernels of an instruction set
+long sum_runs(const PIXEL_KERNELS *k, const rgb_pixel_t *frame, int width, int height)
+{
+    long sum = 0;
+    for (int y = 0; y < height; y++)
+    {
+        const rgb_pixel_t *row = frame + (size_t)y * width;
+        int x = k->skip_black(row, 0, width);
+        while (x < width)
+        {
+            int end = k->skip_nonblack(row, x, width);
+            sum += x * 31L + end;
+            x = k->skip_black(row, end, width);
+        }
+    }
+    return sum;
+}
+
+// Function to run a kernel of an instruction set on n pixels, 0 to 4 for clear, copy, bgr24, gray8 and scan
+long run_simd_kernel(const PIXEL_KERNELS *k, int kernel, rgb_pixel_t *dst, const rgb_pixel_t *src, size_t n, int width)
+{
+    switch (kernel)
+    {
+        case 0:
+            k->clear_pixels(dst, n);
+            return 0;
+        case 1:
+            k->copy_pixels(dst, src, n);
+            return 0;
+        case 2:
+            k->to_bgr24((uint8_t *)dst, src, n);
+            return 0;
+        case 3:
+            k->to_gray8((uint8_t *)dst, src, n);
+            return 0;
+        default:
+            return sum_runs(k, src, width, n / width);
+    }
+}
+
+/*
+ * Benchmark of the kernels of each instruction set supported by the
+ * processor against the scalar ones. Each kernel is first checked against the
+ * scalar one, byte for byte, on lengths the vectors do not divide and on
+ * pointers not aligned to the vectors.
+ */
+int bench_simd(int iterations)
+{
+    const char *names[] = {"clear", "copy", "bgr24", "gray8", "scan"};
+    int n_kernels = sizeof(names) / sizeof(names[0]);
+    int sizes[][2] = {{1600, 600}, {3840, 2160}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    size_t lengths[] = {0, 1, 3, 7, 15, 17, 31, 33, 63, 65, 129, 1001, 4099};
+    int n_lengths = sizeof(lengths) / sizeof(lengths[0]);
+
+    // Frame with runs of pixels of random colors, some of them black with a non-zero alpha
+    size_t max_n = (size_t)sizes[n_sizes - 1][0] * sizes[n_sizes - 1][1];
+    rgb_pixel_t *frame = malloc((max_n + 16) * sizeof(rgb_pixel_t));
+    rgb_pixel_t *out = malloc((max_n + 16) * sizeof(rgb_pixel_t));
+    rgb_pixel_t *expected = malloc((max_n + 16) * sizeof(rgb_pixel_t));
+    if (frame == NULL || out == NULL || expected == NULL)
+    {
+        perror("Error while allocating the frames");
+        return 1;
+    }
+    srand(1);
+    int colored = 0;
+    for (size_t i = 0; i < max_n + 16; i++)
+    {
+        colored = rand() % 8 == 0 ? !colored : colored;
+        uint32_t word = colored ? (uint32_t)rand() : (uint32_t)(rand() % 2) << 24;
+        memcpy(&frame[i], &word, sizeof(word));
+    }
+
+    printf("Kernels in use: %s\n", simd_name(simd_best()));
+    printf("%-7s %-11s", "kernel", "resolution");
+    for (int level = 0; level < SIMD_LEVELS; level++)
+    {
+        printf(" %9s ms", simd_name(level));
+    }
+    printf(" %6s\n", "check");
+
+    int failures = 0;
+    for (int kernel = 0; kernel < n_kernels; kernel++)
+    {
+        // Check each instruction set against the scalar kernel, at every offset of a 64 byte vector
+        int ok = 1;
+        for (int level = 1; level < SIMD_LEVELS; level++)
+        {
+            if (!simd_supported(level))
+            {
+                continue;
+            }
+            for (int offset = 0; offset < 16; offset++)
+            {
+                for (int l = 0; l < n_lengths; l++)
+                {
+                    size_t n = lengths[l];
+                    int width = n > 0 ? n : 1;
+                    memset(expected, 0xAB, (n + 16) * sizeof(rgb_pixel_t));
+                    memset(out, 0xAB, (n + 16) * sizeof(rgb_pixel_t));
+                    long expected_sum = run_simd_kernel(&simd_kernels[SIMD_SCALAR], kernel, expected + offset, frame + offset, n, width);
+                    long sum = run_simd_kernel(&simd_kernels[level], kernel, out + offset, frame + offset, n, width);
+                    ok = ok && sum == expected_sum && memcmp(expected, out, (n + 16) * sizeof(rgb_pixel_t)) == 0;
+                }
+            }
+        }
+
+        for (int s = 0; s < n_sizes; s++)
+        {
+            size_t n = (size_t)sizes[s][0] * sizes[s][1];
+            char resolution[16];
+            sprintf(resolution, "%dx%d", sizes[s][0], sizes[s][1]);
+            printf("%-7s %-11s", names[kernel], resolution);
+
+            long expected_sum = run_simd_kernel(&simd_kernels[SIMD_SCALAR], kernel, expected, frame, n, sizes[s][0]);
+            for (int level = 0; level < SIMD_LEVELS; level++)
+            {
+                if (!simd_supported(level))
+                {
+                    printf(" %12s", "n/a");
+                    continue;
+                }
+
+                // Check the whole frame too, then time the kernel
+                ok = ok && run_simd_kernel(&simd_kernels[level], kernel, out, frame, n, sizes[s][0]) == expected_sum &&
+                     memcmp(expected, out, n * (kernel == 2 ? 3 : kernel == 3 ? 1 : 4)) == 0;
+                double start = now();
+                for (int it = 0; it < iterations; it++)
+                {
+                    run_simd_kernel(&simd_kernels[level], kernel, out, frame, n, sizes[s][0]);
+                }
+                printf(" %12.3f", (now() - start) * 1e3 / iterations);
+            }
+            printf(" %6s\n", ok ? "ok" : "FAIL");
+        }
+        failures += !ok;
+    }
+
+    free(frame);
+    free(out);
+    free(expected);
+
+    if (failures > 0)
+    {
+        printf("%d kernels differ from the scalar ones\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to check that the objects found with the integral image are the components found by labelling
+int same_blobs(const BLOB *expected, int n_expected, const BLOB *found, int n_found)
+{
+    if (n_expected != n_found)
+    {
+        return 0;
+    }
+    for (int k = 0; k < n_found && k < MAX_BLOBS; k++)
+    {
+        const BLOB *a = &expected[k], *b = &found[k];
+        if (a->area != b->area || a->min_x != b->min_x || a->min_y != b->min_y || a->max_x != b->max_x || a->max_y != b->max_y ||
+            abs(a->center_x - b->center_x) > 1 || abs(a->center_y - b->center_y) > 1)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Function to draw a chain of objects placed diagonally close to each other: the bounding box of each object
+ * overlaps the next one by a corner, while the objects stay more than 16 pixels apart
+ */
+void draw_diagonal_chain(rgb_pixel_t *frame, int width, int height)
+{
+    RECT whole_frame = {0, 0, width - 1, height - 1};
+    OBJECT object = {0};
+    object.radius = 100;
+    object.color = (rgb_pixel_t){255, 0, 0, 0};
+    frame_clear(frame, (size_t)width * height);
+    for (object.x = 110, object.y = 110; object.x + object.radius < width && object.y + object.radius < height; object.x += 164, object.y += 164)
+    {
+        object_draw(&object, frame, width, whole_frame);
+    }
+}
+
+/*
+ * Benchmark of the detection of the objects by labelling the frame, as processB does by default, against the
+ * integral image, built from the whole frame or updated over the rectangle changed by the move of the circle,
+ * and on a chain of objects placed diagonally close to each other
+ */
+int bench_integral(int iterations)
+{
+    int sizes[][2] = {{1600, 600}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    LABELLER lab = {0};
+    BLOB expected[MAX_BLOBS], blobs[MAX_BLOBS];
+
+    printf("%-11s %10s %10s %10s %10s %10s %6s\n", "resolution", "label ms", "build ms", "update ms", "detect ms", "query ns", "check");
+
+    int failures = 0;
+    for (int s = 0; s < n_sizes; s++)
+    {
+        int width = sizes[s][0], height = sizes[s][1], scale = DEFAULT_SCALE;
+        int cols = width / scale, rows = height / scale;
+        rgb_pixel_t *frame = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+        INTEGRAL_IMAGE built, updated;
+        if (frame == NULL || integral_init(&built, width, height) == -1 || integral_init(&updated, width, height) == -1)
+        {
+            perror("Error while allocating the frame and the integral images");
+            return 1;
+        }
+
+        // First frame: the moving circle and a still one, as processA publishes it
+        int x = 4, y = 4;
+        frame_clear(frame, (size_t)width * height);
+        frame_draw_circle(frame, width, height, cols - 4, rows - 4, scale);
+        frame_draw_circle(frame, width, height, x, y, scale);
+        integral_build(&updated, frame);
+
+        double label_time = 0, build_time = 0, update_time = 0, detect_time = 0;
+        int ok = 1;
+        for (int it = 0; it < iterations; it++)
+        {
+            // Move the circle by one cell, diagonally across the frame
+            RECT previous = frame_circle_bounds(width, height, x, y, scale);
+            frame_clear(frame, (size_t)width * height);
+            frame_draw_circle(frame, width, height, cols - 4, rows - 4, scale);
+            x = 4 + (x - 3) % (cols - 12);
+            y = 4 + (y - 3) % (rows - 12);
+            frame_draw_circle(frame, width, height, x, y, scale);
+            RECT dirty = rect_union(previous, frame_circle_bounds(width, height, x, y, scale));
+
+            double start = now();
+            label_frame_rows(frame, width, &lab, 0, height);
+            int n_expected = labeller_collect(&lab, expected, MAX_BLOBS);
+            label_time += now() - start;
+
+            start = now();
+            integral_build(&built, frame);
+            build_time += now() - start;
+
+            start = now();
+            integral_update(&updated, frame, dirty);
+            update_time += now() - start;
+
+            start = now();
+            int n_found = integral_find_blobs(&updated, blobs, MAX_BLOBS);
+            detect_time += now() - start;
+
+            // The update gives the table of the whole frame, and the same objects as the labelling
+            ok = ok && memcmp(built.sums, updated.sums, (size_t)(width + 1) * (height + 1) * sizeof(uint32_t)) == 0 &&
+                 same_blobs(expected, n_expected, blobs, n_found);
+        }
+
+        // Time of a single occupancy query, on rectangles all over the frame
+        volatile uint32_t total = 0;
+        int queries = 1000000;
+        double start = now();
+        for (int q = 0; q < queries; q++)
+        {
+            int min_x = (int)((long)q * 7919 % (width / 2)), min_y = (int)((long)q * 104729 % (height / 2));
+            total += integral_box(&updated, min_x, min_y, min_x + width / 4, min_y + height / 4);
+        }
+        double query_time = now() - start;
+
+        char resolution[16];
+        sprintf(resolution, "%dx%d", width, height);
+        printf("%-11s %10.3f %10.3f %10.3f %10.3f %10.1f %6s\n", resolution, label_time * 1e3 / iterations, build_time * 1e3 / iterations,
+               update_time * 1e3 / iterations, detect_time * 1e3 / iterations, query_time * 1e9 / queries, ok ? "ok" : "FAIL");
+        failures += !ok;
+
+        integral_destroy(&built);
+        integral_destroy(&updated);
+        free(frame);
+    }
+
+    // Objects placed diagonally close to each other: the rectangles of their cells overlap, not the cells
+    int width = 1600, height = 600;
+    rgb_pixel_t *frame = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+    INTEGRAL_IMAGE ii;
+    if (frame == NULL || integral_init(&ii, width, height) == -1)
+    {
+        perror("Error while allocating the frame and the integral image");
+        return 1;
+    }
+    draw_diagonal_chain(frame, width, height);
+
+    double label_time = 0, build_time = 0, detect_time = 0;
+    int ok = 1;
+    for (int it = 0; it < iterations; it++)
+    {
+        double start = now();
+        label_frame_rows(frame, width, &lab, 0, height);
+        int n_expected = labeller_collect(&lab, expected, MAX_BLOBS);
+        label_time += now() - start;
+
+        start = now();
+        integral_build(&ii, frame);
+        build_time += now() - start;
+
+        start = now();
+        int n_found = integral_find_blobs(&ii, blobs, MAX_BLOBS);
+        detect_time += now() - start;
+
+        ok = ok && same_blobs(expected, n_expected, blobs, n_found);
+    }
+    printf("%-11s %10.3f %10.3f %10s %10.3f %10s %6s\n", "diagonal", label_time * 1e3 / iterations, build_time * 1e3 / iterations, "-",
+           detect_time * 1e3 / iterations, "-", ok ? "ok" : "FAIL");
+    failures += !ok;
+
+    integral_destroy(&ii);
+    free(frame);
+    labeller_destroy(&lab);
+
+    if (failures > 0)
+    {
+        printf("The integral image differs from the labelling at %d resolutions\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Benchmark of the detection of the objects by labelling the frame against the occupancy pyramid published by processA,
+ * updated over the rectangle changed by the move of the circle and searched from the coarsest level down, and on a
+ * chain of objects placed diagonally close to each other
+ */
+int bench_pyramid(int iterations)
+{
+    int sizes[][2] = {{1600, 600}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    LABELLER lab = {0};
+    BLOB expected[MAX_BLOBS], blobs[MAX_BLOBS];
+
+    printf("%-11s %10s %10s %10s %10s %10s %6s\n", "resolution", "label ms", "build ms", "update ms", "detect ms", "speedup", "check");
+
+    int failures = 0;
+    for (int s = 0; s < n_sizes; s++)
+    {
+        int width = sizes[s][0], height = sizes[s][1], scale = DEFAULT_SCALE;
+        int cols = width / scale, rows = height / scale;
+        PYRAMID_LEVEL levels[PYRAMID_LEVELS];
+        uint64_t size = pyramid_layout(width, height, levels);
+        rgb_pixel_t *frame = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+        uint8_t *built = calloc(size, 1), *updated = calloc(size, 1);
+        PYRAMID_SEARCH search;
+        if (frame == NULL || built == NULL || updated == NULL || pyramid_search_init(&search, levels) == -1)
+        {
+            perror("Error while allocating the frame and the pyramids");
+            return 1;
+        }
+
+        // First frame: the moving circle and a still one, as processA publishes it
+        RECT whole_frame = {0, 0, width - 1, height - 1};
+        int x = 4, y = 4;
+        frame_clear(frame, (size_t)width * height);
+        frame_draw_circle(frame, width, height, cols - 4, rows - 4, scale);
+        frame_draw_circle(frame, width, height, x, y, scale);
+        pyramid_update(levels, updated, frame, width, height, whole_frame);
+
+        double label_time = 0, build_time = 0, update_time = 0, detect_time = 0;
+        int ok = 1;
+        for (int it = 0; it < iterations; it++)
+        {
+            // Move the circle by one cell, diagonally across the frame
+            RECT previous = frame_circle_bounds(width, height, x, y, scale);
+            frame_clear(frame, (size_t)width * height);
+            frame_draw_circle(frame, width, height, cols - 4, rows - 4, scale);
+            x = 4 + (x - 3) % (cols - 12);
+            y = 4 + (y - 3) % (rows - 12);
+            frame_draw_circle(frame, width, height, x, y, scale);
+            RECT dirty = rect_union(previous, frame_circle_bounds(width, height, x, y, scale));
+
+            double start = now();
+            label_frame_rows(frame, width, &lab, 0, height);
+            int n_expected = labeller_collect(&lab, expected, MAX_BLOBS);
+            label_time += now() - start;
+
+            start = now();
+            pyramid_update(levels, built, frame, width, height, whole_frame);
+            build_time += now() - start;
+
+            start = now();
+            pyramid_update(levels, updated, frame, width, height, dirty);
+            update_time += now() - start;
+
+            start = now();
+            int n_found = pyramid_find_blobs(levels, updated, frame, width, height, &search, blobs, MAX_BLOBS);
+            detect_time += now() - start;
+
+            // The update gives the pyramid of the whole frame, and the same objects as the labelling
+            ok = ok && memcmp(built, updated, size) == 0 && same_blobs(expected, n_expected, blobs, n_found);
+        }
+
+        char resolution[16];
+        sprintf(resolution, "%dx%d", width, height);
+        printf("%-11s %10.3f %10.3f %10.3f %10.3f %9.0fx %6s\n", resolution, label_time * 1e3 / iterations, build_time * 1e3 / iterations,
+               update_time * 1e3 / iterations, detect_time * 1e3 / iterations, label_time / (update_time + detect_time), ok ? "ok" : "FAIL");
+        failures += !ok;
+
+        pyramid_search_destroy(&search);
+        free(built);
+        free(updated);
+        free(frame);
+    }
+
+    // Objects placed diagonally close to each other: the rectangles of their cells overlap, not the cells
+    int width = 1600, height = 600;
+    PYRAMID_LEVEL levels[PYRAMID_LEVELS];
+    uint64_t size = pyramid_layout(width, height, levels);
+    rgb_pixel_t *frame = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+    uint8_t *cells = calloc(size, 1);
+    PYRAMID_SEARCH search;
+    if (frame == NULL || cells == NULL || pyramid_search_init(&search, levels) == -1)
+    {
+        perror("Error while allocating the frame and the pyramid");
+        return 1;
+    }
+    RECT whole_frame = {0, 0, width - 1, height - 1};
+    draw_diagonal_chain(frame, width, height);
+    pyramid_update(levels, cells, frame, width, height, whole_frame);
+
+    double label_time = 0, detect_time = 0;
+    int ok = 1;
+    for (int it = 0; it < iterations; it++)
+    {
+        double start = now();
+        label_frame_rows(frame, width, &lab, 0, height);
+        int n_expected = labeller_collect(&lab, expected, MAX_BLOBS);
+        label_time += now() - start;
+
+        start = now();
+        int n_found = pyramid_find_blobs(levels, cells, frame, width, height, &search, blobs, MAX_BLOBS);
+        detect_time += now() - start;
+
+        ok = ok && same_blobs(expected, n_expected, blobs, n_found);
+    }
+    printf("%-11s %10.3f %10s %10s %10.3f %9.0fx %6s\n", "diagonal", label_time * 1e3 / iterations, "-", "-",
+           detect_time * 1e3 / iterations, label_time / detect_time, ok ? "ok" : "FAIL");
+    failures += !ok;
+
+    pyramid_search_destroy(&search);
+    free(cells);
+    free(frame);
+    labeller_destroy(&lab);
+
+    if (failures > 0)
+    {
+        printf("The pyramid differs from the labelling at %d resolutions\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Benchmark of the scene drawn by processA: time to draw a frame after every object drifted by a tick, with 1 to
+ * thousands of objects, on a single worker and on one per core; the frame drawn tile by tile is checked against
+ * the whole frame cleared and drawn object by object, and the circle alone against frame_draw_circle
+ */
+int bench_scene(int iterations)
+{
+    int width = 1920, height = 1080, scale = DEFAULT_SCALE;
+    int counts[] = {1, 100, 1000, 5000, 20000};
+    int n_counts = sizeof(counts) / sizeof(counts[0]);
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int workers[] = {1, cores > 1 ? cores : 2};
+
+    rgb_pixel_t *frame = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+    rgb_pixel_t *expected = malloc((size_t)width * height * sizeof(rgb_pixel_t));
+    if (frame == NULL || expected == NULL)
+    {
+        perror("Error while allocating the frames");
+        return 1;
+    }
+    RECT whole_frame = {0, 0, width - 1, height - 1};
+
+    printf("%-8s %8s %8s %12s %12s %10s %10s %6s\n", "objects", "workers", "tiles", "dirty tiles", "binned", "raster ms", "max ms", "check");
+
+    int failures = 0;
+    for (int c = 0; c < n_counts; c++)
+    {
+        for (int w = 0; w < 2; w++)
+        {
+            SCENE scene;
+            THREAD_POOL pool;
+            rgb_pixel_t circle_color = {255, 0, 0, 0};
+            if (scene_init(&scene, width, height) == -1 || pool_create(&pool, workers[w]) == -1)
+            {
+                perror("Error while creating the scene");
+                return 1;
+            }
+
+            // The circle of processA, then the drifting objects
+            scene_add(&scene, 40 * scale, 20 * scale, scale * 3 / 2, circle_color);
+            scene_scatter(&scene, counts[c] - 1, scale, 1);
+            scene_render(&scene, &pool, frame);
+
+            int ok = 1;
+            if (counts[c] == 1)
+            {
+                frame_clear(expected, (size_t)width * height);
+                frame_draw_circle(expected, width, height, 40, 20, scale);
+                ok = memcmp(frame, expected, (size_t)width * height * sizeof(rgb_pixel_t)) == 0;
+            }
+
+            // Time of the frames after the first one, the circle moving by a cell each tick
+            scene.frames = 0;
+            scene.tiles_drawn = 0;
+            scene.binned = 0;
+            scene.raster_ns = 0;
+            scene.raster_max_ns = 0;
+            for (int it = 0; it < iterations; it++)
+            {
+                scene_move(&scene, 0, (40 + it % 20) * scale, 20 * scale);
+                scene_advance(&scene, 1);
+                scene_render(&scene, &pool, frame);
+            }
+
+            // The frame drawn tile by tile is the one drawn object by object
+            frame_clear(expected, (size_t)width * height);
+            for (int id = 0; id < scene.n_objects; id++)
+            {
+                if (scene.objects[id].active)
+                {
+                    object_draw(&scene.objects[id], expected, width, whole_frame);
+                }
+            }
+            ok = ok && memcmp(frame, expected, (size_t)width * height * sizeof(rgb_pixel_t)) == 0;
+
+            double frames = scene.frames > 0 ? scene.frames : 1;
+            printf("%-8d %8d %8d %12.1f %12.1f %10.3f %10.3f %6s\n", counts[c], pool.n_workers, scene.cols * scene.rows,
+                   scene.tiles_drawn / frames, scene.binned / frames, scene.raster_ns / 1e6 / frames, scene.raster_max_ns / 1e6,
+                   ok ? "ok" : "FAIL");
+            failures += !ok;
+
+            pool_destroy(&pool);
+            scene_destroy(&scene);
+        }
+    }
+    free(frame);
+    free(expected);
+
+    if (failures > 0)
+    {
+        printf("The scene differs from the objects drawn one by one in %d runs\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+// Function to check that a BMP file written by bmp_write holds the frame, bottom-up after the header
+int check_bmp_file(const char *path, const rgb_pixel_t *frame, int width, int height)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    uint8_t header[BMP_HEADER_SIZE], expected[BMP_HEADER_SIZE];
+    bmp_fill_header(expected, width, height);
+    int ok = fread(header, 1, BMP_HEADER_SIZE, file) == BMP_HEADER_SIZE && memcmp(header, expected, BMP_HEADER_SIZE) == 0;
+
+    rgb_pixel_t *row = malloc((size_t)width * sizeof(rgb_pixel_t));
+    for (int y = height - 1; ok && y >= 0; y--)
+    {
+        ok = fread(row, sizeof(rgb_pixel_t), width, file) == (size_t)width &&
+             memcmp(row, frame + (size_t)y * width, (size_t)width * sizeof(rgb_pixel_t)) == 0;
+    }
+    ok = ok && fgetc(file) == EOF;
+
+    free(row);
+    fclose(file);
+    return ok;
+}
+
+// Benchmark of the snapshots saved by processA, with libbmp and with the in-tree writer
+int bench_snapshot(int iterations)
+{
+    int sizes[][2] = {{1600, 600}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    const char *path = "out/benchmark.bmp";
+    int failures = 0;
+
+    printf("Snapshots written in out/\n");
+    printf("%-11s %9s %10s %12s %10s %6s\n", "resolution", "file MB", "libbmp ms", "buffered ms", "direct ms", "check");
+
+    for (int s = 0; s < n_sizes; s++)
+    {
+        int width = sizes[s][0], height = sizes[s][1];
+        size_t n = (size_t)width * height;
+
+        rgb_pixel_t *frame = malloc(n * sizeof(rgb_pixel_t));
+        bmpfile_t *bmp = bmp_create(width, height, DEFAULT_DEPTH);
+        if (frame == NULL || bmp == NULL)
+        {
+            perror("Error while allocating the frame");
+            return 1;
+        }
+        frame_clear(frame, n);
+        for (int k = 0; k < 20; k++)
+        {
+            frame_draw_circle(frame, width, height, k * 7 % (width / DEFAULT_SCALE), k * 3 % (height / DEFAULT_SCALE), DEFAULT_SCALE);
+        }
+
+        // Snapshot through libbmp, filling the bitmap from the frame first
+        double start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            static_to_bmp(frame, bmp, width, height);
+            bmp_save(bmp, path);
+        }
+        double libbmp_time = (now() - start) / iterations;
+
+        // Snapshot with the in-tree writer, through the page cache and direct
+        double times[2];
+        int direct_in_effect = 1, ok = 1;
+        for (int direct = 0; direct < 2; direct++)
+        {
+            start = now();
+            for (int it = 0; it < iterations; it++)
+            {
+                int flags = direct ? BMP_WRITE_DIRECT : 0;
+                if (bmp_write(path, frame, width, height, &flags) == -1)
+                {
+                    perror("Error while writing the snapshot");
+                    return 1;
+                }
+                direct_in_effect = direct ? (flags & BMP_WRITE_DIRECT) != 0 : direct_in_effect;
+            }
+            times[direct] = (now() - start) / iterations;
+            ok = ok && check_bmp_file(path, frame, width, height);
+        }
+
+        char resolution[16], direct_ms[16];
+        sprintf(resolution, "%dx%d", width, height);
+        if (direct_in_effect)
+        {
+            sprintf(direct_ms, "%.3f", times[1] * 1e3);
+        }
+        else
+        {
+            sprintf(direct_ms, "n/a");
+        }
+        printf("%-11s %9.1f %10.3f %12.3f %10s %6s\n", resolution, bmp_file_size(width, height) / 1048576.0, libbmp_time * 1e3,
+               times[0] * 1e3, direct_ms, ok ? "ok" : "FAIL");
+        failures += !ok;
+
+        bmp_destroy(bmp);
+        free(frame);
+    }
+
+    unlink(path);
+    return failures > 0;
+}
+
+// Benchmark of the allocation policies of the shared memory, with the geometry from ARP_WIDTH and ARP_HEIGHT
+int bench_policy(int iterations)
+{
+    int policies[] = {0, SHM_POLICY_POPULATE, SHM_POLICY_THP, SHM_POLICY_THP | SHM_POLICY_POPULATE,
+                      SHM_POLICY_HUGETLB, SHM_POLICY_HUGETLB | SHM_POLICY_POPULATE, SHM_POLICY_POPULATE | SHM_POLICY_LOCK};
+    int n_policies = sizeof(policies) / sizeof(policies[0]);
+
+    GEOMETRY geometry = geometry_from_env();
+    LABELLER lab = {0};
+    BLOB blobs[MAX_BLOBS];
+
+    int tlb_fd = open_tlb_counter();
+    if (tlb_fd == -1)
+    {
+        printf("TLB miss counter not available (check /proc/sys/kernel/perf_event_paranoid)\n");
+    }
+
+    printf("Image of %dx%d pixels\n", geometry.width, geometry.height);
+    printf("%-24s %-24s %9s %11s %9s %9s %13s\n", "requested", "in effect", "create ms", "1st frame ms", "frame ms", "attach ms", "dTLB miss/scan");
+
+    for (int p = 0; p < n_policies; p++)
+    {
+        // Create the object and write the first frame, as processA does at launch
+        double start = now();
+        SHARED_HEADER *header = shared_image_create(BENCH_SHM_NAME, &geometry, policies[p]);
+        if (header == NULL)
+        {
+            perror("Error while creating the shared memory object");
+            return 1;
+        }
+        double create_time = now() - start;
+
+        rgb_pixel_t *frame = shared_frame(header);
+        start = now();
+        memset(frame, 0, header->frame_size);
+        draw_frame_circle(frame, &geometry, 4, 4);
+        double first_frame_time = now() - start;
+
+        // Following frames
+        start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            memset(frame, 0, header->frame_size);
+            draw_frame_circle(frame, &geometry, 4 + it % 8, 4);
+        }
+        double frame_time = (now() - start) / iterations;
+
+        // Map the object a second time, as processB does
+        start = now();
+        SHARED_HEADER *reader = shared_image_attach(BENCH_SHM_NAME, 1000, PROT_READ);
+        if (reader == NULL)
+        {
+            perror("Error while attaching to the shared memory object");
+            return 1;
+        }
+        double attach_time = now() - start;
+
+        // Count the TLB misses of the labelling scans on the reader mapping
+        ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+        for (int it = 0; it < iterations; it++)
+        {
+            label_frame_rows(shared_frame(reader), geometry.width, &lab, 0, geometry.height);
+            labeller_collect(&lab, blobs, MAX_BLOBS);
+        }
+        ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long misses = read_counter(tlb_fd);
+
+        char requested[64], effective[64], tlb[32];
+        if (misses >= 0)
+        {
+            sprintf(tlb, "%lld", misses / iterations);
+        }
+        else
+        {
+            sprintf(tlb, "n/a");
+        }
+        printf("%-24s %-24s %9.3f %11.3f %9.3f %9.3f %13s\n", policy_to_string(policies[p], requested, sizeof(requested)),
+               policy_to_string(header->policy, effective, sizeof(effective)), create_time * 1e3, first_frame_time * 1e3,
+               frame_time * 1e3, attach_time * 1e3, tlb);
+
+        shared_image_detach(reader);
+        shared_image_detach(header);
+        shared_image_unlink(BENCH_SHM_NAME);
+    }
+
+    if (tlb_fd != -1)
+    {
+        close(tlb_fd);
+    }
+    labeller_destroy(&lab);
+    return 0;
+}
+
+// Port of the servers of the transport benchmark
+#define BENCH_PORT 5999
+
+// Typedef for the echo server of the transport benchmark, acking every command as processA does
+typedef struct
+{
+    int transport;
+    int fd;
+    COMMAND_QUEUE *queue;
+    volatile int stop;
+}ECHO_SERVER;
+
+// Function to run the echo server until stopped, in its own thread
+void *echo_server(void *arg)
+{
+    ECHO_SERVER *server = (ECHO_SERVER *)arg;
+    int keys[UDP_MAX_REDUNDANCY];
+    int cmd;
+
+    if (server->transport == TRANSPORT_SHM)
+    {
+        // Sleep on the queue, checking the stop flag at least every 100 ms
+        while (!server->stop)
+        {
+            command_ring_wait(&server->queue->commands, 100000000ULL);
+            while (command_ring_receive(&server->queue->commands, &cmd))
+            {
+                command_ring_send(&server->queue->acks, cmd);
+            }
+        }
+    }
+    else if (server->transport == TRANSPORT_UDP)
+    {
+        UDP_RECEIVER receiver;
+        receiver.n_peers = 0;
+        receiver.invalid = 0;
+        receiver.evicted = 0;
+
+        struct pollfd pfd = {server->fd, POLLIN, 0};
+        while (!server->stop)
+        {
+            if (poll(&pfd, 1, 100) > 0)
+            {
+                udp_receive(&receiver, server->fd, keys);
+            }
+        }
+    }
+    else
+    {
+        // A single client, served until it closes the connection
+        CLIENT_SET clients;
+        clients_init(&clients, server->fd);
+        if (clients_accept(&clients) < 0)
+        {
+            return NULL;
+        }
+        int received;
+        while ((received = clients_receive(&clients, 0, &cmd)) != CLIENT_CLOSED)
+        {
+            if (received == CLIENT_COMMAND)
+            {
+                clients_ack(&clients, 0, cmd);
+            }
+        }
+        clients_remove(&clients, 0);
+    }
+    return NULL;
+}
+
+// Function to wait for the ack of the last command sent by the client, returns -1 on error
+int wait_ack(int transport, int fd, UDP_SENDER *sender, COMMAND_QUEUE *queue)
+{
+    char ack[MESSAGE_SIZE];
+    int cmd;
+
+    switch (transport)
+    {
+        case TRANSPORT_SHM:
+            while (!command_ring_receive(&queue->acks, &cmd))
+            {
+                command_ring_wait(&queue->acks, 1000000000ULL);
+            }
+            return 0;
+        case TRANSPORT_UDP:
+            while (sender->acked != sender->seq)
+            {
+                struct pollfd pfd = {fd, POLLIN, 0};
+                if (poll(&pfd, 1, UDP_RESEND_NS / 1000000) > 0)
+                {
+                    udp_sender_receive(sender, fd);
+                }
+                else if (sender->resends >= UDP_MAX_RESENDS)
+                {
+                    return -1;
+                }
+                udp_sender_poll(sender, fd, monotonic_ns());
+            }
+            return 0;
+        default:
+            for (int filled = 0; filled < MESSAGE_SIZE;)
+            {
+                int n = read(fd, ack + filled, MESSAGE_SIZE - filled);
+                if (n <= 0)
+                {
+                    return -1;
+                }
+                filled += n;
+            }
+            return 0;
+    }
+}
+
+// Function to compare two latencies, for qsort
+int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Benchmark of the round trip of a command over each transport, from the
+ * send of the client to its ack, with the server in a thread of this process.
+ * Commands are sent one at a time, so the times are the latency of the
+ * transport and not its throughput.
+ */
+int bench_transport(int iterations)
+{
+    int commands = iterations * 100;
+    uint64_t *latencies = malloc(commands * sizeof(uint64_t));
+    if (latencies == NULL)
+    {
+        perror("Error while allocating the latencies");
+        return 1;
+    }
+
+    printf("%-9s %8s %9s %9s %9s %9s %9s\n", "transport", "commands", "mean us", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    for (int transport = 0; transport < TRANSPORTS; transport++)
+    {
+        ECHO_SERVER server = {transport, -1, NULL, 0};
+        int fd = -1;
+        COMMAND_QUEUE *queue = NULL;
+        UDP_SENDER sender;
+        udp_sender_init(&sender, 1);
+
+        // Open the server side, then connect the client
+        if (transport == TRANSPORT_SHM)
+        {
+            server.queue = command_queue_create(BENCH_PORT);
+            queue = server.queue != NULL ? command_queue_open(BENCH_PORT) : NULL;
+        }
+        else
+        {
+            server.fd = transport_listen(transport, BENCH_PORT);
+            fd = server.fd >= 0 ? transport_connect(transport, "localhost", BENCH_PORT) : -1;
+        }
+        if (queue == NULL && fd < 0)
+        {
+            printf("Error while opening the %s transport: %s\n", transport_name(transport), strerror(errno));
+            return 1;
+        }
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, echo_server, &server);
+
+        // Send the commands one at a time, alternating the arrow keys
+        int sent = 0;
+        for (; sent < commands; sent++)
+        {
+            uint64_t start = monotonic_ns();
+            if (transport_send_key(transport, fd, &sender, queue, sent % 2 ? KEY_LEFT : KEY_RIGHT) < 0 ||
+                wait_ack(transport, fd, &sender, queue) < 0)
+            {
+                printf("Error while sending over the %s transport\n", transport_name(transport));
+                break;
+            }
+            latencies[sent] = monotonic_ns() - start;
+        }
+
+        // Close the client, which also stops the servers of the stream transports
+        server.stop = 1;
+        if (queue != NULL)
+        {
+            command_queue_close(queue);
+        }
+        else
+        {
+            close(fd);
+        }
+        pthread_join(thread, NULL);
+        if (server.queue != NULL)
+        {
+            command_queue_destroy(server.queue, BENCH_PORT);
+        }
+        else
+        {
+            close(server.fd);
+        }
+
+        if (sent == 0)
+        {
+            continue;
+        }
+        qsort(latencies, sent, sizeof(uint64_t), compare_latency);
+        double total = 0;
+        for (int i = 0; i < sent; i++)
+        {
+            total += latencies[i];
+        }
+        printf("%-9s %8d %9.2f %9.2f %9.2f %9.2f %9.2f\n", transport_name(transport), sent, total / sent / 1e3,
+               latencies[sent / 2] / 1e3, latencies[(int)(sent * 0.99)] / 1e3, latencies[(int)(sent * 0.999)] / 1e3,
+               latencies[sent - 1] / 1e3);
+    }
+
+    // Remove the Unix domain socket of the benchmark
+    char path[108];
+    transport_unix_path(BENCH_PORT, path, sizeof(path));
+    unlink(path);
+
+    free(latencies);
+    return 0;
+}
+
+// Rate in frames per second of the writer of the readers benchmark, the tick rate of processA
+#define BENCH_WRITER_HZ 60
+
+// Typedef for the state shared by the writer and the reader processes of the readers benchmark
+typedef struct {
+    // Set to stop the readers
+    int stop;
+    // Lock of the frame when the readers take it, instead of checking the sequence number
+    sem_t lock;
+}READERS_CONTROL;
+
+// Function run by a reader process, copying the frame without pause until stopped
+void bench_reader(SHARED_HEADER *header, READER_SLOT *slot, READERS_CONTROL *control, int locked)
+{
+    rgb_pixel_t *snapshot = malloc(header->frame_size);
+    const rgb_pixel_t *frame = shared_frame(header);
+    if (snapshot == NULL)
+    {
+        return;
+    }
+
+    while (!__atomic_load_n(&control->stop, __ATOMIC_ACQUIRE))
+    {
+        if (locked)
+        {
+            // One reader at a time, and never while the writer draws
+            sem_wait(&control->lock);
+            memcpy(snapshot, frame, header->frame_size);
+            uint32_t seq = header->frame_seq;
+            sem_post(&control->lock);
+            reader_slot_done(slot, seq, 0);
+        }
+        else
+        {
+            // All the readers at once, the copies overlapping a frame being drawn start again
+            uint32_t seq = frame_read_begin(header);
+            int retries = 0;
+            memcpy(snapshot, frame, header->frame_size);
+            while (frame_read_retry(header, seq))
+            {
+                seq = frame_read_begin(header);
+                memcpy(snapshot, frame, header->frame_size);
+                retries++;
+            }
+            reader_slot_done(slot, seq, retries);
+        }
+    }
+    free(snapshot);
+}
+
+// Benchmark of the frame read by 1 to 32 processes at once, with the lock of the previous versions and with the sequence number
+int bench_readers(int iterations)
+{
+    GEOMETRY geometry = geometry_from_env();
+    SHARED_HEADER *header = shared_image_create(BENCH_SHM_NAME, &geometry, 0);
+    if (header == NULL)
+    {
+        perror("Error while creating the shared memory object");
+        return 1;
+    }
+    rgb_pixel_t *frame = shared_frame(header);
+    int n = geometry.width * geometry.height;
+    int cols = geometry.width / geometry.scale;
+
+    READERS_CONTROL *control = mmap(NULL, sizeof(READERS_CONTROL), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (control == MAP_FAILED)
+    {
+        perror("Error while mapping the control of the readers");
+        return 1;
+    }
+
+    printf("%d frames published at %d Hz, %.1f MB each\n", iterations, BENCH_WRITER_HZ, header->frame_size / 1048576.0);
+    printf("%-8s %-8s %11s %11s %9s %8s %14s\n", "readers", "read", "frames/s", "per reader", "retries", "max lag", "max write us");
+
+    for (int n_readers = 1; n_readers <= MAX_READERS; n_readers *= 2)
+    {
+        for (int locked = 1; locked >= 0; locked--)
+        {
+            control->stop = 0;
+            sem_init(&control->lock, 1, 1);
+            memset(header->readers, 0, sizeof(header->readers));
+
+            // Start the readers, each one in its own slot
+            for (int r = 0; r < n_readers; r++)
+            {
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    READER_SLOT *slot = reader_slot_claim(header);
+                    if (slot != NULL)
+                    {
+                        bench_reader(header, slot, control, locked);
+                    }
+                    _exit(0);
+                }
+            }
+
+            // Wait for all of them to be registered
+            int registered = 0;
+            while (registered < n_readers)
+            {
+                usleep(1000);
+                registered = 0;
+                for (int r = 0; r < MAX_READERS; r++)
+                {
+                    registered += __atomic_load_n(&header->readers[r].pid, __ATOMIC_ACQUIRE) != 0;
+                }
+            }
+
+            uint64_t frames_before = 0;
+            for (int r = 0; r < MAX_READERS; r++)
+            {
+                frames_before += __atomic_load_n(&header->readers[r].frames, __ATOMIC_RELAXED);
+            }
+
+            // Publish the frames at the tick rate, as processA does
+            double start = now(), max_write = 0;
+            uint32_t max_lag = 0;
+            for (int it = 0; it < iterations; it++)
+            {
+                double next = start + (double)it / BENCH_WRITER_HZ;
+                if (next > now())
+                {
+                    usleep((useconds_t)((next - now()) * 1e6));
+                }
+
+                for (int r = 0; r < MAX_READERS; r++)
+                {
+                    if (header->readers[r].pid != 0 && reader_slot_lag(header, &header->readers[r]) > max_lag)
+                    {
+                        max_lag = reader_slot_lag(header, &header->readers[r]);
+                    }
+                }
+
+                // Time from the decision to publish to the frame being published, including the wait for the lock
+                double write_start = now();
+                if (locked)
+                {
+                    sem_wait(&control->lock);
+                }
+                frame_write_begin(header);
+                frame_clear(frame, n);
+                frame_draw_circle(frame, geometry.width, geometry.height, 2 + it % (cols - 4), 2, geometry.scale);
+                frame_write_end(header);
+                if (locked)
+                {
+                    sem_post(&control->lock);
+                }
+                if (now() - write_start > max_write)
+                {
+                    max_write = now() - write_start;
+                }
+            }
+            double elapsed = now() - start;
+
+            uint64_t frames = 0, retries = 0;
+            for (int r = 0; r < MAX_READERS; r++)
+            {
+                frames += __atomic_load_n(&header->readers[r].frames, __ATOMIC_RELAXED);
+                retries += __atomic_load_n(&header->readers[r].retries, __ATOMIC_RELAXED);
+            }
+            frames -= frames_before;
+
+            // Stop the readers
+            __atomic_store_n(&control->stop, 1, __ATOMIC_RELEASE);
+            while (wait(NULL) > 0)
+            {
+            }
+            sem_destroy(&control->lock);
+
+            printf("%-8d %-8s %11.1f %11.1f %9llu %8u %14.1f\n", n_readers, locked ? "locked" : "seqlock", frames / elapsed,
+                   frames / elapsed / n_readers, (unsigned long long)retries, max_lag, max_write * 1e6);
+        }
+    }
+
+    munmap(control, sizeof(READERS_CONTROL));
+    shared_image_detach(header);
+    shared_image_unlink(BENCH_SHM_NAME);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <benchmark> [iterations]\n", argv[0]);
+        printf("Benchmarks:\n");
+        printf("  geometry   frame create, clear, copy and labelling time across resolutions\n");
+        printf("  policy     first frame latency and TLB misses for each shared memory allocation policy\n");
+        printf("  snapshot   time to save a snapshot with libbmp and with the in-tree BMP writer, buffered and direct\n");
+        printf("  kernels    pixel kernels against their reference implementations, across resolutions and pixel formats\n");
+        printf("  simd       pixel kernels of each instruction set supported by the processor against the scalar ones\n");
+        printf("  transport  round trip latency of a command over each transport, with 100 commands per iteration\n");
+        printf("  integral   object detection by labelling against the integral image, built whole and updated over the moved circle\n");
+        printf("  pyramid    object detection by labelling against the occupancy pyramid, updated over the moved circle\n");
+        printf("  scene      time to draw the scene of processA tile by tile, from 1 to 20000 drifting objects, on 1 worker and on one per core\n");
+        printf("  readers    frames read per second by 1 to 32 processes, with a lock and with the sequence number of the frame\n");
+        return 1;
+    }
+
+    // Number of iterations of each measurement
+    int iterations = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 50;
+
+    if (strcmp(argv[1], "geometry") == 0)
+    {
+        return bench_geometry(iterations);
+    }
+    if (strcmp(argv[1], "policy") == 0)
+    {
+        return bench_policy(iterations);
+    }
+
+    if (strcmp(argv[1], "snapshot") == 0)
+    {
+        return bench_snapshot(iterations);
+    }
+    if (strcmp(argv[1], "kernels") == 0)
+    {
+        return bench_kernels(iterations);
+    }
+    if (strcmp(argv[1], "simd") == 0)
+    {
+        return bench_simd(iterations);
+    }
+    if (strcmp(argv[1], "transport") == 0)
+    {
+        return bench_transport(iterations);
+    }
+    if (strcmp(argv[1], "integral") == 0)
+    {
+        return bench_integral(iterations);
+    }
+    if (strcmp(argv[1], "pyramid") == 0)
+    {
+        return bench_pyramid(iterations);
+    }
+    if (strcmp(argv[1], "scene") == 0)
+    {
+        return bench_scene(iterations);
+    }
+    if (strcmp(argv[1], "readers") == 0)
+    {
+        return bench_readers(iterations);
+    }
+
+    printf("Unknown benchmark: %s\n", argv[1]);
+    return 1;
+}
@@ -3,12 +3,34 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
-#include <semaphore.h>
 #include <fcntl.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include "./../include/trace_events.h"
+#include "./../include/shared_image.h"
+#include "./../include/instance.h"
+
+// Times a crashed child process is restarted in a session before the session is closed
+#define DEFAULT_MAX_RESTARTS 3
+
+// Typedef for a pipeline supervised by master, processA and processB running in their own instance
+typedef struct
+{
+  int instance;
+  // Lock file claiming the instance on the host
+  int lock_fd;
+  char instance_str[8];
+  char port_str[6];
+  char *arg_list_A[7];
+  char *arg_list_B[4];
+  pid_t pid_procA;
+  pid_t pid_procB;
+  // Header of the shared memory created by processA, to tell a crash from a clean exit
+  SHARED_HEADER *header;
+  // Times a crashed child can still be restarted
+  int restarts;
+}PIPELINE;
 
-#define SEM_PATH "/sem_SHARED_IMAGE"
 
 int spawn(const char *program, char *arg_list[])
 {
@@ -35,30 +57,151 @@ int spawn(const char *program, char *arg_list[])
   }
 }
 
-int main()
+// Check if a child process was killed by a signal other than the ones closing it
+int crashed(int status)
 {
+  return WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM && WTERMSIG(status) != SIGHUP && WTERMSIG(status) != SIGKILL;
+}
+
+// Check if a process is gone without clearing its pid, the only trace of a crash inside konsole, whose status is its own
+int died(uint32_t pid)
+{
+  return pid != 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+// Check if processA crashed, leaving the ownership of the shared memory to a dead process
+int producer_crashed(int status, SHARED_HEADER *header)
+{
+  return crashed(status) || (header != NULL && died(__atomic_load_n(&header->owner_pid, __ATOMIC_ACQUIRE)));
+}
 
-  // Create a semaphore
-  sem_t *sem = sem_open(SEM_PATH, O_CREAT, S_IRUSR | S_IWUSR, 1);
-  if (sem == SEM_FAILED)
+// Check if processB crashed, leaving its reader slot to a dead process
+int reader_crashed(int status, SHARED_HEADER *header)
+{
+  if (crashed(status))
   {
-    perror("Error while creating semaphore");
     return 1;
   }
+  for (int i = 0; header != NULL && i < MAX_READERS; i++)
+  {
+    if (died(__atomic_load_n(&header->readers[i].pid, __ATOMIC_ACQUIRE)))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Function to launch a process of a pipeline in konsole, passing it the instance of the pipeline
+pid_t spawn_in(PIPELINE *pipeline, char *arg_list[])
+{
+  setenv("ARP_INSTANCE", pipeline->instance_str, 1);
+  return spawn("/usr/bin/konsole", arg_list);
+}
 
-  // Initialize the semaphore
-  if (sem_init(sem, 1, 1) == -1)
+// Function to claim the first free instance from first and launch the processA of a pipeline, returns -1 on error
+int pipeline_start(PIPELINE *pipeline, int first, char *modality_str, int port, char *ip_str, int restarts)
+{
+  pipeline->instance = instance_claim(first, &pipeline->lock_fd);
+  if (pipeline->instance == -1)
   {
-    perror("Error while initializing semaphore");
-    return 1;
+    return -1;
   }
+  sprintf(pipeline->instance_str, "%d", pipeline->instance);
+  sprintf(pipeline->port_str, "%d", port);
+  pipeline->header = NULL;
+  pipeline->restarts = restarts;
+
+  // Create the argument list for the child processes
+  char *arg_list_A[] = {"/usr/bin/konsole", "-e", "./bin/processA", modality_str, pipeline->port_str, ip_str, NULL};
+  char *arg_list_B[] = {"/usr/bin/konsole", "-e", "./bin/processB", NULL};
+  memcpy(pipeline->arg_list_A, arg_list_A, sizeof(arg_list_A));
+  memcpy(pipeline->arg_list_B, arg_list_B, sizeof(arg_list_B));
+
+  uint64_t span = span_begin();
+  pipeline->pid_procA = spawn_in(pipeline, pipeline->arg_list_A);
+  span_end("spawn processA", span);
+  if (pipeline->pid_procA == 1)
+  {
+    close(pipeline->lock_fd);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Function to check the processes of a pipeline. A child process that crashed is restarted
+ * alone: the shared memory keeps the frame, so the other process goes on. Returns 0 once a
+ * child process exited, after closing the other one.
+ */
+int pipeline_supervise(PIPELINE *pipeline)
+{
+  int status;
 
-  // Close the semaphore
-  if (sem_close(sem) == -1)
+  if (waitpid(pipeline->pid_procA, &status, WNOHANG) != 0)
   {
-    perror("Error while closing semaphore");
-    return 1;
+    if (producer_crashed(status, pipeline->header) && pipeline->restarts > 0)
+    {
+      pipeline->restarts--;
+      printf("processA of instance %d crashed, restarting it\n", pipeline->instance);
+      fflush(stdout);
+      pipeline->pid_procA = spawn_in(pipeline, pipeline->arg_list_A);
+      if (pipeline->pid_procA != 1)
+      {
+        return 1;
+      }
+    }
+
+    // Otherwise close the other child process, which writes its logs and spans before exiting
+    kill(pipeline->pid_procB, SIGTERM);
+    waitpid(pipeline->pid_procB, &status, 0);
+    return 0;
+  }
+  else if (waitpid(pipeline->pid_procB, &status, WNOHANG) != 0)
+  {
+    if (reader_crashed(status, pipeline->header) && pipeline->restarts > 0)
+    {
+      pipeline->restarts--;
+      printf("processB of instance %d crashed, restarting it\n", pipeline->instance);
+      fflush(stdout);
+      pipeline->pid_procB = spawn_in(pipeline, pipeline->arg_list_B);
+      if (pipeline->pid_procB != 1)
+      {
+        return 1;
+      }
+    }
+    kill(pipeline->pid_procA, SIGTERM);
+    waitpid(pipeline->pid_procA, &status, 0);
+    return 0;
   }
+  return 1;
+}
+
+// Function to release the shared memory and the instance of a closed pipeline
+void pipeline_release(PIPELINE *pipeline)
+{
+  if (pipeline->header != NULL)
+  {
+    shared_image_detach(pipeline->header);
+  }
+  close(pipeline->lock_fd);
+}
+
+int main()
+{
+  // Record the spans of the processes, if ARP_TRACE_EVENTS is set
+  trace_events_init("master");
+
+  // Number of pipelines launched in each session, set with ARP_PIPELINES, and first instance to claim, set with ARP_INSTANCE
+  int n_pipelines = getenv("ARP_PIPELINES") != NULL ? atoi(getenv("ARP_PIPELINES")) : 1;
+  if (n_pipelines < 1 || n_pipelines > MAX_PIPELINES)
+  {
+    n_pipelines = n_pipelines < 1 ? 1 : MAX_PIPELINES;
+  }
+  int first_instance = instance_from_env();
+
+  // Number of times a crashed child can be restarted in each pipeline, set with ARP_MAX_RESTARTS
+  int max_restarts = getenv("ARP_MAX_RESTARTS") != NULL ? atoi(getenv("ARP_MAX_RESTARTS")) : DEFAULT_MAX_RESTARTS;
 
   // Variable to store the user's choice
   char choice[20];
@@ -174,52 +317,104 @@ int main()
       break;
     }
 
-    // Create the argument list for the child processes
-    char *arg_list_A[] = {"/usr/bin/konsole", "-e", "./bin/processA", modality_str, port_str, ip_str, NULL};
-    char *arg_list_B[] = {"/usr/bin/konsole", "-e", "./bin/processB", NULL};
+    // Pipeline i listens on, or connects to, the port number plus i
+    int port = modality == 2 || modality == 3 ? atoi(port_str) : 0;
+    int n = port + n_pipelines - 1 > 65535 ? 65536 - port : n_pipelines;
 
-    pid_t pid_procA = spawn("/usr/bin/konsole", arg_list_A);
-    if (pid_procA == 1)
+    // Launch the processA of each pipeline, in the first free instance
+    PIPELINE pipelines[MAX_PIPELINES];
+    int n_started = 0;
+    uint64_t run_span = span_begin();
+    for (int i = 0; i < n; i++)
+    {
+      if (pipeline_start(&pipelines[n_started], first_instance, modality_str, port == 0 ? 0 : port + i, ip_str, max_restarts) == -1)
+      {
+        perror("Error while starting a pipeline");
+        break;
+      }
+      if (n > 1)
+      {
+        printf("Pipeline %d: instance %d, port %s\n", n_started, pipelines[n_started].instance, pipelines[n_started].port_str);
+      }
+      n_started++;
+    }
+    if (n_started == 0)
     {
       return 1;
     }
 
     usleep(500000);
 
-    pid_t pid_procB = spawn("/usr/bin/konsole", arg_list_B);
-    if (pid_procB == 1)
+    // Launch the processB of each pipeline
+    for (int i = 0; i < n_started; i++)
     {
-      // Kill the other process
-      kill(pid_procA, SIGKILL);
-      return 1;
+      uint64_t span = span_begin();
+      pipelines[i].pid_procB = spawn_in(&pipelines[i], pipelines[i].arg_list_B);
+      span_end("spawn processB", span);
+      if (pipelines[i].pid_procB == 1)
+      {
+        // Kill the other processes
+        for (int k = 0; k < n_started; k++)
+        {
+          kill(pipelines[k].pid_procA, SIGKILL);
+          if (k < i)
+          {
+            kill(pipelines[k].pid_procB, SIGKILL);
+          }
+        }
+        return 1;
+      }
     }
 
-    int status;
+    // Map the header of the shared memory of each pipeline, once processA created it
+    for (int i = 0; i < n_started; i++)
+    {
+      char shm_name[64];
+      instance_name(SHM_NAME, "", pipelines[i].instance, shm_name, sizeof(shm_name));
+      pipelines[i].header = shared_image_attach(shm_name, 5000, PROT_READ);
+    }
 
-    while (1)
+    // Supervise the pipelines until all of them are closed
+    int open[MAX_PIPELINES];
+    int n_open = n_started;
+    for (int i = 0; i < n_started; i++)
     {
-      // If child process terminates unexpectedly, kill the other child process
-      if (waitpid(pid_procA, &status, WNOHANG) != 0)
-      {
-        kill(pid_procB, SIGKILL);
-        break;
-      }
-      else if (waitpid(pid_procB, &status, WNOHANG) != 0)
+      open[i] = 1;
+    }
+    while (n_open > 0)
+    {
+      for (int i = 0; i < n_started; i++)
       {
-        kill(pid_procA, SIGKILL);
-        break;
+        if (open[i] && !pipeline_supervise(&pipelines[i]))
+        {
+          pipeline_release(&pipelines[i]);
+          open[i] = 0;
+          n_open--;
+        }
       }
+
+      // Do not spin on the processor while the children run
+      usleep(10000);
     }
 
+    span_end("run", run_span);
+
     printf("Program exited.\n");
     fflush(stdout);
   }
 
-  // Unlink the semaphore
-  if (sem_unlink(SEM_PATH) == -1)
+  // Merge the spans of all the processes in a single trace
+  if (trace_events.path != NULL)
   {
-    perror("Error while unlinking semaphore");
-    return 1;
+    const char *path = trace_events.path;
+    trace_events_close();
+    int merged = trace_events_merge(path);
+    if (merged == -1)
+    {
+      perror("Error while writing the trace");
+      return 1;
+    }
+    printf("Trace of %d processes written to %s\n", merged, path);
   }
 
   return 0;
@@ -1,9 +1,18 @@
+#define _GNU_SOURCE
 #include "./../include/processA_utilities.h"
-#include <bmpfile.h>
+#include "./../include/shared_image.h"
+#include "./../include/ui_renderer.h"
+#include "./../include/client_set.h"
+#include "./../include/transport.h"
+#include "./../include/session.h"
+#include "./../include/pixel_kernels.h"
+#include "./../include/bmp_writer.h"
+#include "./../include/trace_events.h"
+#include "./../include/instance.h"
+#include "./../include/scene.h"
 #include <fcntl.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
-#include <semaphore.h>
 #include <errno.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -14,85 +23,95 @@
 #include <strings.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 
-#define SEM_PATH "/sem_SHARED_IMAGE"
 
-// Dimensions of the image
-const int width = 1600;
-const int height = 600;
-const int depth = 4;
+// Maximum number of commands drained from all the sources in a pass of the loop, the others wait for the next pass
+#define MAX_PENDING 1024
 
-// Log file
-FILE *logFile;
+// Interval between two logs of the readers of the frame
+#define READERS_LOG_NS 10000000000ULL
 
-// Function to draw a circle of radius 30 on a bitmap centered in given coordinates
-void draw_bmp_circle(bmpfile_t *bmp, int x, int y)
-{
+// Time a message stays on the status line
+#define STATUS_NS 1000000000ULL
 
-    // Data type for defining pixel colors (BGRA)
-    rgb_pixel_t pixel = {255, 0, 0, 0};
+// Dimensions of the image and pixels per cell of the window, chosen at launch
+int width;
+int height;
+int scale;
 
-    // Radius of the circle
-    int radius = 30;
+// Log file
+FILE *logFile;
 
-    // Draw the circle
-    for (int i = -radius; i <= radius; i++)
-    {
-        for (int j = -radius; j <= radius; j++)
-        {
-            // If distance is smaller, point is within the circle
-            if (sqrt(i * i + j * j) < radius)
-            {
-                /*
-                 * Color the pixel at the specified (x,y) position with a factor of 20
-                 * with the given pixel values
-                 */
-                bmp_set_pixel(bmp, x * 20 + i, y * 20 + j, pixel);
-            }
-        }
-    }
+// Colors of the markers of the clients, blue is the circle
+rgb_pixel_t marker_colors[] = {{0, 0, 255, 0}, {0, 255, 0, 0}, {0, 255, 255, 0}, {255, 0, 255, 0}, {255, 255, 0, 0}, {0, 128, 255, 0}, {128, 0, 255, 0}, {255, 255, 255, 0}};
+
+// Typedef for the counters of the commands drained and applied by the server since the last log
+typedef struct {
+    // Passes of the loop that found commands waiting, commands found, most found by a pass and passes that left some waiting
+    unsigned long passes;
+    unsigned long commands;
+    int max_depth;
+    unsigned long full;
+    // Frames published, commands applied in them and most applied in a frame, and commands applied since the last frame
+    unsigned long frames;
+    unsigned long applied;
+    int max_applied;
+    int since_frame;
+}INPUT_COUNTERS;
+
+// Set by SIGTERM and SIGHUP to exit the main loop as the q key does
+volatile sig_atomic_t quit_requested = 0;
+
+// Function handling SIGTERM and SIGHUP, sent when master or the terminal closes processA
+void request_quit(int signo)
+{
+    quit_requested = 1;
 }
 
-// Function to erase all the bitmap
-void erase_bmp(bmpfile_t *bmp)
+// Function to keep a marker for each connected client along the bottom of the frame, each in a color of its own
+void sync_client_markers(SCENE *scene, CLIENT_SET *clients, int *markers, int *n_markers)
 {
-
-    // Data type for defining pixel colors (BGRA)
-    rgb_pixel_t pixel = {0, 0, 0, 0};
-
-    // Erase the bitmap
-    for (int i = 0; i < width; i++)
+    while (*n_markers < clients->n_clients)
     {
-        for (int j = 0; j < height; j++)
+        int k = *n_markers;
+        int id = scene_add(scene, scale + k * 2 * scale, height - scale, scale / 2,
+                           marker_colors[k % (sizeof(marker_colors) / sizeof(marker_colors[0]))]);
+        if (id == -1)
         {
-            bmp_set_pixel(bmp, i, j, pixel);
+            return;
         }
+        markers[(*n_markers)++] = id;
+    }
+    while (*n_markers > clients->n_clients)
+    {
+        scene_remove(scene, markers[--(*n_markers)]);
     }
 }
 
-// Function to convert the bitmap to a matrix of 0 and 1
-void bmp_to_static(bmpfile_t *bmp, rgb_pixel_t *matrix)
+// Function to log the commands drained per pass of the loop and applied per frame since the last log
+void input_log(INPUT_COUNTERS *counters, const char *timeString)
 {
-    // Convert the bitmap to a matrix
-    for (int i = 0; i < width; i++)
-    {
-        for (int j = 0; j < height; j++)
-        {
-            // Get the pixel from the bitmap
-            rgb_pixel_t *pixel = bmp_get_pixel(bmp, i, j);
-            // Set the pixel in the matrix
-            matrix[i + width * j].alpha = pixel->alpha;
-            matrix[i + width * j].red = pixel->red;
-            matrix[i + width * j].green = pixel->green;
-            matrix[i + width * j].blue = pixel->blue;
-        }
-    }
+    fprintf(logFile, "%s - Input: %lu commands in %lu passes, %.1f per pass, queue depth max %d, %lu passes left some waiting; "
+            "%.2f commands per frame, max %d, over %lu frames\n", timeString, counters->commands, counters->passes,
+            counters->passes > 0 ? (double)counters->commands / counters->passes : 0.0, counters->max_depth, counters->full,
+            counters->frames > 0 ? (double)counters->applied / counters->frames : 0.0, counters->max_applied, counters->frames);
+    int since_frame = counters->since_frame;
+    memset(counters, 0, sizeof(INPUT_COUNTERS));
+    counters->since_frame = since_frame;
 }
 
 int main(int argc, char *argv[])
 {
+    // Names of the log, the snapshot and the shared memory object of the instance of the pipeline passed by master
+    int instance = instance_from_env();
+    char log_path[64], image_path[64], shm_name[64];
+    instance_name("log/processA", ".log", instance, log_path, sizeof(log_path));
+    instance_name("out/image", ".bmp", instance, image_path, sizeof(image_path));
+    instance_name(SHM_NAME, "", instance, shm_name, sizeof(shm_name));
+
     // Open the log file
-    logFile = fopen("log/processA.log", "a");
+    logFile = fopen(log_path, "a");
 
     // Get the current time
     time_t t = time(NULL);
@@ -102,123 +121,160 @@ int main(int argc, char *argv[])
     // Get the modality of the program from the arguments
     int modality = atoi(argv[1]);
 
-    // Data structure for storing the bitmap file
-    bmpfile_t *bmp;
+    // Get the geometry of the image
+    GEOMETRY geometry = geometry_from_env();
+    width = geometry.width;
+    height = geometry.height;
+    scale = geometry.scale;
 
-    // Instantiate bitmap with the given parameters
-    bmp = bmp_create(width, height, depth);
+    // Log the geometry
+    fprintf(logFile, "%s - Image of %dx%d pixels, %d pixels per cell\n", timeString, width, height, scale);
 
-    if (bmp == NULL)
-    {
-        // If the bitmap is not created log and exit
-        fprintf(logFile, "%s - Error while creating bitmap\n", timeString);
-        exit(1);
-    }
+    // Options of the writer of the snapshots
+    int bmp_flags = env_int("ARP_BMP_DIRECT", 0) ? BMP_WRITE_DIRECT : 0;
 
-    // Shared memory name
-    const char *shm_name = "/SHARED_IMAGE";
+    // Get the allocation policy of the shared memory
+    int policy = policy_from_env();
 
-    // Size in bytes of shared memory
-    int SHM_SIZE = width * height * sizeof(rgb_pixel_t);
-
-    // Shared memory file descriptor
-    int shm_fd;
+    // Take over the shared memory object left by a processA that died, keeping its frame, trajectory and readers
+    SHARED_HEADER *header = shared_image_adopt(shm_name, &geometry);
+    int adopted = header != NULL;
+    if (adopted)
+    {
+        // Log the event
+        fprintf(logFile, "%s - Restarted on the shared memory object, generation %u, %u frames published before\n", timeString,
+                header->generation, header->frame_seq / 2);
+    }
+    else
+    {
+        // Another processA still owns the object, which is replaced as before
+        if (errno == EBUSY)
+        {
+            fprintf(logFile, "%s - Another processA owns the shared memory object, creating a new one\n", timeString);
+        }
 
-    // Open the shared memory object
-    if ((shm_fd = shm_open(shm_name, O_CREAT | O_RDWR, 0666)) == -1)
+        // Create the shared memory object and write the geometry in its header
+        header = shared_image_create(shm_name, &geometry, policy);
+    }
+    if (header == NULL)
     {
         // Log the error
-        fprintf(logFile, "%s - Error while opening shared memory object\n", timeString);
-
-        // Destroy the bitmap
-        bmp_destroy(bmp);
+        fprintf(logFile, "%s - Error while creating the shared memory object\n", timeString);
 
         // Exit with error
         exit(errno);
     }
 
-    // Configure the size of the shared memory object
-    if (ftruncate(shm_fd, SHM_SIZE) == -1)
-    {
-        // Log the error
-        fprintf(logFile, "%s - Error while configuring the size of the shared memory object\n", timeString);
-        // Destroy the bitmap
-        bmp_destroy(bmp);
-        // Close the shared memory object
-        shm_unlink(shm_name); // No need to check for errors because it will exit anyway
-        exit(errno);
-    }
+    // Frame and trajectory ring stored in the shared memory
+    rgb_pixel_t *ptr = shared_frame(header);
+    TRAJECTORY_RING *ring = shared_ring(header);
 
-    // Map the shared memory object into the address space of the process
-    rgb_pixel_t *ptr = (rgb_pixel_t *)mmap(0, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
-    {
-        // Log the error
-        fprintf(logFile, "%s - Error while mapping the shared memory object into the address space of the process\n", timeString);
-        // Destroy the bitmap
-        bmp_destroy(bmp);
-        // Close the shared memory object
-        shm_unlink(shm_name); // No need to check for errors because it will exit anyway
-        exit(errno);
-    }
+    // Log the allocation policy, which falls back when huge pages or locked memory are not available
+    char requested[64], effective[64];
+    fprintf(logFile, "%s - Shared memory policy: requested %s, in effect %s\n", timeString,
+            policy_to_string(policy, requested, sizeof(requested)), policy_to_string(header->policy, effective, sizeof(effective)));
 
     // Utility variable to avoid trigger resize event on launch
     int first_resize = TRUE;
 
-    // Initialize UI
-    init_console_ui();
+    // Record the spans of the hot paths, if ARP_TRACE_EVENTS is set
+    trace_events_init("processA");
 
-    // Erase the bitmap
-    erase_bmp(bmp);
+    // Exit cleanly when closed
+    struct sigaction on_quit;
+    memset(&on_quit, 0, sizeof(on_quit));
+    on_quit.sa_handler = request_quit;
+    sigaction(SIGTERM, &on_quit, NULL);
+    sigaction(SIGHUP, &on_quit, NULL);
 
-    // Draw the circle in the middle of the image
-    draw_bmp_circle(bmp, width / 2, height / 2);
+    // Initialize UI
+    init_console_ui();
 
-    // Initialize the semaphore
-    sem_t *sem_sh = sem_open(SEM_PATH, O_CREAT, S_IRUSR | S_IWUSR, 1);
-    if (sem_sh == SEM_FAILED)
+    // Start from the last position published by the previous processA
+    POSITION_EVENT last_position;
+    if (adopted && ring_last(ring, &last_position) && last_position.x > 0 && last_position.x < COLS - BTN_SIZE_X - 2 && last_position.y > 0 && last_position.y + 1 < LINES)
     {
-        // Log the error
-        fprintf(logFile, "%s - Error while initializing the semaphore\n", timeString);    
-        // Destroy the bitmap
-        bmp_destroy(bmp);
-        // Unmap the shared memory object
-        munmap(ptr, SHM_SIZE);
-        // Close the shared memory object
-        shm_unlink(shm_name); // No need to check for errors because it will exit anyway
-        exit(errno);
+        circle.x = last_position.x;
+        circle.y = last_position.y;
     }
 
+    // Publish the initial position of the circle
+    ring_publish(ring, circle.x, circle.y);
+
     bool error = FALSE;
 
-    // Share the initial image
-    // Protect the shared memory with the semaphore
-    if (sem_wait(sem_sh) == -1)
+    // Scene drawn in the frame: the circle, drifting objects added with ARP_SCENE_OBJECTS and a marker per client,
+    // drawn tile by tile on the raster workers
+    SCENE scene;
+    THREAD_POOL pool;
+    rgb_pixel_t circle_color = {255, 0, 0, 0};
+    int scene_error = scene_init(&scene, width, height);
+    int pool_error = pool_create(&pool, env_int("ARP_RASTER_THREADS", pool_size_from_env()));
+    int circle_object = scene_add(&scene, circle.x * scale, circle.y * scale, scale * 3 / 2, circle_color);
+    scene_scatter(&scene, env_int("ARP_SCENE_OBJECTS", 0), scale, 1);
+    int markers[MAX_CLIENTS];
+    int n_markers = 0;
+    if (scene_error == -1 || pool_error == -1 || circle_object == -1)
     {
         // Log the error
-        fprintf(logFile, "%s - Error while locking the semaphore\n", timeString);
+        fprintf(logFile, "%s - Error while creating the scene\n", timeString);
 
         error = TRUE;
         goto cleanup;
     }
 
-    // Convert the bitmap to a matrix
-    bmp_to_static(bmp, ptr);
+    // Log the scene
+    fprintf(logFile, "%s - Scene of %d objects, %d tiles of %d pixels, drawn by %d worker(s)\n", timeString, scene.n_objects,
+            scene.cols * scene.rows, SCENE_TILE, pool.n_workers);
 
-    // Release the semaphore
-    if (sem_post(sem_sh) == -1)
+    // Share the initial image, drawing the whole scene directly in the shared memory
+    frame_write_begin(header);
+    RECT initial = scene_render(&scene, &pool, ptr);
+    if (initial.min_x == -1)
     {
+        frame_write_end(header);
+
         // Log the error
-        fprintf(logFile, "%s - Error while unlocking the semaphore\n", timeString);
+        fprintf(logFile, "%s - Error while binning the objects of the scene\n", timeString);
 
         error = TRUE;
         goto cleanup;
     }
+    header->dirty = initial;
+    pyramid_update(header->pyramid, shared_pyramid(header), ptr, width, height, header->dirty);
+    frame_write_end(header);
 
     // Variables for socket communication
-    int sockfd, newsockfd, portno, clilen, n;
-    struct sockaddr_in serv_addr, cli_addr;
-    struct hostent *server;
+    int sockfd = -1, newsockfd, portno = argc > 2 ? atoi(argv[2]) : 0;
+
+    // Clients connected to the server
+    CLIENT_SET clients;
+
+    // Transport of the commands, chosen with ARP_TRANSPORT
+    int transport = transport_from_env();
+    int udp = transport == TRANSPORT_UDP;
+    int stream = transport_is_stream(transport);
+    UDP_SENDER sender;
+    UDP_RECEIVER receiver;
+    receiver.n_peers = 0;
+    receiver.invalid = 0;
+    receiver.evicted = 0;
+    udp_sender_init(&sender, env_int("ARP_UDP_REDUNDANCY", UDP_DEFAULT_REDUNDANCY));
+
+    // Queue of the commands in shared memory, with the shm transport
+    COMMAND_QUEUE *queue = NULL;
+
+    // Session of the client over a stream transport, reconnected when the server is lost
+    CLIENT_SESSION session;
+    session_init(&session, transport, argc > 3 ? argv[3] : "localhost", portno);
+
+    // Time of the last log of the UDP counters and datagrams received until then
+    uint64_t last_counters_log = 0;
+    unsigned long logged_datagrams = 0;
+
+    // Trace of the keys sent by the client, replayed by arp_loadgen
+    FILE *trace = NULL;
+    uint64_t last_sent = 0;
 
     // Update the time
     t = time(NULL);
@@ -229,40 +285,38 @@ int main(int argc, char *argv[])
     if (modality == 2)
     {
         // Log the event
-        fprintf(logFile, "%s - Server mode\n", timeString);
+        fprintf(logFile, "%s - Server mode over %s\n", timeString, transport_name(transport));
 
-        // Create a socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0)
+        // Create the queue of the commands, or the socket bound to the port
+        if (transport == TRANSPORT_SHM)
         {
-            // Log the error
-            fprintf(logFile, "%s - Error while creating the socket\n", timeString);
+            queue = command_queue_create(portno);
+            if (queue == NULL)
+            {
+                // Log the error
+                fprintf(logFile, "%s - Error while creating the command queue: %s\n", timeString, strerror(errno));
 
-            error = TRUE;
-            goto cleanup;
+                error = TRUE;
+                goto cleanup;
+            }
         }
-
-        // Initialize socket structure
-        bzero((char *)&serv_addr, sizeof(serv_addr));
-        portno = atoi(argv[2]);
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = INADDR_ANY;
-        serv_addr.sin_port = htons(portno);
-
-        // Bind the host address
-        if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        else
         {
-            // Log the error
-            fprintf(logFile, "%s - Error while binding the host address\n", timeString);
+            sockfd = transport_listen(transport, portno);
+            if (sockfd < 0)
+            {
+                // Log the error
+                fprintf(logFile, "%s - Error while opening the server socket: %s\n", timeString, strerror(errno));
 
-            error = TRUE;
-            goto cleanup;
+                error = TRUE;
+                goto cleanup;
+            }
         }
+    }
 
-        // Start listening for the client
-        listen(sockfd, 5);
-        clilen = sizeof(cli_addr);
-
+    // If the modality is server over a stream socket, wait for the first client
+    if (modality == 2 && stream)
+    {
         // Update the time
         t = time(NULL);
         timeString = ctime(&t);
@@ -271,8 +325,9 @@ int main(int argc, char *argv[])
         // Log the event
         fprintf(logFile, "%s - Waiting for client connection\n", timeString);
 
-        // Accept connection from the client
-        newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
+        // Accept connection from the first client, the others are accepted while running
+        clients_init(&clients, sockfd);
+        newsockfd = clients_accept(&clients);
         if (newsockfd < 0)
         {
             // Log the error
@@ -289,71 +344,99 @@ int main(int argc, char *argv[])
 
         // Log the event
         fprintf(logFile, "%s - Client connected\n", timeString);
+        sync_client_markers(&scene, &clients, markers, &n_markers);
     }
     // If modality is client
     else if (modality == 3)
     {
         // Log the event
-        fprintf(logFile, "%s - Client mode\n", timeString);
+        fprintf(logFile, "%s - Client mode over %s\n", timeString, transport_name(transport));
 
-        // Create a socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0)
-        {
-            // Log the error
-            fprintf(logFile, "%s - Error while creating the socket\n", timeString);
+        // Log the event
+        fprintf(logFile, "%s - Connecting to the server\n", timeString);
 
-            error = TRUE;
-            goto cleanup;
+        // Attach to the queue of the commands, or connect to the server
+        if (transport == TRANSPORT_SHM)
+        {
+            queue = command_queue_open(portno);
         }
-
-        // Get the host name
-        server = gethostbyname(argv[3]);
-        if (server == NULL)
+        else if (stream)
+        {
+            if (session_open(&session, monotonic_ns()) != -1)
+            {
+                sockfd = session.fd;
+            }
+        }
+        else
+        {
+            sockfd = transport_connect(transport, argv[3], portno);
+        }
+        if (queue == NULL && sockfd < 0)
         {
             // Log the error
-            fprintf(logFile, "%s - Error while getting the host name\n", timeString);
+            fprintf(logFile, "%s - Error while connecting to the server: %s\n", timeString, strerror(errno));
 
             error = TRUE;
             goto cleanup;
         }
 
-        // Initialize socket structure
-        bzero((char *)&serv_addr, sizeof(serv_addr));
-        portno = atoi(argv[2]);
-        serv_addr.sin_family = AF_INET;
-        bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-        serv_addr.sin_port = htons(portno);
-
         // Update the time
         t = time(NULL);
         timeString = ctime(&t);
         timeString[strlen(timeString) - 1] = '\0';
 
         // Log the event
-        fprintf(logFile, "%s - Connecting to the server\n", timeString);
+        fprintf(logFile, "%s - Connected to the server\n", timeString);
 
-        // Connect to the server
-        if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        // Record the keys sent in a trace, if requested
+        if (getenv("ARP_TRACE") != NULL)
         {
-            // Log the error
-            fprintf(logFile, "%s - Error while connecting to the server\n", timeString);
-
-            error = TRUE;
-            goto cleanup;
+            trace = fopen(getenv("ARP_TRACE"), "w");
+            if (trace == NULL)
+            {
+                // Log the error
+                fprintf(logFile, "%s - Error while opening the trace file\n", timeString);
+            }
         }
+    }
 
-        // Update the time
-        t = time(NULL);
-        timeString = ctime(&t);
-        timeString[strlen(timeString) - 1] = '\0';
+    // Renderer of the window, with the print button drawn over it
+    RENDERER renderer;
+    renderer_init(&renderer, env_int("ARP_MAX_FPS", DEFAULT_MAX_FPS), &print_btn);
 
-        // Log the event
-        fprintf(logFile, "%s - Connected to the server\n", timeString);
+    // Start the fixed timestep simulation moving the circle
+    SIMULATION sim;
+    if (simulation_init(&sim, env_int("ARP_TICK_HZ", DEFAULT_TICK_HZ), env_int("ARP_SPEED", DEFAULT_SPEED)) == -1)
+    {
+        // Log the error
+        fprintf(logFile, "%s - Error while starting the simulation timer\n", timeString);
+
+        error = TRUE;
+        goto cleanup;
     }
 
-    // Variable to store the key to send or received
-    char key[4];
+    // Body followed by the circle
+    BODY body;
+    body_set(&body, circle.x, circle.y);
+
+    // Last time the readers of the frame were logged
+    uint64_t readers_logged = monotonic_ns();
+
+    // Time at which the message on the status line is cleared, 0 if there is none
+    uint64_t status_until = 0;
+
+    // Counters of the commands drained and applied by the server
+    INPUT_COUNTERS input = {0};
+
+    // Input to show in the next frame, and number of the keys pressed on this window
+    FRAME_TRACE frame_trace = {0};
+    uint32_t local_inputs = 0;
+
+    // Start from the position of the circle on the server
+    if (modality == 3 && stream)
+    {
+        body_set(&body, session.x, session.y);
+    }
 
     // Infinite loop
     while (TRUE)
@@ -363,10 +446,75 @@ int main(int argc, char *argv[])
         timeString = ctime(&t);
         timeString[strlen(timeString) - 1] = '\0';
 
-        mvprintw(LINES - 1, 1, "Press q to quit");
+        // Write the changes of the previous pass to the terminal, at most once per tick
+        renderer_update(&renderer);
+
+        // Write the spans recorded so far when the buffer is half full
+        trace_events_flush(0);
+
+        // The connection of the session may have been lost while sending
+        if (modality == 3 && stream)
+        {
+            sockfd = session.fd;
+        }
+
+        // Wait for the keyboard, the client or the next tick of the simulation
+        fd_set watched;
+        FD_ZERO(&watched);
+        FD_SET(STDIN_FILENO, &watched);
+        FD_SET(sim.timer_fd, &watched);
+        int maxfd = sim.timer_fd;
+        if (modality == 2 && stream)
+        {
+            maxfd = clients_fdset(&clients, &watched, maxfd);
+        }
+        else if (modality != 1 && sockfd != -1)
+        {
+            FD_SET(sockfd, &watched);
+            maxfd = sockfd > maxfd ? sockfd : maxfd;
+        }
+
+        // While the session reconnects, the end of the handshake makes its socket writable
+        fd_set writefds;
+        FD_ZERO(&writefds);
+        if (modality == 3 && stream && session_wants_write(&session))
+        {
+            FD_SET(sockfd, &writefds);
+        }
+
+        fd_set readfds = watched;
+        int ready;
+        if (modality == 2 && queue != NULL)
+        {
+            // The commands of the queue do not wake select: sleep on the queue until the next tick instead
+            struct timeval no_wait = {0, 0};
+            ready = select(maxfd + 1, &readfds, NULL, NULL, &no_wait);
+            if (ready == 0 && command_ring_empty(&queue->commands))
+            {
+                command_ring_wait(&queue->commands, simulation_next_tick(&sim));
+
+                // Check the keyboard and the timer again
+                readfds = watched;
+                ready = select(maxfd + 1, &readfds, NULL, NULL, &no_wait);
+            }
+        }
+        else
+        {
+            ready = select(maxfd + 1, &readfds, &writefds, NULL, NULL);
+        }
+
+        // If error occurred
+        if (ready == -1 && errno != EINTR)
+        {
+            // Log the error
+            fprintf(logFile, "%s - Error while waiting for the input\n", timeString);
+
+            error = TRUE;
+            break;
+        }
 
         // Get input in non-blocking mode
-        int cmd = getch();
+        int cmd = renderer_getch(&renderer);
 
         // If user resizes screen, re-draw UI...
         if (cmd == KEY_RESIZE)
@@ -378,11 +526,17 @@ int main(int argc, char *argv[])
             else
             {
                 reset_console_ui();
+
+                // The circle is back in the middle of the window
+                body_set(&body, circle.x, circle.y);
+                ring_publish(ring, circle.x, circle.y);
+                scene_move(&scene, circle_object, circle.x * scale, circle.y * scale);
+                renderer_damage(&renderer);
             }
         }
 
-        // If the user pressed q, exit
-        if (cmd == 'q'){
+        // If the user pressed q, or processA was closed, exit
+        if (cmd == 'q' || quit_requested){
             // Log the event
             fprintf(logFile, "%s - Quitting\n", timeString);
 
@@ -392,30 +546,34 @@ int main(int argc, char *argv[])
         // If the modality is server
         if (modality == 2)
         {
-            // Initialize the select function variables
-            fd_set readfds;
-            FD_ZERO(&readfds);
-            FD_SET(newsockfd, &readfds);
-            int maxfd = newsockfd + 1;
-            struct timeval timeout = {0, 1000};
-
-            // Wait for the client to send a byte
-            int ready = select(maxfd, &readfds, NULL, NULL, &timeout);
-
-            // If error occurred
-            if (ready == -1 && errno != EINTR)
+            // Commands received in this pass, with the socket of their client and their sequence number in its session
+            int pending[MAX_PENDING];
+            int pending_fd[MAX_PENDING];
+            uint32_t pending_seq[MAX_PENDING];
+            // Stamps of the commands, only the stream transports carry the identifier and the send time
+            INPUT_STAMP pending_stamp[MAX_PENDING];
+            int n_pending = 0;
+            // Set when commands are still waiting at the end of the drain, they are read in the next pass
+            int full = FALSE;
+
+            // If the clients sent datagrams, read the new commands of all the datagrams waiting
+            if (udp && ready > 0 && FD_ISSET(sockfd, &readfds))
             {
-                // Log the error
-                fprintf(logFile, "%s - Error while waiting for the client input\n", timeString);
+                int received;
+                do
+                {
+                    uint64_t span = span_begin();
+                    received = udp_receive(&receiver, sockfd, pending + n_pending);
+                    span_end("socket_read", span);
+                    for (int k = 0; k < received; k++, n_pending++)
+                    {
+                        pending_fd[n_pending] = -1;
+                        pending_stamp[n_pending] = (INPUT_STAMP){0, 0, monotonic_ns()};
+                    }
+                }
+                while (received != -1 && n_pending + UDP_MAX_REDUNDANCY <= MAX_PENDING && transport_pending(sockfd) > 0);
 
-                error = TRUE;
-                break;
-            }
-            // If the client sent a byte
-            else if (ready > 0)
-            {
-                // Read the byte
-                if (read(newsockfd, &key, 4) < 0)
+                if (received == -1)
                 {
                     // Log the error
                     fprintf(logFile, "%s - Error while reading the client input\n", timeString);
@@ -423,54 +581,131 @@ int main(int argc, char *argv[])
                     error = TRUE;
                     break;
                 }
+                full = transport_pending(sockfd) > 0;
+            }
 
-                // Convert the read string to a integer
-                int byte = atoi(key);
+            // Read all the commands of the queue, acking each of them
+            int byte;
+            while (queue != NULL && n_pending < MAX_PENDING && command_ring_receive(&queue->commands, &byte))
+            {
+                pending_fd[n_pending] = -1;
+                pending_stamp[n_pending] = (INPUT_STAMP){0, 0, monotonic_ns()};
+                pending[n_pending++] = byte;
+                command_ring_send(&queue->acks, byte);
+            }
+            full = full || (queue != NULL && !command_ring_empty(&queue->commands));
 
-                // If the byte is an arrow key
-                if (byte == KEY_LEFT || byte == KEY_RIGHT || byte == KEY_UP || byte == KEY_DOWN)
+            // If a new client is connecting
+            if (stream && ready > 0 && FD_ISSET(sockfd, &readfds))
+            {
+                if (clients_accept(&clients) < 0)
+                {
+                    // Log the error
+                    fprintf(logFile, "%s - Error while accepting connection from the client\n", timeString);
+                }
+                else
                 {
-                    // Update the time
-                    t = time(NULL);
-                    timeString = ctime(&t);
-                    timeString[strlen(timeString) - 1] = '\0';
-
                     // Log the event
-                    fprintf(logFile, "%s - Received arrow key\n", timeString);
+                    fprintf(logFile, "%s - Client connected, %d clients\n", timeString, clients.n_clients);
+                }
+                sync_client_markers(&scene, &clients, markers, &n_markers);
+            }
+
+            // Read all the messages waiting from the clients, backwards since a closed client is replaced by the last one
+            for (int i = stream ? clients.n_clients - 1 : -1; ready > 0 && i >= 0; i--)
+            {
+                if (!FD_ISSET(clients.clients[i].fd, &readfds))
+                {
+                    continue;
+                }
 
-                    // Move the circle
-                    move_circle(byte);
-                    draw_circle();
+                // Once the commands of the pass are full, the clients left are drained in the next pass
+                if (n_pending == MAX_PENDING)
+                {
+                    full = TRUE;
+                    break;
+                }
+
+                // The first read is the one select reported, the next ones only read bytes already received
+                int received = CLIENT_PARTIAL;
+                int first_read = TRUE;
+                while (n_pending < MAX_PENDING && (first_read || transport_pending(clients.clients[i].fd) > 0))
+                {
+                    first_read = FALSE;
+                    uint64_t span = span_begin();
+                    received = clients_receive(&clients, i, &byte);
+                    span_end("socket_read", span);
 
-                    // Protect the shared memory with the semaphore
-                    if (sem_wait(sem_sh) == -1)
+                    // If the client closed the connection
+                    if (received == CLIENT_CLOSED)
                     {
-                        // Log the error
-                        fprintf(logFile, "%s - Error while taking the semaphore\n", timeString);
+                        clients_remove(&clients, i);
+                        sync_client_markers(&scene, &clients, markers, &n_markers);
 
-                        error = TRUE;
+                        // Log the event
+                        fprintf(logFile, "%s - Client disconnected, %d clients\n", timeString, clients.n_clients);
                         break;
                     }
 
-                    // Erase previous circle
-                    erase_bmp(bmp);
-
-                    // Draw the circle on the bitmap in the new position
-                    draw_bmp_circle(bmp, circle.x, circle.y);
+                    // If the client opened a session, send it the position of the circle to start from
+                    if (received == CLIENT_HELLO)
+                    {
+                        SESSION *opened = &clients.sessions[clients.clients[i].session];
+                        clients_welcome(&clients, i, circle.x, circle.y);
 
-                    // Convert the bitmap to a matrix
-                    bmp_to_static(bmp, ptr);
+                        // Log the event
+                        fprintf(logFile, "%s - Client in session %08x, %u commands applied\n", timeString, opened->token, opened->applied);
+                    }
 
-                    // Release the semaphore
-                    if (sem_post(sem_sh) == -1)
+                    // If the command is complete, it is applied and acked below in this pass; a heartbeat is acked with the current state
+                    if (received == CLIENT_COMMAND && byte != HEARTBEAT_KEY)
                     {
-                        // Log the error
-                        fprintf(logFile, "%s - Error while releasing the semaphore\n", timeString);
-
-                        error = TRUE;
-                        break;
+                        pending_fd[n_pending] = clients.clients[i].fd;
+                        pending_seq[n_pending] = clients_applied(&clients, i);
+                        clients_stamp(&clients, i, monotonic_ns(), &pending_stamp[n_pending]);
+                        pending[n_pending++] = byte;
+                    }
+                    else if (received == CLIENT_COMMAND)
+                    {
+                        clients_reply(&clients, i, byte, clients_applied(&clients, i), (int)round(body.x), (int)round(body.y));
                     }
                 }
+
+                full = full || (received != CLIENT_CLOSED && transport_pending(clients.clients[i].fd) > 0);
+            }
+
+            // Count the commands found waiting in this pass, the depth of the queues of all the sources
+            if (n_pending > 0)
+            {
+                input.passes++;
+                input.commands += n_pending;
+                input.max_depth = n_pending > input.max_depth ? n_pending : input.max_depth;
+                input.full += full;
+            }
+
+            // Drop the clients whose heartbeats stopped
+            for (int i = stream ? clients_expired(&clients, monotonic_ns()) : -1; i != -1; i = clients_expired(&clients, monotonic_ns()))
+            {
+                clients_remove(&clients, i);
+                sync_client_markers(&scene, &clients, markers, &n_markers);
+
+                // Log the event
+                fprintf(logFile, "%s - Client silent for too long, disconnected, %d clients\n", timeString, clients.n_clients);
+            }
+
+            // Apply the commands received
+            for (int k = 0; k < n_pending; k++)
+            {
+                int byte = pending[k];
+                input.since_frame++;
+
+                // If the byte is an arrow key
+                if (byte == KEY_LEFT || byte == KEY_RIGHT || byte == KEY_UP || byte == KEY_DOWN)
+                {
+                    // Apply the key to the simulation, the circle moves on the next tick
+                    press_key(&sim, &body, byte);
+                    trace_input(&frame_trace, &pending_stamp[k]);
+                }
                 // If the byte is the mouse key
                 else if (byte == KEY_MOUSE)
                 {
@@ -479,25 +714,118 @@ int main(int argc, char *argv[])
                     timeString = ctime(&t);
                     timeString[strlen(timeString) - 1] = '\0';
 
-                    // Save the image as .bmp file
-                    bmp_save(bmp, "out/image.bmp");
-
-                    // Print that the image was saved
-                    mvprintw(LINES - 1, 1, "Image saved succesfully!");
-                    refresh();
-                    sleep(1);
-                    for (int j = 0; j < COLS - BTN_SIZE_X - 2; j++)
+                    // Save the image as .bmp file, straight from the shared memory
+                    int flags = bmp_flags;
+                    uint64_t span = span_begin();
+                    int saved = bmp_write(image_path, ptr, width, height, &flags);
+                    span_end("bmp_write", span);
+                    if (saved == -1)
                     {
-                        mvaddch(LINES - 1, j, ' ');
+                        // Log the error
+                        fprintf(logFile, "%s - Error while saving the picture\n", timeString);
+                    }
+                    else if (flags != bmp_flags)
+                    {
+                        // Log the event
+                        fprintf(logFile, "%s - Direct I/O not supported in out/, picture saved through the page cache\n", timeString);
                     }
 
+                    // Print that the image was saved, the tick loop clears it once STATUS_NS have passed
+                    mvprintw(LINES - 1, 1, "Image saved succesfully!");
+                    renderer_damage(&renderer);
+                    status_until = monotonic_ns() + STATUS_NS;
+
                     // Log the event
                     fprintf(logFile, "%s - Picture saved\n", timeString);
                 }
+
+                // Ack the command to its client with the resulting position, unless it disconnected meanwhile
+                int i = pending_fd[k] == -1 ? -1 : clients_find(&clients, pending_fd[k]);
+                if (i != -1)
+                {
+                    clients_reply(&clients, i, byte, pending_seq[k], (int)round(body.x), (int)round(body.y));
+                }
+            }
+
+            // Log the counters of the UDP clients every 10 seconds, if they changed
+            uint64_t now = monotonic_ns();
+            unsigned long datagrams = 0;
+            for (int i = 0; i < receiver.n_peers; i++)
+            {
+                datagrams += receiver.peers[i].datagrams;
+            }
+            if (udp && datagrams != logged_datagrams && now - last_counters_log > 10000000000ULL)
+            {
+                udp_log_counters(&receiver, logFile, timeString);
+                last_counters_log = now;
+                logged_datagrams = datagrams;
             }
         }
         else
         {
+            // Read the acks of the server, sending the last commands again if they are late
+            if (modality == 3 && udp)
+            {
+                while (ready > 0 && FD_ISSET(sockfd, &readfds) && udp_sender_receive(&sender, sockfd) == 1)
+                {
+                    // Only the newest ack matters
+                }
+                udp_sender_poll(&sender, sockfd, monotonic_ns());
+            }
+
+            // Discard the acks of the server
+            int ack;
+            while (modality == 3 && queue != NULL && command_ring_receive(&queue->acks, &ack))
+            {
+                // The acks are only used by arp_loadgen
+            }
+
+            // Keep the session alive, reconnecting when the server is lost
+            if (modality == 3 && stream)
+            {
+                uint64_t now = monotonic_ns();
+                int event = SESSION_IDLE;
+                if (sockfd != -1 && ready > 0 && (FD_ISSET(sockfd, &readfds) || FD_ISSET(sockfd, &writefds)))
+                {
+                    uint64_t span = span_begin();
+                    event = session_receive(&session, now);
+                    span_end("socket_read", span);
+                }
+                if (event != SESSION_LOST)
+                {
+                    int polled = session_poll(&session, now);
+                    event = polled != SESSION_IDLE ? polled : event;
+                }
+                sockfd = session.fd;
+
+                if (event == SESSION_LOST)
+                {
+                    // Log the event
+                    fprintf(logFile, "%s - Connection to the server lost, reconnecting\n", timeString);
+                }
+                else if (event == SESSION_OPENED || event == SESSION_RESUMED)
+                {
+                    // A new session continues from the position of the circle on the server, a resumed one is reconciled below
+                    if (event == SESSION_OPENED)
+                    {
+                        body_set(&body, session.x, session.y);
+                    }
+
+                    // Log the event
+                    fprintf(logFile, "%s - Reconnected to the server, session %08x %s, %lu commands sent again\n", timeString,
+                            session.token, event == SESSION_RESUMED ? "resumed" : "opened", session.resent);
+                }
+
+                // Move the predicted circle where the server put it
+                int dx, dy;
+                int at_rest = body.vx == 0 && body.vy == 0 && now - body.last_press > RECONCILE_QUIET_NS;
+                if (session_reconcile(&session, (int)round(body.x), (int)round(body.y), at_rest, &dx, &dy))
+                {
+                    body.x += dx;
+                    body.y += dy;
+                }
+            }
+
             // Else, if user presses print button...
             if (cmd == KEY_MOUSE)
             {
@@ -508,9 +836,13 @@ int main(int argc, char *argv[])
                         // If the modality is client
                         if (modality == 3)
                         {
-                            // Send the print key
-                            sprintf(key, "%d", KEY_MOUSE);
-                            if (write(sockfd, &key, 4) < 0)
+                            // Send the print key, kept until the session is resumed if the connection is down
+                            if (stream && session_send_key(&session, KEY_MOUSE, (int)round(body.x), (int)round(body.y), monotonic_ns()) == SESSION_LOST)
+                            {
+                                // Log the event
+                                fprintf(logFile, "%s - Connection to the server lost, reconnecting\n", timeString);
+                            }
+                            else if (!stream && transport_send_key(transport, sockfd, &sender, queue, KEY_MOUSE) < 0)
                             {
                                 // Log the error
                                 fprintf(logFile, "%s - Error while sending the print key\n", timeString);
@@ -523,18 +855,27 @@ int main(int argc, char *argv[])
                             fprintf(logFile, "%s - Print command sent\n", timeString);
                         }
 
-                        // Save the image as .bmp file
-                        bmp_save(bmp, "out/image.bmp");
-
-                        // Print that the image was saved
-                        mvprintw(LINES - 1, 1, "Image saved succesfully!");
-                        refresh();
-                        sleep(1);
-                        for (int j = 0; j < COLS - BTN_SIZE_X - 2; j++)
+                        // Save the image as .bmp file, straight from the shared memory
+                        int flags = bmp_flags;
+                        uint64_t span = span_begin();
+                        int saved = bmp_write(image_path, ptr, width, height, &flags);
+                        span_end("bmp_write", span);
+                        if (saved == -1)
                         {
-                            mvaddch(LINES - 1, j, ' ');
+                            // Log the error
+                            fprintf(logFile, "%s - Error while saving the picture\n", timeString);
+                        }
+                        else if (flags != bmp_flags)
+                        {
+                            // Log the event
+                            fprintf(logFile, "%s - Direct I/O not supported in out/, picture saved through the page cache\n", timeString);
                         }
 
+                        // Print that the image was saved, the tick loop clears it once STATUS_NS have passed
+                        mvprintw(LINES - 1, 1, "Image saved succesfully!");
+                        renderer_damage(&renderer);
+                        status_until = monotonic_ns() + STATUS_NS;
+
                         // Update the time
                         t = time(NULL);
                         timeString = ctime(&t);
@@ -554,17 +895,30 @@ int main(int argc, char *argv[])
                 timeString = ctime(&t);
                 timeString[strlen(timeString) - 1] = '\0';
 
-                move_circle(cmd);
-                draw_circle();
+                // Apply the key to the simulation, the circle moves on the next tick
+                press_key(&sim, &body, cmd);
+                INPUT_STAMP stamp = {++local_inputs, 0, monotonic_ns()};
+                stamp.sent = stamp.received;
+                trace_input(&frame_trace, &stamp);
 
                 // If the modality is client
                 if (modality == 3)
                 {
-                    // Convert the arrow key to a string
-                    sprintf(key, "%d", cmd);
+                    // Record the key with the time elapsed since the previous one
+                    if (trace != NULL)
+                    {
+                        uint64_t sent = monotonic_ns();
+                        fprintf(trace, "%llu %d\n", last_sent == 0 ? 0ULL : (unsigned long long)((sent - last_sent) / 1000000), cmd);
+                        last_sent = sent;
+                    }
 
-                    // Send the byte to the server
-                    if (write(sockfd, key, 4) < 0)
+                    // Send the byte to the server, kept until the session is resumed if the connection is down
+                    if (stream && session_send_key(&session, cmd, (int)round(body.x), (int)round(body.y), monotonic_ns()) == SESSION_LOST)
+                    {
+                        // Log the event
+                        fprintf(logFile, "%s - Connection to the server lost, reconnecting\n", timeString);
+                    }
+                    else if (!stream && transport_send_key(transport, sockfd, &sender, queue, cmd) < 0)
                     {
                         // Log the error
                         fprintf(logFile, "%s - Error while sending the arrow key\n", timeString);
@@ -573,48 +927,172 @@ int main(int argc, char *argv[])
                         break;
                     }
                 }
+            }
+        }
 
-                // Protect the shared memory with the semaphore
-                if (sem_wait(sem_sh) == -1)
-                {
-                    // Log the error
-                    fprintf(logFile, "%s - Error while taking the semaphore\n", timeString);
-                    error = TRUE;
-                    break;
-                }
+        // Advance the simulation by the elapsed ticks, publishing at most one frame per tick
+        int ticks = simulation_ticks(&sim);
+        if (ticks > 0)
+        {
+            body_advance(&sim, &body, ticks, monotonic_ns());
 
-                // Erase previous circle
-                erase_bmp(bmp);
+            int circle_moved = follow_body(&body);
+            if (circle_moved)
+            {
+                draw_circle();
 
-                // Draw the circle on the bitmap in the new position
-                draw_bmp_circle(bmp, circle.x, circle.y);
+                // Publish the new position in the trajectory ring
+                ring_publish(ring, circle.x, circle.y);
+                renderer_damage(&renderer);
+
+                // Move the circle of the scene
+                scene_move(&scene, circle_object, circle.x * scale, circle.y * scale);
+            }
 
-                // Convert the bitmap to a matrix
-                bmp_to_static(bmp, ptr);
+            // Move the drifting objects
+            scene_advance(&scene, ticks);
 
-                // Release the semaphore
-                if (sem_post(sem_sh) == -1)
+            // Publish a frame if an object moved, appeared or disappeared
+            if (scene.pending)
+            {
+                // Redraw the dirty tiles of the frame, the readers copying it meanwhile start again
+                uint64_t publish_span = span_begin();
+                frame_write_begin(header);
+                uint64_t drawn = monotonic_ns();
+
+                // Only the pixels of the dirty tiles change
+                uint64_t span = span_begin();
+                RECT changed = scene_render(&scene, &pool, ptr);
+                span_end("scene_render", span);
+                if (changed.min_x == -1)
                 {
+                    frame_write_end(header);
+
                     // Log the error
-                    fprintf(logFile, "%s - Error while releasing the semaphore\n", timeString);
+                    fprintf(logFile, "%s - Error while binning the objects of the scene\n", timeString);
 
                     error = TRUE;
                     break;
                 }
+                header->dirty = changed;
+
+                // Update the occupancy pyramid over the same pixels, for the readers searching it
+                span = span_begin();
+                pyramid_update(header->pyramid, shared_pyramid(header), ptr, width, height, header->dirty);
+                span_end("pyramid_update", span);
+
+                // A frame moving the circle shows the oldest input not shown yet, if it is recent enough to have moved it
+                header->trace = frame_trace;
+                header->trace.traced = circle_moved && frame_trace.traced && drawn - frame_trace.received < TRACE_STALE_NS;
+                header->trace.drawn = drawn;
+                header->trace.published = monotonic_ns();
+                frame_write_end(header);
+                span_end("publish", publish_span);
+                if (circle_moved)
+                {
+                    frame_trace.traced = 0;
+                }
+
+                // All the commands applied since the previous frame are shown by this one
+                input.frames++;
+                input.applied += input.since_frame;
+                input.max_applied = input.since_frame > input.max_applied ? input.since_frame : input.max_applied;
+                input.since_frame = 0;
+            }
+
+            // Clear the message on the status line once it was shown long enough
+            if (status_until != 0 && monotonic_ns() >= status_until)
+            {
+                for (int j = 0; j < COLS - BTN_SIZE_X - 2; j++)
+                {
+                    mvaddch(LINES - 1, j, ' ');
+                }
+                draw_help();
+                renderer_damage(&renderer);
+                status_until = 0;
+            }
+
+            // Log how many frames each reader is behind, and the time spent drawing the scene
+            if (monotonic_ns() - readers_logged > READERS_LOG_NS)
+            {
+                readers_log(header, logFile, timeString);
+                scene_log(&scene, logFile, timeString);
+                if (modality == 2)
+                {
+                    input_log(&input, timeString);
+                }
+                readers_logged = monotonic_ns();
             }
         }
     }
 
+    // Stop the simulation timer
+    simulation_destroy(&sim);
+
+    // Log the time spent drawing the scene and the commands drained since the last log
+    scene_log(&scene, logFile, timeString);
+    if (modality == 2)
+    {
+        input_log(&input, timeString);
+    }
+
+    // Log the counters of the UDP transport
+    if (udp && modality == 2)
+    {
+        udp_log_counters(&receiver, logFile, timeString);
+    }
+    else if (udp && modality == 3)
+    {
+        fprintf(logFile, "%s - UDP: %lu commands, %lu datagrams sent, %lu sent again for a late ack\n", timeString,
+                (unsigned long)sender.seq, sender.sent, sender.resent);
+    }
+    else if (stream && modality == 3)
+    {
+        fprintf(logFile, "%s - Session %08x: %lu reconnections, %lu commands sent again, %lu lost, %lu corrections from the server\n",
+                timeString, session.token, session.reconnects, session.resent, session.lost, session.corrections);
+    }
+
+    // Close the trace of the keys sent
+    if (trace != NULL)
+    {
+        fclose(trace);
+    }
+
+    // Detach from the queue of the commands, the server removes it
+    if (queue != NULL && modality == 2)
+    {
+        command_queue_destroy(queue, portno);
+    }
+    else if (queue != NULL)
+    {
+        command_queue_close(queue);
+    }
+
+    // Remove the Unix domain socket of the server
+    if (transport == TRANSPORT_UNIX && modality == 2)
+    {
+        char path[108];
+        transport_unix_path(portno, path, sizeof(path));
+        unlink(path);
+    }
+
 cleanup:
 
     // Store the errno
     int err_no = errno;
 
-    // Free the bitmap
-    bmp_destroy(bmp);
+    // Stop the raster workers and free the scene
+    pool_destroy(&pool);
+    scene_destroy(&scene);
+
+    // Write the last spans
+    trace_events_close();
+
+    // Give up the ownership of the shared memory object, which is removed below
+    shared_owner_release(header);
 
     // Unmap the shared memory object
-    if (munmap(ptr, SHM_SIZE) == -1)
+    if (shared_image_detach(header) == -1)
     {
         // Log the error
         fprintf(logFile, "%s - Error while unmapping the shared memory\n", timeString);
@@ -623,7 +1101,7 @@ cleanup:
     }
 
     // Close the shared memory object
-    if (shm_unlink(shm_name) == -1)
+    if (shared_image_unlink(shm_name) == -1)
     {
         // Log the error
         fprintf(logFile, "%s - Error while closing the shared memory\n", timeString);
@@ -1,185 +1,299 @@
 #include "./../include/processB_utilities.h"
-#include <bmpfile.h>
+#include "./../include/shared_image.h"
+#include "./../include/blob_detection.h"
+#include "./../include/thread_pool.h"
+#include "./../include/ui_renderer.h"
+#include "./../include/trace_events.h"
+#include "./../include/instance.h"
 #include <fcntl.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
-#include <semaphore.h>
 #include <errno.h>
+#include <signal.h>
 
-#define SEM_PATH "/sem_SHARED_IMAGE"
-
-// Dimensions of the image
-const int width = 1600;
-const int height = 600;
-const int depth = 4;
+// Dimensions of the image and pixels per cell of the processA window, read from the shared memory
+int width;
+int height;
+int scale;
 
 // Log file
 FILE *logFile;
 
-// Function to erase all the bitmap
-void erase_bmp(bmpfile_t *bmp)
+// Set by SIGUSR1 to write the latency histograms in the log
+volatile sig_atomic_t dump_latency = 0;
+
+// Set by SIGTERM and SIGHUP to exit the main loop, writing the histograms and the spans
+volatile sig_atomic_t quit_requested = 0;
+
+// Typedef for the data shared by the workers processing the image in horizontal stripes
+typedef struct {
+    // Frame in the shared memory and private snapshot of it
+    const rgb_pixel_t *shared;
+    rgb_pixel_t *snapshot;
+    // Frame to scan, either the shared one or the snapshot
+    const rgb_pixel_t *frame;
+    // One labeller and one result per stripe
+    LABELLER *labellers;
+    int *results;
+}STRIPE_JOB;
+
+// Worker task copying one stripe of the shared memory into the snapshot
+void copy_stripe(void *arg, int index, int n_workers)
 {
+    STRIPE_JOB *job = (STRIPE_JOB *)arg;
+    int y_start, y_end;
+    stripe_rows(height, index, n_workers, &y_start, &y_end);
+
+    uint64_t span = span_begin();
+    size_t offset = (size_t)y_start * width;
+    frame_copy(job->snapshot + offset, job->shared + offset, (size_t)(y_end - y_start) * width);
+    span_end("copy_stripe", span);
+}
 
-    // Data type for defining pixel colors (BGRA)
-    rgb_pixel_t pixel = {0, 0, 0, 0};
+// Worker task labelling the components of one stripe of the frame
+void label_stripe(void *arg, int index, int n_workers)
+{
+    STRIPE_JOB *job = (STRIPE_JOB *)arg;
+    int y_start, y_end;
+    stripe_rows(height, index, n_workers, &y_start, &y_end);
 
-    // Erase the bitmap
-    for (int i = 0; i < width; i++)
-    {
-        for (int j = 0; j < height; j++)
-        {
-            bmp_set_pixel(bmp, i, j, pixel);
-        }
-    }
+    uint64_t span = span_begin();
+    job->results[index] = label_frame_rows(job->frame, width, &job->labellers[index], y_start, y_end);
+    span_end("label_stripe", span);
 }
 
-// Function to convert the matrix of 0 and 1 to a bitmap
-void static_to_bmp(rgb_pixel_t *matrix, bmpfile_t *bmp)
+// Function to label all the connected non-black components of the frame, one stripe per worker
+int find_blobs(THREAD_POOL *pool, STRIPE_JOB *job, LABELLER *lab, BLOB *blobs)
 {
-    // Loop through the matrix
-    for (int i = 0; i < width; i++)
+    // Label each stripe in parallel
+    pool_run(pool, label_stripe, job);
+
+    for (int k = 0; k < pool->n_workers; k++)
     {
-        for (int j = 0; j < height; j++)
+        if (job->results[k] == -1)
         {
-            // Get the pixel from the matrix
-            rgb_pixel_t pixel = matrix[i + width * j];
-            // Set the pixel in the bitmap
-            bmp_set_pixel(bmp, i, j, pixel);
+            return -1;
         }
     }
-}
 
-// Function to find center of the cirlce in the bitmap
-void find_center(bmpfile_t *bmp, int *x, int *y)
-{
-    // Variable to store the length of the current circumference rope
-    int length = 0;
+    // Join the components crossing the stripe boundaries
+    if (labeller_merge(lab, job->labellers, pool->n_workers) == -1)
+    {
+        return -1;
+    }
 
-    // Variable to store the length of the longest circumference rope
-    int max_length = 0;
+    // Collect centroid, bounding box and area of each component
+    return labeller_collect(lab, blobs, MAX_BLOBS);
+}
 
-    // Cycle through the bitmap
-    for (int i = 0; i < width; i++)
+/*
+ * Function to find the objects with the integral image of the frame. The table is only updated over
+ * the rectangle that changed if the frame follows the one it was computed from, built again otherwise
+ */
+int find_blobs_integral(INTEGRAL_IMAGE *sat, const rgb_pixel_t *frame, uint32_t seq, RECT dirty, BLOB *blobs)
+{
+    uint64_t span = span_begin();
+    if (sat->valid && seq == sat->seq + 2)
     {
-        for (int j = 0; j < height; j++)
-        {
-            // Get the pixel at the specified (x,y) position
-            // Data type for defining pixel
-            rgb_pixel_t *pixel = bmp_get_pixel(bmp, i, j);
+        integral_update(sat, frame, dirty);
+        span_end("integral_update", span);
+    }
+    else
+    {
+        integral_build(sat, frame);
+        span_end("integral_build", span);
+    }
+    sat->seq = seq;
+    sat->valid = TRUE;
 
-            // If the pixel is not black
-            if (pixel->blue != 0 || pixel->green != 0 || pixel->red != 0)
-            {
-                // Increment the length of the current circumference rope
-                length++;
-            }
-            else
-            {
-                // If the current circumference rope is longer than the longest one
-                if (length > max_length)
-                {
-                    // Update the longest circumference rope
-                    max_length = length;
+    span = span_begin();
+    int n_blobs = integral_find_blobs(sat, blobs, MAX_BLOBS);
+    span_end("integral_detect", span);
+    return n_blobs;
+}
 
-                    // Update the center of the circle
-                    *x = j / 20;
-                    *y = (i - length / 2) / 20;
-                }
+// Function handling SIGUSR1, the histograms are written by the main loop
+void request_latency(int signo)
+{
+    dump_latency = 1;
+}
 
-                // Reset the length of the current circumference rope
-                length = 0;
-            }
-        }
-    }
+// Function handling SIGTERM and SIGHUP, sent when master or the terminal closes processB
+void request_quit(int signo)
+{
+    quit_requested = 1;
 }
 
 int main(int argc, char const *argv[])
 {
+    // Names of the log and the shared memory object of the instance of the pipeline passed by master
+    int instance = instance_from_env();
+    char log_path[64], shm_name[64];
+    instance_name("log/processB", ".log", instance, log_path, sizeof(log_path));
+    instance_name(SHM_NAME, "", instance, shm_name, sizeof(shm_name));
+
     // Open the log file
-    logFile = fopen("log/processB.log", "a");
+    logFile = fopen(log_path, "a");
 
     // Get the current time
     time_t t = time(NULL);
     char *timeString = ctime(&t);
     timeString[strlen(timeString) - 1] = '\0';
 
-    // Data structure for storing the bitmap file
-    bmpfile_t *bmp;
+    // Map the shared memory object read-only, waiting for processA to write its header
+    SHARED_HEADER *header = shared_image_attach(shm_name, 5000, PROT_READ);
+    if (header == NULL)
+    {
+        // Log the error
+        fprintf(logFile, "%s - Error while opening shared memory object\n", timeString);
 
-    // Instantiate bitmap with the given parameters
-    bmp = bmp_create(width, height, depth);
+        // Exit with error
+        exit(errno);
+    }
 
-    if (bmp == NULL)
+    // Frame and trajectory ring stored in the shared memory
+    const rgb_pixel_t *ptr = shared_frame(header);
+    TRAJECTORY_RING *ring = shared_ring(header);
+
+    // Replay the trajectory from the oldest position still in the ring
+    RING_CURSOR cursor;
+    ring_cursor_init(ring, &cursor, TRUE);
+
+    // Last replayed position and velocity of the circle in cells per second
+    POSITION_EVENT last_event = {0};
+    double velocity_x = 0, velocity_y = 0;
+
+    // Get the geometry chosen by processA
+    width = header->geometry.width;
+    height = header->geometry.height;
+    scale = header->geometry.scale;
+
+    // Log the geometry and the allocation policy
+    char policy[64];
+    fprintf(logFile, "%s - Image of %dx%d pixels, %d pixels per cell\n", timeString, width, height, scale);
+    fprintf(logFile, "%s - Shared memory policy: %s\n", timeString, policy_to_string(header->policy, policy, sizeof(policy)));
+
+    // Find the objects by labelling the frame, with its integral image or with the pyramid published with it
+    const char *detector = getenv("ARP_DETECTOR");
+    int integral = detector != NULL && strcmp(detector, "sat") == 0;
+    int pyramid = detector != NULL && strcmp(detector, "pyramid") == 0;
+    INTEGRAL_IMAGE sat = {0};
+    PYRAMID_SEARCH search = {0};
+    if ((integral && integral_init(&sat, width, height) == -1) || (pyramid && pyramid_search_init(&search, header->pyramid) == -1))
     {
-        // If the bitmap is not created, log and exit
-        fprintf(logFile, "%s - Error while creating bitmap\n", timeString);
+        // Log the error
+        fprintf(logFile, "%s - Error while allocating the %s\n", timeString, integral ? "integral image" : "pyramid search");
+
+        // Unmap the shared memory object
+        shared_image_detach(header);
 
         exit(1);
     }
 
-    // Shared memory name
-    const char *shm_name = "/SHARED_IMAGE";
-
-    // Size in bytes of shared memory
-    int SHM_SIZE = width * height * sizeof(rgb_pixel_t);
-
-    // Shared memory file descriptor
-    int shm_fd;
+    // Scan the frame directly in the shared memory, or a snapshot copied from it; the pyramid search only reads
+    // the pixels around the objects, so it always reads in place
+    int direct = env_int("ARP_DIRECT_READ", 0) || pyramid;
 
-    // Open the shared memory object
-    if ((shm_fd = shm_open(shm_name, O_CREAT | O_RDWR, 0666)) == -1)
+    // Private snapshot of the frame, copied when processA publishes a new frame
+    rgb_pixel_t *snapshot = NULL;
+    if (!direct)
     {
-        // Log the error
-        fprintf(logFile, "%s - Error while opening shared memory object\n", timeString);
+        snapshot = malloc(header->frame_size);
+        if (snapshot == NULL)
+        {
+            // Log the error
+            fprintf(logFile, "%s - Error while allocating the snapshot\n", timeString);
 
-        // Destroy the bitmap
-        bmp_destroy(bmp);
+            // Unmap the shared memory object
+            shared_image_detach(header);
 
-        // Exit with error
-        exit(errno);
+            exit(1);
+        }
+    }
+
+    // Start the worker pool, with at most one stripe per row
+    int n_workers = pool_size_from_env();
+    if (n_workers > height)
+    {
+        n_workers = height;
     }
+    THREAD_POOL pool;
+    int pool_error = pool_create(&pool, n_workers);
 
-    // Map the shared memory object into the address space of the process
-    rgb_pixel_t *ptr = (rgb_pixel_t *)mmap(0, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
+    // Per-stripe labellers and results
+    STRIPE_JOB job = {ptr, snapshot, direct ? ptr : snapshot, calloc(pool.n_workers, sizeof(LABELLER)), calloc(pool.n_workers, sizeof(int))};
+
+    if (pool_error == -1 || job.labellers == NULL || job.results == NULL)
     {
         // Log the error
-        fprintf(logFile, "%s - Error while mapping shared memory object\n", timeString);
-        // Destroy the bitmap
-        bmp_destroy(bmp);
-        // Close the shared memory object
-        shm_unlink(shm_name); // No need to control the return value because the program is exiting anyway with errno
-        exit(errno);
+        fprintf(logFile, "%s - Error while creating the worker pool\n", timeString);
+        // Free the snapshot
+        free(snapshot);
+        // Unmap the shared memory object
+        shared_image_detach(header);
+        exit(1);
     }
 
+    // Log the number of workers and the read mode
+    fprintf(logFile, "%s - Processing the image with %d worker(s), %s, %s\n", timeString, pool.n_workers,
+            direct ? "directly in the shared memory" : "on a snapshot", integral ? "with its integral image" : pyramid ? "with its pyramid" : "by labelling");
+
     // Utility variable to avoid trigger resize event on launch
     int first_resize = TRUE;
 
     // Initialize UI
     init_console_ui();
 
-    // Variables to store the center of the circle
-    int x, y;
+    // Labeller state and detected objects
+    LABELLER lab = {0};
+    BLOB blobs[MAX_BLOBS];
+    int n_blobs = 0;
+    int prev_n_blobs = -1;
 
-    // Initialize the semaphore
-    sem_t *sem_sh = sem_open(SEM_PATH, O_CREAT, S_IRUSR | S_IWUSR, 1);
-    if (sem_sh == SEM_FAILED)
+    // Register as a reader of the frame, so that processA can log how far behind it is
+    READER reader;
+    if (shared_reader_register(shm_name, header, &reader) == -1)
     {
         // Log the error
-        fprintf(logFile, "%s - Error while opening semaphore\n", timeString);
-        // Destroy the bitmap
-        bmp_destroy(bmp);
+        fprintf(logFile, "%s - Error while registering as a reader of the frame\n", timeString);
+        // Free the snapshot
+        free(snapshot);
         // Unmap the shared memory object
-        munmap(ptr, SHM_SIZE);
-        // Close the shared memory object
-        shm_unlink(shm_name); // No need to control the return value because the program is exiting anyway with errno
+        shared_image_detach(header);
         exit(errno);
     }
 
+    // Histograms of the hops of the inputs shown by the frames, written in the log on SIGUSR1 and when exiting
+    HISTOGRAM latency[HOPS];
+    memset(latency, 0, sizeof(latency));
+    struct sigaction on_usr1;
+    memset(&on_usr1, 0, sizeof(on_usr1));
+    on_usr1.sa_handler = request_latency;
+    sigaction(SIGUSR1, &on_usr1, NULL);
+
+    // Exit cleanly when closed
+    struct sigaction on_quit;
+    memset(&on_quit, 0, sizeof(on_quit));
+    on_quit.sa_handler = request_quit;
+    sigaction(SIGTERM, &on_quit, NULL);
+    sigaction(SIGHUP, &on_quit, NULL);
+
+    // Record the spans of the hot paths, if ARP_TRACE_EVENTS is set
+    trace_events_init("processB");
+
+    // Renderer of the window and last status line written
+    RENDERER renderer;
+    renderer_init(&renderer, env_int("ARP_MAX_FPS", DEFAULT_MAX_FPS), NULL);
+    char prev_status[128] = "";
+
+    // Generation of the processA owning the shared memory, and whether it died while drawing
+    uint32_t generation = header->generation;
+    int waiting_owner = FALSE;
+
     bool error = FALSE;
 
-    // Infinite loop
-    while (TRUE)
+    // Loop until closed
+    while (!quit_requested)
     {
         // Update the current time
         t = time(NULL);
@@ -187,7 +301,7 @@ int main(int argc, char const *argv[])
         timeString[strlen(timeString) - 1] = '\0';
 
         // Get input in non-blocking mode
-        int cmd = getch();
+        int cmd = renderer_getch(&renderer);
 
         // If user resizes screen, re-draw UI...
         if (cmd == KEY_RESIZE)
@@ -199,58 +313,239 @@ int main(int argc, char const *argv[])
             else
             {
                 reset_console_ui();
+
+                // The screen was cleared, draw the status line again
+                prev_status[0] = '\0';
+                renderer_damage(&renderer);
             }
         }
 
         else
         {
-            // Protect the shared memory with a semaphore
-            if (sem_wait(sem_sh) == -1)
+            // Read the frame only if processA published a new one since the last read
+            uint32_t seq;
+            int owner_dead = reader_frame_begin(&reader, &seq) == -1;
+            if (!owner_dead && (seq != reader.slot->seq || reader.slot->frames == 0))
             {
-                // Log the error
-                fprintf(logFile, "%s - Error while taking the semaphore\n", timeString);
-                error = TRUE;
-                break;
+                // Either find the objects directly in the shared memory, or copy the frame, one stripe per worker,
+                // starting again if processA draws the frame meanwhile
+                int retries = 0;
+                int found = n_blobs;
+                FRAME_TRACE trace;
+                RECT dirty;
+                uint64_t read_span = span_begin();
+                while (TRUE)
+                {
+                    trace = header->trace;
+                    dirty = header->dirty;
+                    uint64_t span = span_begin();
+                    if (direct)
+                    {
+                        if (pyramid)
+                        {
+                            found = pyramid_find_blobs(header->pyramid, shared_pyramid(header), ptr, width, height, &search, blobs, MAX_BLOBS);
+                        }
+                        else
+                        {
+                            found = integral ? find_blobs_integral(&sat, ptr, seq, dirty, blobs) : find_blobs(&pool, &job, &lab, blobs);
+                        }
+                        span_end("find_blobs", span);
+                    }
+                    else
+                    {
+                        pool_run(&pool, copy_stripe, &job);
+                        span_end("copy", span);
+                    }
+                    if (!frame_read_retry(header, seq))
+                    {
+                        break;
+                    }
+
+                    // The integral image was computed from a torn frame
+                    sat.valid = FALSE;
+
+                    // processA is drawing a new frame, or died while drawing it
+                    span = span_begin();
+                    owner_dead = reader_frame_begin(&reader, &seq) == -1;
+                    span_end("frame_read_wait", span);
+                    if (owner_dead)
+                    {
+                        break;
+                    }
+                    retries++;
+                }
+
+                // The frame read is torn if processA died while drawing it, keep the objects found before
+                if (!owner_dead)
+                {
+                    reader_slot_done(reader.slot, seq, retries);
+                    span_end("frame_read", read_span);
+                    uint64_t read = monotonic_ns();
+
+                    // Find all the objects in the snapshot
+                    if (direct)
+                    {
+                        n_blobs = found;
+                    }
+                    else
+                    {
+                        uint64_t span = span_begin();
+                        n_blobs = integral ? find_blobs_integral(&sat, snapshot, seq, dirty, blobs) : find_blobs(&pool, &job, &lab, blobs);
+                        span_end("find_blobs", span);
+                    }
+
+                    // Add the hops of the input shown by the frame, the labelling is the detection; the first frame
+                    // read may have been published long before processB started
+                    if (trace.traced && reader.slot->frames > 1)
+                    {
+                        latency_record(latency, &trace, read, monotonic_ns());
+                    }
+                }
             }
 
-            // Erase the bitmap
-            erase_bmp(bmp);
+            // Log when processA dies while drawing, and when a restarted processA takes over the shared memory
+            if (owner_dead && !waiting_owner)
+            {
+                fprintf(logFile, "%s - processA died while drawing the frame, waiting for it to restart\n", timeString);
+                fflush(logFile);
+                waiting_owner = TRUE;
+            }
+            uint32_t owner_generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+            if (owner_generation != generation)
+            {
+                fprintf(logFile, "%s - processA %u took over the shared memory, generation %u\n", timeString, header->owner_pid, owner_generation);
+                fflush(logFile);
+                generation = owner_generation;
+                waiting_owner = FALSE;
+            }
 
-            // Convert the matrix to a bitmap
-            static_to_bmp(ptr, bmp);
+            // Write the histograms if requested
+            if (dump_latency)
+            {
+                dump_latency = 0;
+                latency_log(latency, logFile, timeString);
+            }
 
-            // Release the semaphore
-            if (sem_post(sem_sh) == -1)
+            // Write the spans recorded so far when the buffer is half full
+            trace_events_flush(0);
+            if (n_blobs == -1)
             {
                 // Log the error
-                fprintf(logFile, "%s - Error while releasing the semaphore\n", timeString);
+                fprintf(logFile, "%s - Error while allocating the labelling buffers\n", timeString);
 
                 error = TRUE;
                 break;
             }
 
-            // Find the center of the circle
-            find_center(bmp, &x, &y);
+            // Replay the positions published by processA since the last iteration
+            POSITION_EVENT event;
+            uint64_t lost = cursor.lost;
+            while (ring_read(ring, &cursor, &event))
+            {
+                // Mark the position on the path, if not already marked
+                if ((mvinch(event.y, event.x) & A_CHARTEXT) == ' ')
+                {
+                    mvaddch(event.y, event.x, '.');
+                    renderer_damage(&renderer);
+                }
+
+                // Velocity between the last two positions
+                if (last_event.timestamp != 0 && event.timestamp > last_event.timestamp)
+                {
+                    double dt = (event.timestamp - last_event.timestamp) * 1e-9;
+                    velocity_x = (event.x - last_event.x) / dt;
+                    velocity_y = (event.y - last_event.y) / dt;
+                }
+                last_event = event;
+            }
+
+            // The circle is still if it has not moved for half a second
+            if (monotonic_ns() - last_event.timestamp > 500000000ULL)
+            {
+                velocity_x = 0;
+                velocity_y = 0;
+            }
+
+            // Log the positions overwritten before they could be replayed
+            if (cursor.lost != lost)
+            {
+                fprintf(logFile, "%s - %llu position(s) lost, processB is too slow\n", timeString, (unsigned long long)(cursor.lost - lost));
+            }
+
+            // Mark the center of each object, if not already marked
+            for (int k = 0; k < n_blobs && k < MAX_BLOBS; k++)
+            {
+                int row = blobs[k].center_y / scale;
+                int col = blobs[k].center_x / scale;
+                if ((mvinch(row, col) & A_CHARTEXT) != '0')
+                {
+                    mvaddch(row, col, '0');
+                    renderer_damage(&renderer);
+                }
+            }
+
+            // Show the number of objects and the velocity in the status line, if they changed
+            char status[128];
+            snprintf(status, sizeof(status), "Objects detected: %d   Velocity: %+6.1f, %+6.1f cells/s   ", n_blobs, velocity_x, velocity_y);
+            if (strcmp(status, prev_status) != 0)
+            {
+                mvprintw(LINES - 1, 1, "%s", status);
+                strcpy(prev_status, status);
+                renderer_damage(&renderer);
+            }
+
+            // Write the changes to the terminal, at most once per tick
+            renderer_update(&renderer);
 
-            mvaddch(x, y, '0');
-            refresh();
+            // Log the objects when their number changes
+            if (n_blobs != prev_n_blobs)
+            {
+                fprintf(logFile, "%s - %d object(s) detected\n", timeString, n_blobs);
+                for (int k = 0; k < n_blobs && k < MAX_BLOBS; k++)
+                {
+                    fprintf(logFile, "%s -   object %d: center (%d, %d), box (%d, %d)-(%d, %d), area %d\n",
+                            timeString, k, blobs[k].center_x, blobs[k].center_y,
+                            blobs[k].min_x, blobs[k].min_y, blobs[k].max_x, blobs[k].max_y, blobs[k].area);
+                }
+                fflush(logFile);
+                prev_n_blobs = n_blobs;
+            }
         }
     }
 
     // Store the errno
     int err_no = errno;
 
-    // Free the bitmap
-    bmp_destroy(bmp);
+    // Log the latency of the inputs
+    latency_log(latency, logFile, timeString);
+
+    // Write the last spans
+    trace_events_close();
+
+    // Log the frames read and free the reader slot
+    fprintf(logFile, "%s - %llu frames read, %llu reads started again\n", timeString,
+            (unsigned long long)reader.slot->frames, (unsigned long long)reader.slot->retries);
+    shared_reader_unregister(&reader);
 
-    // Unmap the shared memory object
-    if (munmap(ptr, SHM_SIZE) == -1)
+    // Free the snapshot, the integral image and the pyramid search
+    free(snapshot);
+    integral_destroy(&sat);
+    pyramid_search_destroy(&search);
+
+    // Stop the workers
+    pool_destroy(&pool);
+
+    // Free the labelling buffers
+    labeller_destroy(&lab);
+    for (int k = 0; k < pool.n_workers; k++)
     {
-        exit(errno);
+        labeller_destroy(&job.labellers[k]);
     }
+    free(job.labellers);
+    free(job.results);
 
-    // Close the shared memory object
-    if (shm_unlink(shm_name) == -1)
+    // Unmap the shared memory object, which is left to processA so that a restarted processB can attach to it again
+    if (shared_image_detach(header) == -1)
     {
         exit(errno);
     }